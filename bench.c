@@ -0,0 +1,273 @@
+/* Throughput benchmark for the readers.
+ *
+ * For every file type, record size, and line ending, a corpus of records is
+ * written in memory and read by each of the ways the library offers. One line
+ * of CSV is printed per measurement:
+ *
+ *	type,rec_size,eol,path,bytes,records,seconds,mb_per_s,records_per_s
+ *
+ * The optional argument is the least time in seconds to spend on each
+ * measurement (default 0.1). Built with IHR_STATS, statistics are kept
+ * throughout and printed to stderr at the end. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "ihr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CORPUS_SIZE ((size_t)1 << 22) /* Bytes of data in each corpus */
+#define BLOCK ((size_t)1 << 16) /* Bytes of data written at once */
+#define PIECE ((size_t)1 << 16) /* Bytes of text given to a stream at once */
+
+static const char *const type_names[] = {
+	"i8", "i16", "i32", "s19", "s28", "s37"
+};
+
+static const int rec_sizes[] = {1, 16, 64, IHR_MAX_SIZE};
+
+static char *text;
+static size_t text_len, text_cap;
+static size_t n_records;
+static volatile unsigned long sink; /* Keeps results from being optimized out */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Make sure text has room for two more records. */
+static void reserve_text(void)
+{
+	if (text_cap - text_len < 2 * IHR_MAX_LENGTH) {
+		text_cap = text_cap ? text_cap * 2 : BLOCK * 4;
+		text = realloc(text, text_cap);
+		if (!text) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* Write a corpus of records of at most the given data size into text. Returns
+ * the size used, which can be less for SREC. */
+static int make_corpus(int file_type, int rec_size, int flags)
+{
+	static IHR_U8 data[BLOCK];
+	/* Data are written in blocks at addresses which fit the type: */
+	static const IHR_U32 masks[] = {
+		0xFFFF, 0xFFFFF, 0xFFFFFFFF, 0xFFFF, 0xFFFFFF, 0xFFFFFFFF
+	};
+	struct ihr_writer writer;
+	struct ihr_record rec;
+	size_t done, i;
+	unsigned long seed = 1;
+	for (i = 0; i < BLOCK; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+	ihr_writer_init(&writer, file_type, flags);
+	if (rec_size < writer.rec_size) writer.rec_size = rec_size;
+	text_len = 0;
+	for (done = 0; done < CORPUS_SIZE; done += BLOCK) {
+		IHR_U32 addr = done & masks[file_type];
+		size_t off = 0;
+		while (off < BLOCK) {
+			reserve_text();
+			ihr_write_data(&writer, addr + off, BLOCK - off,
+				data + off, text_cap - text_len,
+				text + text_len);
+			text_len += writer.len;
+			off += writer.used;
+		}
+	}
+	rec.type = file_type <= IHRT_I32 ? IHRR_I_END_OF_FILE
+		: IHRR_S9_START_16 + IHRT_S19 - file_type;
+	rec.addr = 0;
+	reserve_text();
+	text_len += ihr_write(file_type, flags, &rec, text + text_len);
+	return writer.rec_size;
+}
+
+/* Read the corpus a line at a time, as in the README example. */
+static void run_read(int file_type)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	size_t idx = 0;
+	unsigned long sum = 0;
+	while (idx < text_len) {
+		const char *lf = memchr(text + idx, '\n', text_len - idx);
+		size_t end = lf ? (size_t)(lf - text) + 1 : text_len;
+		rec.data.data = data;
+		if (ihr_read(file_type, end - idx, text + idx, &rec) < 0) {
+			fprintf(stderr, "bench: read failed\n");
+			exit(EXIT_FAILURE);
+		}
+		sum += rec.size;
+		idx = end;
+	}
+	sink += sum;
+}
+
+static void run_iter(int file_type)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	unsigned long sum = 0;
+	size_t count = 0;
+	int reclen;
+	ihr_iter_init(&iter, file_type, text_len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) > 0) {
+		sum += rec.size;
+		++count;
+	}
+	if (reclen < 0) {
+		fprintf(stderr, "bench: iter failed\n");
+		exit(EXIT_FAILURE);
+	}
+	n_records = count;
+	sink += sum;
+}
+
+static void run_validate(int file_type)
+{
+	struct ihr_error err;
+	if (ihr_validate(file_type, text_len, text, &err) < 0) {
+		fprintf(stderr, "bench: validate failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void run_scan(int file_type)
+{
+	struct ihr_lines lines;
+	ihr_lines_init(&lines);
+	if (ihr_scan(&lines, file_type, text_len, text) < 0) {
+		fprintf(stderr, "bench: scan failed\n");
+		exit(EXIT_FAILURE);
+	}
+	sink += lines.count;
+	ihr_lines_free(&lines);
+}
+
+static int take_record(void *ctx, const struct ihr_record *rec)
+{
+	*(unsigned long *)ctx += rec->size;
+	return 0;
+}
+
+static void run_stream(int file_type)
+{
+	struct ihr_stream stream;
+	unsigned long sum = 0;
+	size_t idx;
+	ihr_stream_init(&stream, file_type);
+	for (idx = 0; idx < text_len; idx += PIECE) {
+		size_t piece = text_len - idx < PIECE ? text_len - idx : PIECE;
+		if (ihr_stream_feed(&stream, piece, text + idx, take_record,
+				&sum)) {
+			fprintf(stderr, "bench: stream failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	ihr_stream_end(&stream, take_record, &sum);
+	sink += sum;
+}
+
+static void run_image(int file_type, int threads)
+{
+	struct ihr_image img;
+	struct ihr_error err;
+	ihr_image_init(&img, file_type);
+	if (ihr_image_read(&img, text_len, text, threads, &err) < 0) {
+		fprintf(stderr, "bench: image failed\n");
+		exit(EXIT_FAILURE);
+	}
+	sink += img.count;
+	ihr_image_free(&img);
+}
+
+static void run_image_1(int file_type)
+{
+	run_image(file_type, 1);
+}
+
+static void run_image_all(int file_type)
+{
+	run_image(file_type, 0);
+}
+
+static const struct path {
+	const char *name;
+	void (*run)(int file_type);
+} paths[] = {
+	{"read", run_read},
+	{"iter", run_iter},
+	{"validate", run_validate},
+	{"scan", run_scan},
+	{"stream", run_stream},
+	{"image-1", run_image_1},
+	{"image-all", run_image_all}
+};
+
+int main(int argc, char *argv[])
+{
+	double min_time = argc > 1 ? atof(argv[1]) : 0.1;
+	int file_type;
+#ifdef IHR_STATS
+	struct ihr_stats stats;
+	ihr_stats_init(&stats);
+	ihr_stats_use(&stats);
+#endif
+	puts("type,rec_size,eol,path,bytes,records,seconds,mb_per_s,"
+		"records_per_s");
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		size_t s;
+		for (s = 0; s < sizeof(rec_sizes) / sizeof(*rec_sizes); ++s) {
+			int flags;
+			for (flags = 0; flags <= IHRW_CRLF; flags += IHRW_CRLF) {
+				size_t p;
+				int rec_size = make_corpus(file_type,
+					rec_sizes[s], flags);
+				run_iter(file_type);
+				for (p = 0; p < sizeof(paths) / sizeof(*paths);
+						++p) {
+					double start = now(), elapsed;
+					unsigned long runs = 0;
+					do {
+						paths[p].run(file_type);
+						++runs;
+						elapsed = now() - start;
+					} while (elapsed < min_time);
+					elapsed /= runs;
+					printf("%s,%d,%s,%s,%lu,%lu,%.6f,%.1f,%.0f\n",
+						type_names[file_type],
+						rec_size,
+						flags ? "crlf" : "lf",
+						paths[p].name,
+						(unsigned long)text_len,
+						(unsigned long)n_records,
+						elapsed,
+						text_len / elapsed / 1e6,
+						n_records / elapsed);
+					fflush(stdout);
+				}
+			}
+		}
+	}
+#ifdef IHR_STATS
+	fprintf(stderr, "records: %lu\nbytes: %lu\nlines: %lu\n"
+		"ticks: scan %.0f, decode %.0f, place %.0f\n",
+		stats.records[IHRR_I_DATA], stats.bytes, stats.lines,
+		stats.ticks[IHRS_SCAN], stats.ticks[IHRS_DECODE],
+		stats.ticks[IHRS_PLACE]);
+#endif
+	free(text);
+	return 0;
+}
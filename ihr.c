@@ -1,63 +1,109 @@
 #include "ihr.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* SIMD kernels are picked at compile time, except for AVX2 and the CRC
+ * instructions, which are selected at run time where the compiler can target
+ * them per function. Define IHR_NO_SIMD to build only the portable code. */
+#if !defined(IHR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#	include <emmintrin.h>
+#	define HAVE_SSE2 1
+#	if defined(__GNUC__) && (__GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#		include <immintrin.h>
+#		define HAVE_AVX2 1
+#		define HAVE_SSE42 1
+#	endif
+#	if defined(__GNUC__) && __GNUC__ >= 8
+#		define HAVE_PCLMUL 1
+#	endif
+#endif
 
 #define SUCCESS 0
 #define FAILURE -1
 
-/* Convert a hex digit to its integer form, or -1 if the given is not hex.
- * TODO: Do we need to accept lowercase hex? */
+/* Functions called with constant arguments are inlined where the compiler
+ * allows, so that it can specialize them. */
+#ifdef __GNUC__
+#	define ALWAYS_INLINE __inline__ __attribute__((always_inline))
+#else
+#	define ALWAYS_INLINE
+#endif
+
+/* Ways of reading the data of a record: */
+#define READ_COPY 0 /* Into rec->data.data */
+#define READ_IN_PLACE 1 /* Over their own digits */
+#define READ_CHECK 2 /* Nowhere; they are only checked and summed */
+
+/* The value of each hex digit character, or NOT_NIBBLE for the other
+ * characters. Uppercase and lowercase are both accepted. */
+#define NOT_NIBBLE 0x10
+#define XX NOT_NIBBLE
+static const IHR_U8 nibbles[256] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, XX, XX, XX, XX, XX, XX,
+	XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX
+};
+#undef XX
+
+/* Convert a hex digit to its integer form, or -1 if the given is not hex. */
 static int read_nibble(char hex)
 {
-	if ('0' <= hex && hex <= '9') return hex - '0';
-	hex |= 0x20; /* Normalize to lowercase */
-	if ('a' <= hex && hex <= 'f') return 10 + hex - 'a';
-	return FAILURE;
+	int nibble = nibbles[(unsigned char)hex];
+	return nibble & NOT_NIBBLE ? FAILURE : nibble;
 }
 
 /* Convert two hex digits to an unsigned byte, or -1 if a digit was invalid. */
 static int read_u8(const char hex[2])
 {
-	return (read_nibble(hex[0]) << 4) | read_nibble(hex[1]);
+	int high = nibbles[(unsigned char)hex[0]];
+	int low = nibbles[(unsigned char)hex[1]];
+	return (high | low) & NOT_NIBBLE ? FAILURE : high << 4 | low;
 }
 
-/* Returns 1 if the type is valid for the given file type or 0 otherwise. */
-static int ihex_valid_type(int file_type, IHR_U8 type)
-{
-	switch (type) {
-	case IHRR_I_DATA:
-	case IHRR_I_END_OF_FILE:
-		return 1;
-	case IHRR_I_EXT_SEG_ADDR:
-	case IHRR_I_START_SEG_ADDR:
-		return file_type == IHRT_I16;
-	case IHRR_I_EXT_LIN_ADDR:
-	case IHRR_I_START_LIN_ADDR:
-		return file_type == IHRT_I32;
-	default:
-		return 0;
-	}
-}
+#define BIT(type) (1U << (type))
+
+/* The record types valid in each file type, a bit for each. Looking them up
+ * costs no branches, and nothing at all where the file type is known at compile
+ * time. */
+static const unsigned valid_types[] = {
+	/* IHRT_I8: */
+	BIT(IHRR_I_DATA) | BIT(IHRR_I_END_OF_FILE),
+	/* IHRT_I16: */
+	BIT(IHRR_I_DATA) | BIT(IHRR_I_END_OF_FILE) | BIT(IHRR_I_EXT_SEG_ADDR)
+		| BIT(IHRR_I_START_SEG_ADDR),
+	/* IHRT_I32: */
+	BIT(IHRR_I_DATA) | BIT(IHRR_I_END_OF_FILE) | BIT(IHRR_I_EXT_LIN_ADDR)
+		| BIT(IHRR_I_START_LIN_ADDR),
+	/* IHRT_S19: */
+	BIT(IHRR_S0_HEADER) | BIT(IHRR_S5_COUNT_16) | BIT(IHRR_S1_DATA_16)
+		| BIT(IHRR_S9_START_16),
+	/* IHRT_S28: */
+	BIT(IHRR_S0_HEADER) | BIT(IHRR_S5_COUNT_16) | BIT(IHRR_S2_DATA_24)
+		| BIT(IHRR_S8_START_24) | BIT(IHRR_S6_COUNT_24),
+	/* IHRT_S37: */
+	BIT(IHRR_S0_HEADER) | BIT(IHRR_S5_COUNT_16) | BIT(IHRR_S3_DATA_32)
+		| BIT(IHRR_S7_START_32) | BIT(IHRR_S6_COUNT_24)
+};
+
+#undef BIT
 
 /* Returns 1 if the type is valid for the given file type or 0 otherwise. */
-static int srec_valid_type(int file_type, IHR_U8 type)
+static int valid_type(int file_type, IHR_U8 type)
 {
-	switch (type) {
-	case IHRR_S0_HEADER:
-	case IHRR_S5_COUNT_16:
-		return 1;
-	case IHRR_S1_DATA_16:
-	case IHRR_S9_START_16:
-		return file_type == IHRT_S19;
-	case IHRR_S2_DATA_24:
-	case IHRR_S8_START_24:
-		return file_type == IHRT_S28;
-	case IHRR_S3_DATA_32:
-	case IHRR_S7_START_32:
-		return file_type == IHRT_S37;
-	case IHRR_S6_COUNT_24:
-		return file_type != IHRT_S19;
-	default:
-		return 0;
-	}
+	return type < 16 && (valid_types[file_type] >> type & 1);
 }
 
 /* Choose an error code to suit a pair of unparseable digits. Returns
@@ -100,32 +146,318 @@ static int find_line_end(const char *text,
 	return SUCCESS;
 }
 
-static int read_data(const char *text, size_t *idx, struct ihr_record *rec)
+#if HAVE_SSE2
+/* Decode 8 bytes at a time from hex into data, stopping before the first block
+ * with a character that is not a hex digit. The decoded bytes are added to
+ * *sum. Returns the number of bytes decoded, which is a multiple of 8 no
+ * greater than size. */
+static size_t decode_sse2(const char *hex,
+	IHR_U8 *data,
+	size_t size,
+	unsigned *sum)
 {
-	int status = SUCCESS;
-	const char *hex = text + *idx;
-	IHR_U8 i;
-	for (i = 0; i < rec->size; ++i) {
-		const char *pair = hex + i * 2;
-		int byte = read_u8(pair);
-		if (byte < 0) {
-			rec->type = invalid_hex_error(pair);
-			status = FAILURE;
+	const __m128i below_digits = _mm_set1_epi8('0' - 1);
+	const __m128i above_digits = _mm_set1_epi8('9' + 1);
+	const __m128i below_letters = _mm_set1_epi8('a' - 1);
+	const __m128i above_letters = _mm_set1_epi8('f' + 1);
+	const __m128i digit_offset = _mm_set1_epi8('0');
+	const __m128i letter_offset = _mm_set1_epi8('a' - 10);
+	const __m128i lowercase = _mm_set1_epi8(0x20);
+	const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+	__m128i total = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 8 <= size; i += 8) {
+		__m128i chars, lower, digits, letters, nibbles, pairs;
+		chars = _mm_loadu_si128((const __m128i *)(hex + i * 2));
+		/* Characters above 0x7F are negative, so they fail both
+		 * signed range checks: */
+		digits = _mm_and_si128(_mm_cmpgt_epi8(chars, below_digits),
+			_mm_cmplt_epi8(chars, above_digits));
+		lower = _mm_or_si128(chars, lowercase);
+		letters = _mm_and_si128(_mm_cmpgt_epi8(lower, below_letters),
+			_mm_cmplt_epi8(lower, above_letters));
+		if (_mm_movemask_epi8(_mm_or_si128(digits, letters)) != 0xFFFF)
+			break;
+		nibbles = _mm_or_si128(
+			_mm_and_si128(digits, _mm_sub_epi8(chars, digit_offset)),
+			_mm_and_si128(letters,
+				_mm_sub_epi8(lower, letter_offset)));
+		/* Each 16-bit lane holds the high nibble in its low byte and
+		 * the low nibble in its high byte: */
+		pairs = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(nibbles, 4),
+			_mm_srli_epi16(nibbles, 8)), low_bytes);
+		pairs = _mm_packus_epi16(pairs, _mm_setzero_si128());
+		_mm_storel_epi64((__m128i *)(data + i), pairs);
+		total = _mm_add_epi32(total,
+			_mm_sad_epu8(pairs, _mm_setzero_si128()));
+	}
+	*sum += _mm_cvtsi128_si32(total);
+	return i;
+}
+#endif /* HAVE_SSE2 */
+
+#if HAVE_AVX2
+/* Like decode_sse2, but 16 bytes at a time. Only call this if the CPU supports
+ * AVX2. The leftover blocks of 8 are passed on to decode_sse2. */
+__attribute__((target("avx2")))
+static size_t decode_avx2(const char *hex,
+	IHR_U8 *data,
+	size_t size,
+	unsigned *sum)
+{
+	const __m256i below_digits = _mm256_set1_epi8('0' - 1);
+	const __m256i above_digits = _mm256_set1_epi8('9' + 1);
+	const __m256i below_letters = _mm256_set1_epi8('a' - 1);
+	const __m256i above_letters = _mm256_set1_epi8('f' + 1);
+	const __m256i digit_offset = _mm256_set1_epi8('0');
+	const __m256i letter_offset = _mm256_set1_epi8('a' - 10);
+	const __m256i lowercase = _mm256_set1_epi8(0x20);
+	const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+	__m128i total = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m256i chars, lower, digits, letters, nibbles, pairs;
+		chars = _mm256_loadu_si256((const __m256i *)(hex + i * 2));
+		digits = _mm256_and_si256(
+			_mm256_cmpgt_epi8(chars, below_digits),
+			_mm256_cmpgt_epi8(above_digits, chars));
+		lower = _mm256_or_si256(chars, lowercase);
+		letters = _mm256_and_si256(
+			_mm256_cmpgt_epi8(lower, below_letters),
+			_mm256_cmpgt_epi8(above_letters, lower));
+		if (_mm256_movemask_epi8(_mm256_or_si256(digits, letters))
+				!= -1)
+			break;
+		nibbles = _mm256_or_si256(
+			_mm256_and_si256(digits,
+				_mm256_sub_epi8(chars, digit_offset)),
+			_mm256_and_si256(letters,
+				_mm256_sub_epi8(lower, letter_offset)));
+		pairs = _mm256_and_si256(_mm256_or_si256(
+			_mm256_slli_epi16(nibbles, 4),
+			_mm256_srli_epi16(nibbles, 8)), low_bytes);
+		/* Packing works within 128-bit lanes, so gather the low
+		 * quadword of each lane into the bottom half: */
+		pairs = _mm256_permute4x64_epi64(
+			_mm256_packus_epi16(pairs, pairs), 0x08);
+		_mm_storeu_si128((__m128i *)(data + i),
+			_mm256_castsi256_si128(pairs));
+		total = _mm_add_epi32(total, _mm_sad_epu8(
+			_mm256_castsi256_si128(pairs), _mm_setzero_si128()));
+	}
+	/* The sums of the two halves are in separate quadwords: */
+	total = _mm_add_epi32(total, _mm_unpackhi_epi64(total, total));
+	*sum += _mm_cvtsi128_si32(total);
+	return i + decode_sse2(hex + i * 2, data + i, size - i, sum);
+}
+#endif /* HAVE_AVX2 */
+
+#if HAVE_SSE2
+/* Like decode_sse2, but the bytes are only summed, not stored. Each byte is 16
+ * times its high digit plus its low digit, so the sum is worked out from the
+ * sum of all digits and that of the high digits alone. */
+static size_t check_sse2(const char *hex, size_t size, unsigned *sum)
+{
+	const __m128i below_digits = _mm_set1_epi8('0' - 1);
+	const __m128i above_digits = _mm_set1_epi8('9' + 1);
+	const __m128i below_letters = _mm_set1_epi8('a' - 1);
+	const __m128i above_letters = _mm_set1_epi8('f' + 1);
+	const __m128i digit_offset = _mm_set1_epi8('0');
+	const __m128i letter_offset = _mm_set1_epi8('a' - 10);
+	const __m128i lowercase = _mm_set1_epi8(0x20);
+	const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+	__m128i all = _mm_setzero_si128(), high = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 8 <= size; i += 8) {
+		__m128i chars, lower, digits, letters, nibbles;
+		chars = _mm_loadu_si128((const __m128i *)(hex + i * 2));
+		digits = _mm_and_si128(_mm_cmpgt_epi8(chars, below_digits),
+			_mm_cmplt_epi8(chars, above_digits));
+		lower = _mm_or_si128(chars, lowercase);
+		letters = _mm_and_si128(_mm_cmpgt_epi8(lower, below_letters),
+			_mm_cmplt_epi8(lower, above_letters));
+		if (_mm_movemask_epi8(_mm_or_si128(digits, letters)) != 0xFFFF)
+			break;
+		nibbles = _mm_or_si128(
+			_mm_and_si128(digits, _mm_sub_epi8(chars, digit_offset)),
+			_mm_and_si128(letters,
+				_mm_sub_epi8(lower, letter_offset)));
+		all = _mm_add_epi32(all,
+			_mm_sad_epu8(nibbles, _mm_setzero_si128()));
+		high = _mm_add_epi32(high, _mm_sad_epu8(
+			_mm_and_si128(nibbles, low_bytes), _mm_setzero_si128()));
+	}
+	all = _mm_add_epi32(all, _mm_unpackhi_epi64(all, all));
+	high = _mm_add_epi32(high, _mm_unpackhi_epi64(high, high));
+	*sum += _mm_cvtsi128_si32(all) + _mm_cvtsi128_si32(high) * 15;
+	return i;
+}
+#endif /* HAVE_SSE2 */
+
+#if HAVE_AVX2
+/* Like check_sse2, but 16 bytes at a time. Only call this if the CPU supports
+ * AVX2. */
+__attribute__((target("avx2")))
+static size_t check_avx2(const char *hex, size_t size, unsigned *sum)
+{
+	const __m256i below_digits = _mm256_set1_epi8('0' - 1);
+	const __m256i above_digits = _mm256_set1_epi8('9' + 1);
+	const __m256i below_letters = _mm256_set1_epi8('a' - 1);
+	const __m256i above_letters = _mm256_set1_epi8('f' + 1);
+	const __m256i digit_offset = _mm256_set1_epi8('0');
+	const __m256i letter_offset = _mm256_set1_epi8('a' - 10);
+	const __m256i lowercase = _mm256_set1_epi8(0x20);
+	const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+	__m256i all = _mm256_setzero_si256(), high = _mm256_setzero_si256();
+	__m128i total;
+	size_t i;
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m256i chars, lower, digits, letters, nibbles;
+		chars = _mm256_loadu_si256((const __m256i *)(hex + i * 2));
+		digits = _mm256_and_si256(
+			_mm256_cmpgt_epi8(chars, below_digits),
+			_mm256_cmpgt_epi8(above_digits, chars));
+		lower = _mm256_or_si256(chars, lowercase);
+		letters = _mm256_and_si256(
+			_mm256_cmpgt_epi8(lower, below_letters),
+			_mm256_cmpgt_epi8(above_letters, lower));
+		if (_mm256_movemask_epi8(_mm256_or_si256(digits, letters))
+				!= -1)
 			break;
+		nibbles = _mm256_or_si256(
+			_mm256_and_si256(digits,
+				_mm256_sub_epi8(chars, digit_offset)),
+			_mm256_and_si256(letters,
+				_mm256_sub_epi8(lower, letter_offset)));
+		all = _mm256_add_epi32(all,
+			_mm256_sad_epu8(nibbles, _mm256_setzero_si256()));
+		high = _mm256_add_epi32(high, _mm256_sad_epu8(
+			_mm256_and_si256(nibbles, low_bytes),
+			_mm256_setzero_si256()));
+	}
+	/* Each quadword holds part of a sum: */
+	all = _mm256_add_epi32(all, _mm256_slli_epi64(high, 4));
+	all = _mm256_sub_epi32(all, high);
+	total = _mm_add_epi32(_mm256_castsi256_si128(all),
+		_mm256_extracti128_si256(all, 1));
+	total = _mm_add_epi32(total, _mm_unpackhi_epi64(total, total));
+	*sum += _mm_cvtsi128_si32(total);
+	return i + check_sse2(hex + i * 2, size - i, sum);
+}
+#endif /* HAVE_AVX2 */
+
+/* Decode as many whole blocks of bytes as the best available kernel can handle,
+ * adding them to *sum. Returns the number of bytes decoded; the rest are left to
+ * the caller. */
+static size_t decode_blocks(const char *hex,
+	IHR_U8 *data,
+	size_t size,
+	unsigned *sum)
+{
+#if HAVE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return decode_avx2(hex, data, size, sum);
+#endif
+#if HAVE_SSE2
+	return decode_sse2(hex, data, size, sum);
+#else
+	(void)hex;
+	(void)data;
+	(void)size;
+	(void)sum;
+	return 0;
+#endif
+}
+
+/* Like decode_blocks, but the bytes are only summed. */
+static size_t check_blocks(const char *hex, size_t size, unsigned *sum)
+{
+#if HAVE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return check_avx2(hex, size, sum);
+#endif
+#if HAVE_SSE2
+	return check_sse2(hex, size, sum);
+#else
+	(void)hex;
+	(void)size;
+	(void)sum;
+	return 0;
+#endif
+}
+
+/* Decode the data field into rec->data.data and add its bytes to *sum, so that
+ * the checksum can be verified without going over the data again. With
+ * READ_IN_PLACE, the data are instead decoded over their own digits, and
+ * rec->data.data is pointed at them. Each byte is stored before any digits not
+ * yet read, and digits from the first bad pair on are left alone. With
+ * READ_CHECK, the data are only summed. */
+static int read_data(const char *text,
+	size_t *idx,
+	struct ihr_record *rec,
+	unsigned *sum,
+	int mode)
+{
+	const char *hex = text + *idx;
+	IHR_U8 *data = mode == READ_IN_PLACE ? (IHR_U8 *)hex
+		: mode == READ_COPY ? rec->data.data : NULL;
+	unsigned invalid = 0;
+	size_t i = data ? decode_blocks(hex, data, rec->size, sum)
+		: check_blocks(hex, rec->size, sum);
+	if (mode == READ_IN_PLACE) {
+		rec->data.data = data;
+		for (; i < rec->size; ++i) {
+			int byte = read_u8(hex + i * 2);
+			if (byte < 0) {
+				rec->type = invalid_hex_error(hex + i * 2);
+				*idx += i * 2;
+				return FAILURE;
+			}
+			data[i] = byte;
+			*sum += byte;
 		}
-		rec->data.data[i] = byte;
+		*idx += i * 2;
+		return SUCCESS;
 	}
-	*idx += (size_t)i * 2;
-	return status;
+	/* Bad digits are only noted here, keeping the loops free of branches: */
+	if (data) {
+		for (; i < rec->size; ++i) {
+			unsigned high = nibbles[(unsigned char)hex[i * 2]];
+			unsigned low = nibbles[(unsigned char)hex[i * 2 + 1]];
+			IHR_U8 byte = high << 4 | low;
+			invalid |= high | low;
+			data[i] = byte;
+			*sum += byte;
+		}
+	} else {
+		for (; i < rec->size; ++i) {
+			unsigned high = nibbles[(unsigned char)hex[i * 2]];
+			unsigned low = nibbles[(unsigned char)hex[i * 2 + 1]];
+			invalid |= high | low;
+			*sum += (high << 4 | low) & 0xFF;
+		}
+	}
+	if (invalid & NOT_NIBBLE) {
+		/* Go back to find the pair to report: */
+		for (i = 0; read_u8(hex + i * 2) >= 0; ++i);
+		rec->type = invalid_hex_error(hex + i * 2);
+		*idx += i * 2;
+		return FAILURE;
+	}
+	*idx += i * 2;
+	return SUCCESS;
 }
 
+ALWAYS_INLINE
 static int ihex_read(int file_type,
 	size_t len,
 	const char *text,
-	struct ihr_record *rec)
+	struct ihr_record *rec,
+	int mode)
 {
 	size_t idx = 0;
 	int read_cksum;
+	unsigned sum = 0;
 	/* Check that the given text can be a valid record: */
 	if (len < IHR_I_MIN_LENGTH) {
 		rec->type = -IHRE_SUB_MIN_LENGTH;
@@ -156,7 +488,7 @@ static int ihex_read(int file_type,
 		type = read_u8(text + idx);
 		if (type < 0) goto error_not_hex;
 		rec->type = type;
-		if (!ihex_valid_type(file_type, type)) {
+		if (!valid_type(file_type, type)) {
 			rec->type = -IHRE_INVALID_TYPE;
 			goto error;
 		}
@@ -187,7 +519,8 @@ static int ihex_read(int file_type,
 				rec->type = -IHRE_INVALID_SIZE;
 				goto error_invalid_size;
 			}
-			if (read_data(text, &idx, rec)) goto error;
+			if (read_data(text, &idx, rec, &sum, mode))
+				goto error;
 		}
 	}
 	/* Read in the checksum (verification comes later): */
@@ -201,16 +534,13 @@ static int ihex_read(int file_type,
 	/* Verify checksum: */
 	{
 		/* The checksum is the two's complement of the least significant
-		 * byte of the sum of all preceding bytes. */
-		IHR_U8 right_cksum = 0;
-		IHR_U8 i = 0;
+		 * byte of the sum of all preceding bytes. The data were summed
+		 * as they were read. */
+		IHR_U8 right_cksum = sum;
 		right_cksum += rec->size;
 		right_cksum += rec->addr >> 8;
 		right_cksum += rec->addr & 0xFF;
 		right_cksum += rec->type;
-		for (i = 0; i < rec->size; ++i) {
-			right_cksum += rec->data.data[i];
-		}
 		right_cksum = (~right_cksum + 1) & 0xFF;
 		if ((IHR_U8)read_cksum != right_cksum) {
 			rec->type = -IHRE_INVALID_CHECKSUM;
@@ -218,7 +548,7 @@ static int ihex_read(int file_type,
 		}
 	}
 	/* Transfer data from rec->data.data to record-type-specific fields: */
-	{
+	if (mode != READ_CHECK) {
 		IHR_U8 *data = rec->data.data;
 		switch (rec->type) {
 		case IHRR_I_DATA:
@@ -259,33 +589,26 @@ error:
 	return ~idx;
 }
 
-IHR_U8 srec_addr_size(IHR_U8 type)
+/* Returns the number of bytes in the address of an SREC record type. */
+static IHR_U8 srec_addr_size(IHR_U8 type)
 {
-	switch (type) {
-	case IHRR_S0_HEADER:
-	case IHRR_S1_DATA_16:
-	case IHRR_S5_COUNT_16:
-	case IHRR_S9_START_16:
-		return 2;
-	case IHRR_S2_DATA_24:
-	case IHRR_S6_COUNT_24:
-	case IHRR_S8_START_24:
-		return 3;
-	case IHRR_S3_DATA_32:
-	case IHRR_S7_START_32:
-		return 4;
-	}
-	return 2;
+	static const IHR_U8 sizes[16] = {
+		2, 2, 3, 4, 2, 2, 3, 4, 3, 2, 2, 2, 2, 2, 2, 2
+	};
+	return type < 16 ? sizes[type] : 2;
 }
 
-int srec_read(int file_type,
+ALWAYS_INLINE
+static int srec_read(int file_type,
 	size_t len,
 	const char *text,
-	struct ihr_record *rec)
+	struct ihr_record *rec,
+	int mode)
 {
 	size_t idx = 0;
 	int addr_size;
 	int read_cksum;
+	unsigned sum = 0;
 	/* Check that the given text can be a valid record: */
 	if (len < IHR_S_MIN_LENGTH) {
 		rec->type = -IHRE_SUB_MIN_LENGTH;
@@ -304,7 +627,7 @@ int srec_read(int file_type,
 		type = read_nibble(text[idx]);
 		if (type < 0) goto error_not_hex;
 		rec->type = type;
-		if (!srec_valid_type(file_type, type)) {
+		if (!valid_type(file_type, type)) {
 			rec->type = -IHRE_INVALID_TYPE;
 			goto error;
 		}
@@ -318,11 +641,12 @@ int srec_read(int file_type,
 		idx += 2;
 		rec->addr = 0;
 		for (i = 0; i < addr_size; ++i) {
-			int addr = read_u8(text + idx);
+			int addr;
+			if (len < idx + 2) goto error_invalid_size;
+			addr = read_u8(text + idx);
 			if (addr < 0) goto error_not_hex;
 			idx += 2;
-			rec->addr |= addr;
-			rec->addr <<= 8;
+			rec->addr = rec->addr << 8 | addr;
 		}
 	}
 	/* Read data field: */
@@ -334,10 +658,12 @@ int srec_read(int file_type,
 		case IHRR_S3_DATA_32:
 			if (len < idx + ((size_t)rec->size + 1) * 2)
 				goto error_invalid_size;
-			if (read_data(text, &idx, rec)) goto error;
+			if (read_data(text, &idx, rec, &sum, mode))
+				goto error;
 			break;
 		default:
-			if (rec->size != 0) goto error_invalid_size;
+			if (rec->size != 0 || len < idx + 2)
+				goto error_invalid_size;
 			break;
 		}
 	}
@@ -352,18 +678,16 @@ int srec_read(int file_type,
 	/* Verify checksum: */
 	{
 		/* The checksum is the one's complement of the least significant
-		 * byte of the sum of all preceding bytes (not the type.) */
-		IHR_U8 right_cksum = 0;
+		 * byte of the sum of all preceding bytes (not the type.) The
+		 * data were summed as they were read. */
+		IHR_U8 right_cksum = sum;
 		IHR_U32 addr = rec->addr;
-		IHR_U8 i;
+		int i;
 		right_cksum += rec->size + addr_size + 1;
 		for (i = 0; i < addr_size; ++i) {
 			right_cksum += addr & 0xFF;
 			addr >>= 8;
 		}
-		for (i = 0; i < rec->size; ++i) {
-			right_cksum += rec->data.data[i];
-		}
 		right_cksum = ~right_cksum & 0xFF;
 		if ((IHR_U8)read_cksum != right_cksum) {
 			rec->type = -IHRE_INVALID_CHECKSUM;
@@ -387,20 +711,2983 @@ error:
 	return ~idx;
 }
 
+#ifdef IHR_STATS
+/* The statistics being counted by this thread, or NULL. Without thread-local
+ * storage, the worker threads would count into one another's, so statistics
+ * are not built at all: */
+#	ifdef __GNUC__
+static __thread struct ihr_stats *stats_now;
+#	else
+#		error "IHR_STATS needs a compiler with __thread"
+#	endif
+
+/* Only one in this many calls is timed, and counted as this many: */
+#	define STATS_SAMPLE 64
+
+/* Read the processor's tick counter, or return 0 if it cannot be read. */
+static double stats_ticks(void)
+{
+#	if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return (double)__builtin_ia32_rdtsc();
+#	else
+	return 0;
+#	endif
+}
+
+/* Do call, adding the time it takes to phase if it is one of the sample. */
+#	define STATS_TIMED(stats, phase, call) do { \
+	if ((++(stats)->sample & (STATS_SAMPLE - 1)) == 0) { \
+		double start_ = stats_ticks(); \
+		call; \
+		(stats)->ticks[phase] += (stats_ticks() - start_) \
+			* STATS_SAMPLE; \
+	} else { \
+		call; \
+	} \
+} while (0)
+
+void ihr_stats_init(struct ihr_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+void ihr_stats_use(struct ihr_stats *stats)
+{
+	stats_now = stats;
+}
+
+struct ihr_stats *ihr_stats_current(void)
+{
+	return stats_now;
+}
+
+void ihr_stats_merge(struct ihr_stats *dest, const struct ihr_stats *src)
+{
+	int i;
+	for (i = 0; i < IHR_STATS_TYPES; ++i) {
+		dest->records[i] += src->records[i];
+		dest->errors[i] += src->errors[i];
+	}
+	dest->bytes += src->bytes;
+	dest->lines += src->lines;
+	for (i = 0; i < IHRS_PHASES; ++i) dest->ticks[i] += src->ticks[i];
+}
+#endif /* IHR_STATS */
+
+/* A copy of the reader for each file type, with the checks which depend on it
+ * worked out at compile time: */
+#define READER(name, read, file_type) \
+static int name(size_t len, \
+	const char *text, \
+	struct ihr_record *rec, \
+	int mode) \
+{ \
+	return read(file_type, len, text, rec, mode); \
+}
+READER(read_i8, ihex_read, IHRT_I8)
+READER(read_i16, ihex_read, IHRT_I16)
+READER(read_i32, ihex_read, IHRT_I32)
+READER(read_s19, srec_read, IHRT_S19)
+READER(read_s28, srec_read, IHRT_S28)
+READER(read_s37, srec_read, IHRT_S37)
+#undef READER
+
+static int (*const readers[])(size_t, const char *, struct ihr_record *, int)
+	= {read_i8, read_i16, read_i32, read_s19, read_s28, read_s37};
+
+#ifdef IHR_STATS
+/* Read a record as read_record does, counting it in stats. */
+static int read_counted(struct ihr_stats *stats,
+	int file_type,
+	size_t len,
+	const char *text,
+	struct ihr_record *rec,
+	int mode)
+{
+	int reclen;
+	STATS_TIMED(stats, IHRS_DECODE,
+		reclen = readers[file_type](len, text, rec, mode));
+	if (reclen >= 0) {
+		++stats->records[rec->type & (IHR_STATS_TYPES - 1)];
+		stats->bytes += rec->size;
+	} else {
+		++stats->errors[-rec->type & (IHR_STATS_TYPES - 1)];
+	}
+	return reclen;
+}
+#endif /* IHR_STATS */
+
+/* Read a record without counting it. */
+static int read_uncounted(int file_type,
+	size_t len,
+	const char *text,
+	struct ihr_record *rec,
+	int mode)
+{
+	if (file_type < IHRT_I8 || file_type > IHRT_S37) return FAILURE;
+	return readers[file_type](len, text, rec, mode);
+}
+
+static int read_record(int file_type,
+	size_t len,
+	const char *text,
+	struct ihr_record *rec,
+	int mode)
+{
+#ifdef IHR_STATS
+	if (stats_now && file_type >= IHRT_I8 && file_type <= IHRT_S37)
+		return read_counted(stats_now, file_type, len, text, rec, mode);
+#endif
+	return read_uncounted(file_type, len, text, rec, mode);
+}
+
 int ihr_read(int file_type,
 	size_t len,
 	const char *text,
 	struct ihr_record *rec)
+{
+	return read_record(file_type, len, text, rec, READ_COPY);
+}
+
+/* The readers for each file type, which read as ihr_read does. Each has its
+ * own copy of the reader, with no check or lookup of the file type: */
+#ifdef IHR_STATS
+#define PUBLIC_READER(name, read, file_type) \
+int name(size_t len, const char *text, struct ihr_record *rec) \
+{ \
+	if (stats_now) \
+		return read_counted(stats_now, file_type, len, text, rec, \
+			READ_COPY); \
+	return read(file_type, len, text, rec, READ_COPY); \
+}
+#else
+#define PUBLIC_READER(name, read, file_type) \
+int name(size_t len, const char *text, struct ihr_record *rec) \
+{ \
+	return read(file_type, len, text, rec, READ_COPY); \
+}
+#endif /* IHR_STATS */
+PUBLIC_READER(ihr_read_i8, ihex_read, IHRT_I8)
+PUBLIC_READER(ihr_read_i16, ihex_read, IHRT_I16)
+PUBLIC_READER(ihr_read_i32, ihex_read, IHRT_I32)
+PUBLIC_READER(ihr_read_s19, srec_read, IHRT_S19)
+PUBLIC_READER(ihr_read_s28, srec_read, IHRT_S28)
+PUBLIC_READER(ihr_read_s37, srec_read, IHRT_S37)
+#undef PUBLIC_READER
+
+ihr_read_fn *ihr_reader(int file_type)
+{
+	static ihr_read_fn *const public_readers[] = {
+		ihr_read_i8, ihr_read_i16, ihr_read_i32,
+		ihr_read_s19, ihr_read_s28, ihr_read_s37
+	};
+	if (file_type < IHRT_I8 || file_type > IHRT_S37) return NULL;
+	return public_readers[file_type];
+}
+
+int ihr_read_in_place(int file_type,
+	size_t len,
+	char *text,
+	struct ihr_record *rec)
+{
+	return read_record(file_type, len, text, rec, READ_IN_PLACE);
+}
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+#if HAVE_SSE2
+/* Encode 16 bytes at a time from data into hex as pairs of uppercase digits,
+ * adding the bytes to *sum. Returns the number of bytes encoded, which is a
+ * multiple of 16 no greater than size. */
+static size_t encode_sse2(const IHR_U8 *data,
+	size_t size,
+	char *hex,
+	unsigned *sum)
+{
+	const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i digit_offset = _mm_set1_epi8('0');
+	const __m128i letter_gap = _mm_set1_epi8('A' - '0' - 10);
+	__m128i total = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i bytes, high, low, first, second;
+		bytes = _mm_loadu_si128((const __m128i *)(data + i));
+		high = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibbles);
+		low = _mm_and_si128(bytes, low_nibbles);
+		/* Put each high nibble before its low nibble: */
+		first = _mm_unpacklo_epi8(high, low);
+		second = _mm_unpackhi_epi8(high, low);
+		first = _mm_add_epi8(_mm_add_epi8(first, digit_offset),
+			_mm_and_si128(_mm_cmpgt_epi8(first, nine), letter_gap));
+		second = _mm_add_epi8(_mm_add_epi8(second, digit_offset),
+			_mm_and_si128(_mm_cmpgt_epi8(second, nine), letter_gap));
+		_mm_storeu_si128((__m128i *)(hex + i * 2), first);
+		_mm_storeu_si128((__m128i *)(hex + i * 2 + 16), second);
+		total = _mm_add_epi32(total,
+			_mm_sad_epu8(bytes, _mm_setzero_si128()));
+	}
+	total = _mm_add_epi32(total, _mm_unpackhi_epi64(total, total));
+	*sum += _mm_cvtsi128_si32(total);
+	return i;
+}
+#endif /* HAVE_SSE2 */
+
+/* Encode size bytes of data into hex, adding them to *sum. Returns the position
+ * after the digits written. */
+static char *encode_data(const IHR_U8 *data,
+	size_t size,
+	char *hex,
+	unsigned *sum)
+{
+	size_t i = 0;
+#if HAVE_SSE2
+	i = encode_sse2(data, size, hex, sum);
+#endif
+	for (; i < size; ++i) {
+		hex[i * 2] = hex_digits[data[i] >> 4];
+		hex[i * 2 + 1] = hex_digits[data[i] & 0xF];
+		*sum += data[i];
+	}
+	return hex + size * 2;
+}
+
+static char *write_u8(char *text, IHR_U8 byte)
+{
+	text[0] = hex_digits[byte >> 4];
+	text[1] = hex_digits[byte & 0xF];
+	return text + 2;
+}
+
+static char *write_line_end(char *text, int flags)
+{
+	if (flags & IHRW_CRLF) *text++ = '\r';
+	*text++ = '\n';
+	return text;
+}
+
+static int ihex_write(int file_type,
+	int flags,
+	const struct ihr_record *rec,
+	char *text)
+{
+	IHR_U8 fields[4];
+	const IHR_U8 *data = fields;
+	IHR_U8 size;
+	unsigned sum = 0;
+	char *at = text;
+	if (rec->type < 0 || !valid_type(file_type, rec->type))
+		return -IHRE_INVALID_TYPE;
+	/* Take the data from the record-type-specific fields: */
+	switch (rec->type) {
+	case IHRR_I_DATA:
+		data = rec->data.data;
+		size = rec->size;
+		break;
+	case IHRR_I_END_OF_FILE:
+		size = 0;
+		break;
+	case IHRR_I_EXT_SEG_ADDR:
+	case IHRR_I_EXT_LIN_ADDR:
+		fields[0] = rec->data.ihex.base_addr >> 8;
+		fields[1] = rec->data.ihex.base_addr & 0xFF;
+		size = 2;
+		break;
+	case IHRR_I_START_SEG_ADDR:
+		fields[0] = rec->data.ihex.start.code_seg >> 8;
+		fields[1] = rec->data.ihex.start.code_seg & 0xFF;
+		fields[2] = rec->data.ihex.start.instr_ptr >> 8;
+		fields[3] = rec->data.ihex.start.instr_ptr & 0xFF;
+		size = 4;
+		break;
+	default: /* IHRR_I_START_LIN_ADDR */
+		fields[0] = (rec->data.ihex.ext_instr_ptr >> 24) & 0xFF;
+		fields[1] = (rec->data.ihex.ext_instr_ptr >> 16) & 0xFF;
+		fields[2] = (rec->data.ihex.ext_instr_ptr >> 8) & 0xFF;
+		fields[3] = rec->data.ihex.ext_instr_ptr & 0xFF;
+		size = 4;
+		break;
+	}
+	*at++ = ':';
+	at = write_u8(at, size);
+	at = write_u8(at, (rec->addr >> 8) & 0xFF);
+	at = write_u8(at, rec->addr & 0xFF);
+	at = write_u8(at, rec->type);
+	sum = size + ((rec->addr >> 8) & 0xFF) + (rec->addr & 0xFF) + rec->type;
+	at = encode_data(data, size, at, &sum);
+	at = write_u8(at, (~sum + 1) & 0xFF);
+	at = write_line_end(at, flags);
+	return at - text;
+}
+
+static int srec_write(int file_type,
+	int flags,
+	const struct ihr_record *rec,
+	char *text)
+{
+	int addr_size, i;
+	IHR_U8 size = 0;
+	unsigned sum;
+	char *at = text;
+	if (rec->type < 0 || !valid_type(file_type, rec->type))
+		return -IHRE_INVALID_TYPE;
+	addr_size = srec_addr_size(rec->type);
+	switch (rec->type) {
+	case IHRR_S0_HEADER:
+	case IHRR_S1_DATA_16:
+	case IHRR_S2_DATA_24:
+	case IHRR_S3_DATA_32:
+		if (rec->size > IHR_MAX_SIZE - addr_size - 1)
+			return -IHRE_INVALID_SIZE;
+		size = rec->size;
+		break;
+	}
+	*at++ = 'S';
+	*at++ = hex_digits[(int)rec->type];
+	sum = size + addr_size + 1;
+	at = write_u8(at, sum);
+	for (i = addr_size - 1; i >= 0; --i) {
+		IHR_U8 byte = (rec->addr >> i * 8) & 0xFF;
+		at = write_u8(at, byte);
+		sum += byte;
+	}
+	at = encode_data(rec->data.data, size, at, &sum);
+	at = write_u8(at, ~sum & 0xFF);
+	at = write_line_end(at, flags);
+	return at - text;
+}
+
+int ihr_write(int file_type,
+	int flags,
+	const struct ihr_record *rec,
+	char *text)
 {
 	switch (file_type) {
 	case IHRT_I8:
 	case IHRT_I16:
 	case IHRT_I32:
-		return ihex_read(file_type, len, text, rec);
+		return ihex_write(file_type, flags, rec, text);
 	case IHRT_S19:
 	case IHRT_S28:
 	case IHRT_S37:
-		return srec_read(file_type, len, text, rec);
+		return srec_write(file_type, flags, rec, text);
+	}
+	return -IHRE_INVALID_TYPE;
+}
+
+/* Returns the highest address which can be written in the file type. */
+static IHR_U32 max_addr(int file_type)
+{
+	switch (file_type) {
+	case IHRT_I8:
+	case IHRT_S19:
+		return 0xFFFF;
+	case IHRT_I16:
+		return 0xFFFFF;
+	case IHRT_S28:
+		return 0xFFFFFF;
+	default:
+		return 0xFFFFFFFF;
+	}
+}
+
+void ihr_writer_init(struct ihr_writer *writer, int file_type, int flags)
+{
+	writer->file_type = file_type;
+	writer->flags = flags;
+	writer->rec_size = file_type <= IHRT_I32 ? IHR_MAX_SIZE
+		: IHR_MAX_SIZE - srec_addr_size(file_type - IHRT_S19 + 1) - 1;
+	writer->base = 0;
+	writer->len = 0;
+	writer->used = 0;
+}
+
+int ihr_write_data(struct ihr_writer *writer,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data,
+	size_t cap,
+	char *text)
+{
+	int intel = writer->file_type <= IHRT_I32;
+	int eol = writer->flags & IHRW_CRLF ? 2 : 1;
+	IHR_U32 max = max_addr(writer->file_type);
+	struct ihr_record rec;
+	int len;
+	writer->len = 0;
+	writer->used = 0;
+	if (writer->rec_size == 0) return -IHRE_INVALID_SIZE;
+	while (writer->used < size) {
+		IHR_U32 at = (addr + writer->used) & 0xFFFFFFFF;
+		IHR_U32 room;
+		size_t chunk = size - writer->used, need;
+		int new_base = 0;
+		if (at > max) return -IHRE_INVALID_ADDR;
+		if (chunk > writer->rec_size) chunk = writer->rec_size;
+		if (intel) {
+			/* Records cannot cross into the next 64K: */
+			room = 0xFFFF - (at & 0xFFFF);
+			new_base = (at & 0xFFFF0000) != writer->base;
+			need = 1 + 8 + 2 + eol + (new_base ? 1 + 8 + 4 + 2 + eol : 0);
+		} else {
+			room = max - at;
+			need = 2 + 2 + 2 + eol
+				+ srec_addr_size(writer->file_type - IHRT_S19 + 1)
+					* 2;
+		}
+		if (chunk - 1 > room) chunk = (size_t)room + 1;
+		need += chunk * 2;
+		if (cap - writer->len < need) break;
+		if (new_base) {
+			writer->base = at & 0xFFFF0000;
+			rec.type = writer->file_type == IHRT_I16 ?
+				IHRR_I_EXT_SEG_ADDR : IHRR_I_EXT_LIN_ADDR;
+			rec.size = 2;
+			rec.addr = 0;
+			rec.data.ihex.base_addr = writer->file_type == IHRT_I16 ?
+				writer->base >> 4 : writer->base >> 16;
+			len = ihr_write(writer->file_type, writer->flags, &rec,
+				text + writer->len);
+			if (len < 0) return len;
+			writer->len += len;
+		}
+		rec.type = intel ? IHRR_I_DATA
+			: writer->file_type - IHRT_S19 + IHRR_S1_DATA_16;
+		rec.size = chunk;
+		rec.addr = intel ? at & 0xFFFF : at;
+		rec.data.data = (IHR_U8 *)data + writer->used;
+		len = ihr_write(writer->file_type, writer->flags, &rec,
+			text + writer->len);
+		if (len < 0) return len;
+		writer->len += len;
+		writer->used += chunk;
+	}
+	return 0;
+}
+
+/* ihr_detect looks at the types of the records in this many bytes at the start
+ * of the text and this many at the end. */
+#define DETECT_HEAD ((size_t)1 << 16)
+#define DETECT_TAIL ((size_t)1 << 12)
+
+/* Record types seen by ihr_detect: */
+#define SEEN_I16 0x01
+#define SEEN_I32 0x02
+#define SEEN_S19 0x04
+#define SEEN_S28 0x08
+#define SEEN_S37 0x10
+#define SEEN_S6 0x20
+
+/* Note the types of the records starting in text from start to end. */
+static int detect_types(size_t len, const char *text, size_t start, size_t end)
+{
+	int seen = 0;
+	size_t idx = start;
+	while (idx < end) {
+		if (text[idx] == ':' && len - idx >= 9) {
+			switch (read_u8(text + idx + 7)) {
+			case IHRR_I_EXT_SEG_ADDR:
+			case IHRR_I_START_SEG_ADDR:
+				seen |= SEEN_I16;
+				break;
+			case IHRR_I_EXT_LIN_ADDR:
+			case IHRR_I_START_LIN_ADDR:
+				seen |= SEEN_I32;
+				break;
+			}
+		} else if (text[idx] == 'S' && len - idx >= 2) {
+			switch (read_nibble(text[idx + 1])) {
+			case IHRR_S1_DATA_16:
+			case IHRR_S9_START_16:
+				seen |= SEEN_S19;
+				break;
+			case IHRR_S2_DATA_24:
+			case IHRR_S8_START_24:
+				seen |= SEEN_S28;
+				break;
+			case IHRR_S3_DATA_32:
+			case IHRR_S7_START_32:
+				seen |= SEEN_S37;
+				break;
+			case IHRR_S6_COUNT_24:
+				seen |= SEEN_S6;
+				break;
+			}
+		}
+		/* Go to the start of the next line: */
+		while (idx < end && text[idx] != '\n' && text[idx] != '\r') ++idx;
+		while (idx < end && (text[idx] == '\n' || text[idx] == '\r')) ++idx;
+	}
+	return seen;
+}
+
+int ihr_detect(size_t len, const char *text)
+{
+	size_t start = 0, head_end, tail_start;
+	int seen;
+	while (start < len && (text[start] == '\n' || text[start] == '\r'))
+		++start;
+	if (start >= len || (text[start] != ':' && text[start] != 'S'))
+		return -IHRE_MISSING_START;
+	head_end = len - start > DETECT_HEAD ? start + DETECT_HEAD : len;
+	seen = detect_types(len, text, start, head_end);
+	if (len - head_end > DETECT_TAIL) {
+		/* Start from the first whole line in the tail: */
+		tail_start = len - DETECT_TAIL;
+		while (tail_start < len && text[tail_start - 1] != '\n'
+		    && text[tail_start - 1] != '\r') ++tail_start;
+	} else {
+		tail_start = head_end;
+	}
+	seen |= detect_types(len, text, tail_start, len);
+	/* Pick the narrowest subset which allows every type seen: */
+	if (text[start] == ':') {
+		if (seen == 0) return IHRT_I8;
+		if (seen == SEEN_I16) return IHRT_I16;
+		if (seen == SEEN_I32) return IHRT_I32;
+	} else {
+		if (seen == 0 || seen == SEEN_S19) return IHRT_S19;
+		if ((seen & ~SEEN_S6) == 0 || (seen & ~SEEN_S6) == SEEN_S28)
+			return IHRT_S28;
+		if ((seen & ~SEEN_S6) == SEEN_S37) return IHRT_S37;
+	}
+	return -IHRE_INVALID_TYPE;
+}
+
+/* Returns 1 if the record has data to be placed in memory, or 0 otherwise. */
+static int is_data(int file_type, int type)
+{
+	if (file_type <= IHRT_I32) return type == IHRR_I_DATA;
+	return type == IHRR_S1_DATA_16 || type == IHRR_S2_DATA_24
+		|| type == IHRR_S3_DATA_32;
+}
+
+/* Tables for updating the reflected CRC-32 and CRC-32C a byte at a time: */
+static const IHR_U32 crc32_table[256] = {
+	0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA,
+	0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+	0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+	0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+	0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE,
+	0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+	0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC,
+	0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+	0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+	0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+	0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940,
+	0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+	0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116,
+	0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+	0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+	0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+	0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A,
+	0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+	0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818,
+	0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+	0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+	0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+	0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C,
+	0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+	0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2,
+	0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+	0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+	0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+	0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086,
+	0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+	0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4,
+	0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+	0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+	0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+	0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8,
+	0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+	0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE,
+	0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+	0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+	0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+	0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252,
+	0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+	0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60,
+	0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+	0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+	0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+	0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04,
+	0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+	0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A,
+	0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+	0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+	0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+	0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E,
+	0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+	0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C,
+	0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+	0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+	0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+	0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0,
+	0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+	0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6,
+	0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+	0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+	0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+static const IHR_U32 crc32c_table[256] = {
+	0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4,
+	0xC79A971F, 0x35F1141C, 0x26A1E7E8, 0xD4CA64EB,
+	0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B,
+	0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24,
+	0x105EC76F, 0xE235446C, 0xF165B798, 0x030E349B,
+	0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+	0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54,
+	0x5D1D08BF, 0xAF768BBC, 0xBC267848, 0x4E4DFB4B,
+	0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A,
+	0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35,
+	0xAA64D611, 0x580F5512, 0x4B5FA6E6, 0xB93425E5,
+	0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+	0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45,
+	0xF779DEAE, 0x05125DAD, 0x1642AE59, 0xE4292D5A,
+	0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A,
+	0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595,
+	0x417B1DBC, 0xB3109EBF, 0xA0406D4B, 0x522BEE48,
+	0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+	0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687,
+	0x0C38D26C, 0xFE53516F, 0xED03A29B, 0x1F682198,
+	0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927,
+	0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38,
+	0xDBFC821C, 0x2997011F, 0x3AC7F2EB, 0xC8AC71E8,
+	0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+	0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096,
+	0xA65C047D, 0x5437877E, 0x4767748A, 0xB50CF789,
+	0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859,
+	0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46,
+	0x7198540D, 0x83F3D70E, 0x90A324FA, 0x62C8A7F9,
+	0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+	0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36,
+	0x3CDB9BDD, 0xCEB018DE, 0xDDE0EB2A, 0x2F8B6829,
+	0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C,
+	0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93,
+	0x082F63B7, 0xFA44E0B4, 0xE9141340, 0x1B7F9043,
+	0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+	0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3,
+	0x55326B08, 0xA759E80B, 0xB4091BFF, 0x466298FC,
+	0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C,
+	0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033,
+	0xA24BB5A6, 0x502036A5, 0x4370C551, 0xB11B4652,
+	0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+	0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D,
+	0xEF087A76, 0x1D63F975, 0x0E330A81, 0xFC588982,
+	0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D,
+	0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622,
+	0x38CC2A06, 0xCAA7A905, 0xD9F75AF1, 0x2B9CD9F2,
+	0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+	0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530,
+	0x0417B1DB, 0xF67C32D8, 0xE52CC12C, 0x1747422F,
+	0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF,
+	0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0,
+	0xD3D3E1AB, 0x21B862A8, 0x32E8915C, 0xC083125F,
+	0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+	0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90,
+	0x9E902E7B, 0x6CFBAD78, 0x7FAB5E8C, 0x8DC0DD8F,
+	0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE,
+	0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1,
+	0x69E9F0D5, 0x9B8273D6, 0x88D28022, 0x7AB90321,
+	0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+	0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81,
+	0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
+	0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E,
+	0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351
+};
+
+static IHR_U32 crc_bytes(const IHR_U32 table[256],
+	IHR_U32 crc,
+	const IHR_U8 *data,
+	size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; ++i) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ crc >> 8;
+	}
+	return crc;
+}
+
+#if HAVE_PCLMUL
+/* Update a CRC-32 with carry-less multiplication, folding four blocks of 16
+ * bytes at a time. Only call this if the CPU supports PCLMULQDQ and SSE4.1.
+ * size must be a multiple of 16 and at least 64. */
+__attribute__((target("pclmul,sse4.1")))
+static IHR_U32 crc32_pclmul(IHR_U32 crc, const IHR_U8 *data, size_t size)
+{
+	const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xC6E41596,
+		0x00000001, 0x54442BD4);
+	const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xCCAA009E,
+		0x00000001, 0x751997D0);
+	const __m128i k5 = _mm_set_epi32(0, 0, 0x00000001, 0x63CD6124);
+	const __m128i poly = _mm_set_epi32(0x00000001, 0xF7011641,
+		0x00000001, 0xDB710641);
+	const __m128i low32 = _mm_set_epi32(0, ~0, 0, ~0);
+	__m128i x1, x2, x3, x4, t;
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)data),
+		_mm_cvtsi32_si128(crc));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 16));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 32));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 48));
+	for (data += 64, size -= 64; size >= 64; data += 64, size -= 64) {
+#define FOLD(x, k, next) _mm_xor_si128(_mm_xor_si128( \
+		_mm_clmulepi64_si128((x), (k), 0x00), \
+		_mm_clmulepi64_si128((x), (k), 0x11)), (next))
+		x1 = FOLD(x1, k1k2, _mm_loadu_si128((const __m128i *)data));
+		x2 = FOLD(x2, k1k2,
+			_mm_loadu_si128((const __m128i *)(data + 16)));
+		x3 = FOLD(x3, k1k2,
+			_mm_loadu_si128((const __m128i *)(data + 32)));
+		x4 = FOLD(x4, k1k2,
+			_mm_loadu_si128((const __m128i *)(data + 48)));
+	}
+	/* Fold the four blocks into one, then fold in any blocks left: */
+	x1 = FOLD(x1, k3k4, x2);
+	x1 = FOLD(x1, k3k4, x3);
+	x1 = FOLD(x1, k3k4, x4);
+	for (; size >= 16; data += 16, size -= 16) {
+		x1 = FOLD(x1, k3k4, _mm_loadu_si128((const __m128i *)data));
+	}
+#undef FOLD
+	/* Fold 128 bits down to 64, then reduce to 32 (Barrett reduction): */
+	t = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+	t = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5,
+		0x00), t);
+	t = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+	return _mm_extract_epi32(_mm_xor_si128(x1, t), 1);
+}
+#endif /* HAVE_PCLMUL */
+
+#if HAVE_SSE42
+/* Update a CRC-32C with the instruction for it, 8 bytes at a time where
+ * possible. Only call this if the CPU supports SSE4.2. */
+__attribute__((target("sse4.2")))
+static IHR_U32 crc32c_sse42(IHR_U32 crc, const IHR_U8 *data, size_t size)
+{
+	size_t i = 0;
+#if defined(__x86_64__) && ULONG_MAX > 0xFFFFFFFF
+	unsigned long wide = crc;
+	for (; i + 8 <= size; i += 8) {
+		unsigned long word;
+		memcpy(&word, data + i, 8);
+		wide = _mm_crc32_u64(wide, word);
+	}
+	crc = wide;
+#endif
+	for (; i + 4 <= size; i += 4) {
+		unsigned word;
+		memcpy(&word, data + i, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+	for (; i < size; ++i) {
+		crc = _mm_crc32_u8(crc, data[i]);
+	}
+	return crc;
+}
+#endif /* HAVE_SSE42 */
+
+/* Update the CRCs which are not inverted, using the best available way. */
+static IHR_U32 update_crc32(IHR_U32 crc, const IHR_U8 *data, size_t size)
+{
+	size_t done = 0;
+#if HAVE_PCLMUL
+	if (size >= 64 && __builtin_cpu_supports("pclmul")
+	 && __builtin_cpu_supports("sse4.1")) {
+		done = size - size % 16;
+		crc = crc32_pclmul(crc, data, done);
+	}
+#endif
+	return crc_bytes(crc32_table, crc, data + done, size - done);
+}
+
+static IHR_U32 update_crc32c(IHR_U32 crc, const IHR_U8 *data, size_t size)
+{
+#if HAVE_SSE42
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_sse42(crc, data, size);
+#endif
+	return crc_bytes(crc32c_table, crc, data, size);
+}
+
+static const IHR_U32 sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROTR(x, n) (((x) >> (n) | (x) << (32 - (n))) & 0xFFFFFFFF)
+
+/* Run the SHA-256 compression function on each 64-byte block of data. */
+static void sha256_blocks(IHR_U32 state[8], const IHR_U8 *data, size_t size)
+{
+	IHR_U32 w[64];
+	for (; size >= 64; data += 64, size -= 64) {
+		IHR_U32 a = state[0], b = state[1], c = state[2], d = state[3];
+		IHR_U32 e = state[4], f = state[5], g = state[6], h = state[7];
+		int i;
+		for (i = 0; i < 16; ++i) {
+			w[i] = (IHR_U32)data[i * 4] << 24
+				| (IHR_U32)data[i * 4 + 1] << 16
+				| (IHR_U32)data[i * 4 + 2] << 8
+				| (IHR_U32)data[i * 4 + 3];
+		}
+		for (; i < 64; ++i) {
+			IHR_U32 s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18)
+				^ w[i - 15] >> 3;
+			IHR_U32 s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19)
+				^ w[i - 2] >> 10;
+			w[i] = (w[i - 16] + s0 + w[i - 7] + s1) & 0xFFFFFFFF;
+		}
+		for (i = 0; i < 64; ++i) {
+			IHR_U32 t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25))
+				+ ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			IHR_U32 t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22))
+				+ ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = (d + t1) & 0xFFFFFFFF;
+			d = c;
+			c = b;
+			b = a;
+			a = (t1 + t2) & 0xFFFFFFFF;
+		}
+		state[0] = (state[0] + a) & 0xFFFFFFFF;
+		state[1] = (state[1] + b) & 0xFFFFFFFF;
+		state[2] = (state[2] + c) & 0xFFFFFFFF;
+		state[3] = (state[3] + d) & 0xFFFFFFFF;
+		state[4] = (state[4] + e) & 0xFFFFFFFF;
+		state[5] = (state[5] + f) & 0xFFFFFFFF;
+		state[6] = (state[6] + g) & 0xFFFFFFFF;
+		state[7] = (state[7] + h) & 0xFFFFFFFF;
+	}
+}
+
+#undef ROTR
+
+/* Give data to each digest. SHA-256 only takes whole blocks, so size must be a
+ * multiple of 64 unless the digest is being ended. */
+static void digest_bytes(struct ihr_digest *digest,
+	const IHR_U8 *data,
+	size_t size)
+{
+	if (digest->flags & IHRD_CRC32)
+		digest->crc[0] = update_crc32(digest->crc[0], data, size);
+	if (digest->flags & IHRD_CRC32C)
+		digest->crc[1] = update_crc32c(digest->crc[1], data, size);
+	if (digest->flags & IHRD_SHA256)
+		sha256_blocks(digest->state, data, size);
+}
+
+void ihr_digest_init(struct ihr_digest *digest, int flags)
+{
+	static const IHR_U32 sha256_init[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+		0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+	};
+	digest->flags = flags;
+	digest->crc32 = 0;
+	digest->crc32c = 0;
+	memset(digest->sha256, 0, sizeof(digest->sha256));
+	digest->crc[0] = 0xFFFFFFFF;
+	digest->crc[1] = 0xFFFFFFFF;
+	memcpy(digest->state, sha256_init, sizeof(sha256_init));
+	digest->count[0] = 0;
+	digest->count[1] = 0;
+	digest->used = 0;
+}
+
+void ihr_digest_update(struct ihr_digest *digest,
+	size_t size,
+	const IHR_U8 *data)
+{
+	IHR_U32 low = size & 0xFFFFFFFF;
+	size_t whole;
+	/* The count is 64 bits, kept in two halves: */
+	digest->count[0] = (digest->count[0] + low) & 0xFFFFFFFF;
+	digest->count[1] = (digest->count[1] + (IHR_U32)(size >> 16 >> 16)
+		+ (digest->count[0] < low)) & 0xFFFFFFFF;
+	/* Small pieces, such as the data of a record, are gathered in buf so
+	 * that the CRC kernels get long runs: */
+	if (size < IHR_DIGEST_BUF - digest->used) {
+		memcpy(digest->buf + digest->used, data, size);
+		digest->used += size;
+		return;
 	}
-	return FAILURE; /* It is undefined behavior to reach here. */
+	if (digest->used > 0) {
+		size_t part = IHR_DIGEST_BUF - digest->used;
+		memcpy(digest->buf + digest->used, data, part);
+		digest_bytes(digest, digest->buf, IHR_DIGEST_BUF);
+		data += part;
+		size -= part;
+	}
+	whole = size - size % 64;
+	digest_bytes(digest, data, whole);
+	digest->used = size - whole;
+	memcpy(digest->buf, data + whole, digest->used);
+}
+
+void ihr_digest_end(struct ihr_digest *digest)
+{
+	IHR_U8 *buf = digest->buf;
+	size_t used = digest->used, whole = used - used % 64, pad;
+	IHR_U32 high = (digest->count[1] << 3 | digest->count[0] >> 29)
+		& 0xFFFFFFFF;
+	IHR_U32 low = (digest->count[0] << 3) & 0xFFFFFFFF;
+	int i;
+	digest_bytes(digest, buf, used);
+	digest->crc32 = ~digest->crc[0] & 0xFFFFFFFF;
+	digest->crc32c = ~digest->crc[1] & 0xFFFFFFFF;
+	if (!(digest->flags & IHRD_SHA256)) return;
+	/* Pad the last block with a one bit, zeros, and the length in bits: */
+	used -= whole;
+	memmove(buf, buf + whole, used);
+	pad = used < 56 ? 64 : 128;
+	buf[used++] = 0x80;
+	memset(buf + used, 0, pad - used);
+	for (i = 0; i < 4; ++i) {
+		buf[pad - 8 + i] = high >> (24 - i * 8) & 0xFF;
+		buf[pad - 4 + i] = low >> (24 - i * 8) & 0xFF;
+	}
+	sha256_blocks(digest->state, buf, pad);
+	for (i = 0; i < 32; ++i) {
+		digest->sha256[i] = digest->state[i / 4] >> (24 - i % 4 * 8)
+			& 0xFF;
+	}
+}
+
+/* Give count copies of byte to the digest. */
+static void digest_fill(struct ihr_digest *digest, IHR_U8 byte, IHR_U32 count)
+{
+	IHR_U8 fill[IHR_DIGEST_BUF];
+	memset(fill, byte, sizeof(fill));
+	while (count > 0) {
+		size_t part = count < sizeof(fill) ? count : sizeof(fill);
+		ihr_digest_update(digest, part, fill);
+		count -= part;
+	}
+}
+
+void ihr_iter_init(struct ihr_iter *iter,
+	int file_type,
+	size_t len,
+	const char *text,
+	IHR_U8 *data)
+{
+	iter->file_type = file_type;
+	iter->len = len;
+	iter->text = text;
+	iter->data = data;
+	iter->offset = 0;
+	iter->next = 0;
+	iter->line = 0;
+	iter->digest = NULL;
+	iter->end = len;
+	iter->in_place = 0;
+}
+
+void ihr_iter_init_in_place(struct ihr_iter *iter,
+	int file_type,
+	size_t len,
+	char *text)
+{
+	ihr_iter_init(iter, file_type, len, text, NULL);
+	iter->in_place = 1;
+}
+
+/* Read the next record as ihr_iter_next does, with the data read as mode says. */
+static int next_record(struct ihr_iter *iter, struct ihr_record *rec, int mode)
+{
+	const char *text = iter->text;
+	size_t len = iter->len;
+	size_t idx = iter->next;
+	size_t line = iter->line + 1;
+	int reclen;
+#ifdef IHR_STATS
+	struct ihr_stats *stats = stats_now;
+#endif
+	/* Skip blank lines, counting them as find_line_end would: */
+	for (; idx < iter->end; ++idx) {
+		if (text[idx] == '\r') {
+			if (idx + 1 < len && text[idx + 1] == '\n') ++idx;
+		} else if (text[idx] != '\n') {
+			break;
+		}
+		++line;
+	}
+#ifdef IHR_STATS
+	/* The end of the text is not a line: */
+	if (stats) stats->lines += line - iter->line - (idx >= iter->end);
+#endif
+	iter->offset = idx;
+	iter->line = line;
+	if (idx >= iter->end) {
+		iter->next = idx;
+		return 0;
+	}
+	rec->data.data = iter->data;
+#ifdef IHR_STATS
+	if (stats && iter->file_type >= IHRT_I8 && iter->file_type <= IHRT_S37)
+		reclen = read_counted(stats, iter->file_type, len - idx,
+			text + idx, rec, mode);
+	else
+#endif
+		reclen = read_uncounted(iter->file_type, len - idx, text + idx,
+			rec, mode);
+	if (reclen >= 0) {
+		iter->next = idx + reclen;
+		/* The data are digested while they are still in the cache: */
+		if (iter->digest && mode != READ_CHECK
+		 && is_data(iter->file_type, rec->type))
+			ihr_digest_update(iter->digest, rec->size,
+				rec->data.data);
+	} else if (rec->type == -IHRE_INVALID_CHECKSUM) {
+		/* The checksum is checked after the line ending is read: */
+		iter->next = idx + ~reclen;
+	} else {
+		/* Skip the rest of the line so that reading can go on. Only
+		 * digits come before the place of the error, so the search
+		 * starts there, after any data decoded in place: */
+		idx += ~reclen;
+		while (idx < len && text[idx] != '\n' && text[idx] != '\r')
+			++idx;
+		if (idx < len && text[idx] == '\r') ++idx;
+		if (idx < len && text[idx] == '\n') ++idx;
+		iter->next = idx;
+	}
+	return reclen;
+}
+
+int ihr_iter_next(struct ihr_iter *iter, struct ihr_record *rec)
+{
+	return next_record(iter, rec, iter->data ? READ_COPY
+		: iter->in_place ? READ_IN_PLACE : READ_CHECK);
+}
+
+int ihr_validate(int file_type,
+	size_t len,
+	const char *text,
+	struct ihr_error *err)
+{
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	int reclen;
+	err->code = 0;
+	err->line = 0;
+	err->column = 0;
+	ihr_iter_init(&iter, file_type, len, text, NULL);
+	while ((reclen = next_record(&iter, &rec, READ_CHECK)) > 0);
+	if (reclen < 0) {
+		err->code = -rec.type;
+		err->line = iter.line;
+		err->column = ~reclen;
+		return rec.type;
+	}
+	return 0;
+}
+
+int ihr_batch_init(struct ihr_batch *batch, size_t cap)
+{
+	/* Bytes for each record, with room for the most data it can have: */
+	size_t per_record = sizeof(size_t) + sizeof(IHR_U32) + 2 + IHR_MAX_SIZE;
+	char *mem = NULL;
+	if (cap > 0) {
+		if (cap > (size_t)-1 / per_record) return -IHRE_NO_MEMORY;
+		mem = malloc(cap * per_record);
+		if (!mem) return -IHRE_NO_MEMORY;
+	}
+	batch->cap = cap;
+	batch->count = 0;
+	/* The arrays are laid out in order of alignment: */
+	batch->offsets = (size_t *)mem;
+	batch->addrs = (IHR_U32 *)(mem + cap * sizeof(size_t));
+	batch->sizes = (IHR_U8 *)(batch->addrs + cap);
+	batch->types = (char *)(batch->sizes + cap);
+	batch->data = (IHR_U8 *)(batch->types + cap);
+	batch->data_len = 0;
+	batch->err.code = 0;
+	batch->err.line = 0;
+	batch->err.column = 0;
+	return 0;
+}
+
+int ihr_read_batch(struct ihr_iter *iter, struct ihr_batch *batch)
+{
+	IHR_U8 *data = iter->data;
+	struct ihr_record rec;
+	int reclen = 0;
+	batch->count = 0;
+	batch->data_len = 0;
+	batch->err.code = 0;
+	batch->err.line = 0;
+	batch->err.column = 0;
+	while (batch->count < batch->cap) {
+		size_t i = batch->count;
+		/* Decode the data straight into the arena: */
+		iter->data = batch->data + batch->data_len;
+		if ((reclen = ihr_iter_next(iter, &rec)) <= 0) break;
+		batch->offsets[i] = batch->data_len;
+		batch->addrs[i] = rec.addr;
+		batch->sizes[i] = rec.size;
+		batch->types[i] = rec.type;
+		batch->data_len += rec.size;
+		++batch->count;
+	}
+	iter->data = data;
+	if (reclen < 0) {
+		batch->err.code = -rec.type;
+		batch->err.line = iter->line;
+		batch->err.column = ~reclen;
+		return rec.type;
+	}
+	return 0;
+}
+
+void ihr_batch_free(struct ihr_batch *batch)
+{
+	free(batch->offsets);
+	ihr_batch_init(batch, 0);
+}
+
+void ihr_lines_init(struct ihr_lines *lines)
+{
+	lines->starts = NULL;
+	lines->numbers = NULL;
+	lines->count = 0;
+	lines->cap = 0;
+	lines->stray = 0;
+}
+
+/* Make room for one more entry in each array, with one more in starts for the
+ * length of the text at the end. */
+static int reserve_line(struct ihr_lines *lines)
+{
+	size_t cap;
+	size_t *starts, *numbers;
+	if (lines->count < lines->cap) return SUCCESS;
+	cap = lines->cap ? lines->cap * 2 : 256;
+	if (cap > (size_t)-1 / sizeof(size_t) - 1) return FAILURE;
+	starts = realloc(lines->starts, (cap + 1) * sizeof(*starts));
+	if (!starts) return FAILURE;
+	lines->starts = starts;
+	numbers = realloc(lines->numbers, cap * sizeof(*numbers));
+	if (!numbers) return FAILURE;
+	lines->numbers = numbers;
+	lines->cap = cap;
+	return SUCCESS;
+}
+
+/* The state of a scan between line ending characters. */
+struct scan {
+	struct ihr_lines *lines;
+	const char *text;
+	char start; /* What records start with */
+	size_t next; /* Offset after the last line ending character */
+	size_t line; /* Number of the line at next */
+};
+
+/* Note the line from scan->next to end, if it is not blank. */
+static int scan_line(struct scan *scan, size_t end)
+{
+	struct ihr_lines *lines = scan->lines;
+	if (end == scan->next) return SUCCESS;
+	if (reserve_line(lines)) return FAILURE;
+	if (scan->text[scan->next] != scan->start && lines->stray == (size_t)-1)
+		lines->stray = lines->count;
+	lines->starts[lines->count] = scan->next;
+	lines->numbers[lines->count] = scan->line;
+	++lines->count;
+	return SUCCESS;
+}
+
+/* Note the line which ends at the line ending character at, and count the line
+ * ending as ihr_iter does. */
+static int scan_eol(struct scan *scan, size_t at)
+{
+	const char *text = scan->text;
+	if (scan_line(scan, at)) return FAILURE;
+	/* "\r\n" is a single line ending: */
+	if (text[at] == '\r' || at == 0 || text[at - 1] != '\r') ++scan->line;
+	scan->next = at + 1;
+	return SUCCESS;
+}
+
+#if HAVE_SSE2
+/* The index of the lowest bit set in mask, which must not be 0. */
+static int low_bit(unsigned mask)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(mask);
+#else
+	int bit = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++bit;
+	}
+	return bit;
+#endif
+}
+
+/* Go through each line ending character in mask, which has a bit for each of
+ * the characters from at on. */
+#define SCAN_MASK(scan, mask, at) do { \
+	while (mask) { \
+		if (scan_eol((scan), (at) + low_bit(mask))) \
+			return FAILURE; \
+		mask &= mask - 1; \
+	} \
+} while (0)
+
+/* Find the line ending characters 16 at a time, setting *done to the number of
+ * characters looked at, a multiple of 16. Returns FAILURE if memory ran out. */
+static int scan_sse2(struct scan *scan, size_t len, size_t *done)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	size_t i;
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i chars = _mm_loadu_si128(
+			(const __m128i *)(scan->text + i));
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(chars, lf), _mm_cmpeq_epi8(chars, cr)));
+		SCAN_MASK(scan, mask, i);
+	}
+	*done = i;
+	return SUCCESS;
+}
+#endif /* HAVE_SSE2 */
+
+#if HAVE_AVX2
+/* Like scan_sse2, but 32 characters at a time. Only call this if the CPU
+ * supports AVX2. */
+__attribute__((target("avx2")))
+static int scan_avx2(struct scan *scan, size_t len, size_t *done)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	size_t i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i chars = _mm256_loadu_si256(
+			(const __m256i *)(scan->text + i));
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(chars, lf),
+			_mm256_cmpeq_epi8(chars, cr)));
+		SCAN_MASK(scan, mask, i);
+	}
+	*done = i;
+	return SUCCESS;
+}
+#endif /* HAVE_AVX2 */
+
+#undef SCAN_MASK
+
+/* Scan as many whole blocks of characters as the best available kernel can
+ * handle, leaving the rest to the caller. */
+static int scan_blocks(struct scan *scan, size_t len, size_t *done)
+{
+#if HAVE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return scan_avx2(scan, len, done);
+#endif
+#if HAVE_SSE2
+	return scan_sse2(scan, len, done);
+#else
+	(void)scan;
+	(void)len;
+	*done = 0;
+	return SUCCESS;
+#endif
+}
+
+int ihr_scan(struct ihr_lines *lines,
+	int file_type,
+	size_t len,
+	const char *text)
+{
+	struct scan scan;
+	size_t i;
+	int status;
+#ifdef IHR_STATS
+	double start = stats_now ? stats_ticks() : 0;
+#endif
+	scan.lines = lines;
+	scan.text = text;
+	scan.start = file_type <= IHRT_I32 ? ':' : 'S';
+	scan.next = 0;
+	scan.line = 1;
+	lines->count = 0;
+	lines->stray = (size_t)-1;
+	status = scan_blocks(&scan, len, &i);
+	for (; i < len && status == SUCCESS; ++i) {
+		if (text[i] == '\n' || text[i] == '\r')
+			status = scan_eol(&scan, i);
+	}
+	/* The last line need not have an ending: */
+	if (status == SUCCESS) status = scan_line(&scan, len);
+	if (status == SUCCESS && !lines->starts) status = reserve_line(lines);
+	if (lines->stray == (size_t)-1) lines->stray = lines->count;
+#ifdef IHR_STATS
+	if (stats_now) stats_now->ticks[IHRS_SCAN] += stats_ticks() - start;
+#endif
+	if (status) return -IHRE_NO_MEMORY;
+	lines->starts[lines->count] = len;
+	return SUCCESS;
+}
+
+void ihr_lines_free(struct ihr_lines *lines)
+{
+	free(lines->starts);
+	free(lines->numbers);
+	ihr_lines_init(lines);
+}
+
+/* The first address of a segment at or after at, and its last address: */
+#define SEG_FROM(seg, at) ((seg)->addr > (at) ? (seg)->addr : (at))
+#define SEG_LAST(seg) ((seg)->addr + (IHR_U32)((seg)->size - 1))
+
+/* Returns 1 if the segment ends before addr with a gap in between. */
+static int ends_before(const struct ihr_segment *seg, IHR_U32 addr)
+{
+	return seg->addr < addr && addr - seg->addr > seg->size;
+}
+
+/* Returns 1 if the segment starts after last with a gap in between. */
+static int starts_after(const struct ihr_segment *seg, IHR_U32 last)
+{
+	return seg->addr > last && seg->addr - last > 1;
+}
+
+/* Find the first segment which does not end before addr. Appending after the
+ * last segment is the common case, so it is checked first. */
+static size_t find_segment(const struct ihr_image *img, IHR_U32 addr)
+{
+	size_t low = 0, high = img->count;
+	if (high == 0) return 0;
+	if (ends_before(&img->segs[high - 1], addr)) return high;
+	if (high == 1 || ends_before(&img->segs[high - 2], addr))
+		return high - 1;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (ends_before(&img->segs[mid], addr))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* Free the data of a segment. */
+static void free_data(struct ihr_segment *seg)
+{
+	if (seg->data) free(seg->data - seg->front);
+}
+
+/* Make room for at least size bytes of segment data. The capacity grows
+ * geometrically so that appending costs amortized constant time. */
+static int reserve_data(struct ihr_segment *seg, size_t size)
+{
+	IHR_U8 *buf;
+	size_t cap;
+	if (size <= seg->cap) return SUCCESS;
+	cap = seg->cap * 2 > size ? seg->cap * 2 : size;
+	buf = realloc(seg->data ? seg->data - seg->front : NULL,
+		seg->front + cap);
+	if (!buf) return FAILURE;
+	seg->data = buf + seg->front;
+	seg->cap = cap;
+	return SUCCESS;
+}
+
+/* Make room for at least size bytes before the data of a segment. The room
+ * grows with the segment, so that prepending costs amortized constant time
+ * too. */
+static int reserve_front(struct ihr_segment *seg, size_t size)
+{
+	IHR_U8 *buf;
+	size_t front = seg->front * 2;
+	if (size <= seg->front) return SUCCESS;
+	if (front < seg->size) front = seg->size;
+	if (front < size) front = size;
+	buf = malloc(front + seg->cap);
+	if (!buf) return FAILURE;
+	if (seg->size > 0) memcpy(buf + front, seg->data, seg->size);
+	free_data(seg);
+	seg->data = buf + front;
+	seg->front = front;
+	return SUCCESS;
+}
+
+/* Start a segment size bytes earlier, in the room before its data. The bytes
+ * are left for the caller to set. */
+static void grow_front(struct ihr_segment *seg, size_t size)
+{
+	seg->data -= size;
+	seg->front -= size;
+	seg->cap += size;
+	seg->addr -= (IHR_U32)size;
+	seg->size += size;
+}
+
+/* Set up seg as a new segment holding a copy of data. */
+static int new_segment(struct ihr_segment *seg,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	seg->addr = addr;
+	seg->size = 0;
+	seg->cap = 0;
+	seg->data = NULL;
+	seg->front = 0;
+	if (reserve_data(seg, size)) return FAILURE;
+	memcpy(seg->data, data, size);
+	seg->size = size;
+	return SUCCESS;
+}
+
+/* A segment of data put before the last segment of an image, in an AVL tree
+ * of them by address. */
+struct pending_seg {
+	struct ihr_segment seg;
+	struct pending_seg *left, *right;
+	int height;
+};
+
+/* Data put before the last segment of an image, not yet merged into its
+ * segments. Putting each piece there would move the segments after it, which
+ * is quadratic when many come out of order, so they are kept in a tree until
+ * there are as many as in the image, and merged in all at once. No segment of
+ * the image or the tree overlaps another, but they may touch until then. */
+struct ihr_pending {
+	struct pending_seg *root;
+	size_t count; /* Segments in the tree */
+	IHR_U32 last; /* The last address of any data in them */
+};
+
+/* No AVL tree of segments within the address space is deeper than this: */
+#define MAX_HEIGHT 64
+
+/* Goes through the segments of an image and its tree which overlap a range of
+ * addresses, in address order. */
+struct walk {
+	struct ihr_segment *segs;
+	size_t at, end;
+	struct pending_seg *stack[MAX_HEIGHT]; /* The next in the tree on top */
+	int depth;
+	IHR_U32 last;
+};
+
+/* Push the segments of a tree leading to the first which does not end before
+ * addr. */
+static void walk_down(struct walk *walk, struct pending_seg *node, IHR_U32 addr)
+{
+	while (node) {
+		if (SEG_LAST(&node->seg) < addr) {
+			node = node->right;
+		} else {
+			walk->stack[walk->depth++] = node;
+			node = node->left;
+		}
+	}
+}
+
+static void walk_init(struct walk *walk,
+	const struct ihr_image *img,
+	IHR_U32 addr,
+	IHR_U32 last)
+{
+	const struct ihr_pending *pend = img->pending;
+	size_t i = find_segment(img, addr);
+	/* The segment found may end just before addr: */
+	if (i < img->count && SEG_LAST(&img->segs[i]) < addr) ++i;
+	walk->segs = img->segs;
+	walk->at = i;
+	walk->end = img->count;
+	walk->depth = 0;
+	walk->last = last;
+	if (pend && pend->count > 0 && pend->last >= addr)
+		walk_down(walk, pend->root, addr);
+}
+
+/* Returns the next segment overlapping the range, or NULL if there is none. */
+static struct ihr_segment *walk_next(struct walk *walk)
+{
+	struct ihr_segment *seg = NULL;
+	struct pending_seg *node = NULL;
+	if (walk->at < walk->end) seg = &walk->segs[walk->at];
+	if (walk->depth > 0) node = walk->stack[walk->depth - 1];
+	if (node && (!seg || node->seg.addr < seg->addr)) {
+		if (node->seg.addr > walk->last) return NULL;
+		--walk->depth;
+		walk_down(walk, node->right, 0);
+		return &node->seg;
+	}
+	if (!seg || seg->addr > walk->last) return NULL;
+	++walk->at;
+	return seg;
+}
+
+/* Report bytes from from to to which new data overlap, and fail if any differ
+ * and the image does not allow it. */
+static int report_overlap(const struct ihr_image *img,
+	IHR_U32 from,
+	IHR_U32 to,
+	int conflict)
+{
+	if (img->on_overlap) {
+		int status = img->on_overlap(img->overlap_ctx, from,
+			(size_t)(to - from) + 1, conflict);
+		if (status < 0) return status;
+	}
+	if (conflict && img->overlap == IHRO_ERROR) return -IHRE_OVERLAP;
+	return SUCCESS;
+}
+
+/* Check data within the address space which are to be put, as check_put
+ * does. Overlapped bytes in touching segments are reported as one run, as if
+ * the segments were joined. */
+static int check_unwrapped(const struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	IHR_U32 last = addr + (IHR_U32)(size - 1), from = 0, to = 0;
+	const struct ihr_segment *seg;
+	struct walk walk;
+	int found = 0, conflict = 0;
+	walk_init(&walk, img, addr, last);
+	while ((seg = walk_next(&walk)) != NULL) {
+		IHR_U32 seg_from = SEG_FROM(seg, addr), seg_to = SEG_LAST(seg);
+		if (seg_to > last) seg_to = last;
+		if (found && seg_from != to + 1) {
+			int status = report_overlap(img, from, to, conflict);
+			if (status) return status;
+			found = 0;
+		}
+		if (!found) {
+			from = seg_from;
+			conflict = 0;
+			found = 1;
+		}
+		to = seg_to;
+		conflict |= memcmp(seg->data + (seg_from - seg->addr),
+			data + (seg_from - addr),
+			(size_t)(seg_to - seg_from) + 1) != 0;
+	}
+	return found ? report_overlap(img, from, to, conflict) : SUCCESS;
+}
+
+/* Report and check the overlaps of data which are to be put, without changing
+ * img. Returns SUCCESS if the data can be put. */
+static int check_put(const struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	if (size == 0 || (!img->on_overlap && img->overlap == IHRO_LAST_WINS))
+		return SUCCESS;
+	/* Data running past the top of the address space wrap to 0: */
+	if (size - 1 > (IHR_U32)(0xFFFFFFFF - addr)) {
+		size_t first = (size_t)(0xFFFFFFFF - addr) + 1;
+		int status = check_unwrapped(img, addr, first, data);
+		if (status) return status;
+		addr = 0;
+		size -= first;
+		data += first;
+	}
+	return check_unwrapped(img, addr, size, data);
+}
+
+/* Put data which reach no segment of an image but the one numbered first, the
+ * last one, if any: in a new segment before or after it, or joined to it. */
+static int put_last(struct ihr_image *img,
+	size_t first,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	IHR_U32 last = addr + (IHR_U32)(size - 1), seg_last;
+	struct ihr_segment *seg;
+	size_t before, after;
+	if (first == img->count || starts_after(&img->segs[first], last)) {
+		/* The data touch no segment, so they get their own: */
+		if (img->count == img->cap) {
+			size_t cap = img->cap ? img->cap * 2 : 16;
+			seg = realloc(img->segs, cap * sizeof(*seg));
+			if (!seg) return -IHRE_NO_MEMORY;
+			img->segs = seg;
+			img->cap = cap;
+		}
+		seg = &img->segs[first];
+		memmove(seg + 1, seg, (img->count - first) * sizeof(*seg));
+		if (new_segment(seg, addr, size, data)) {
+			memmove(seg, seg + 1,
+				(img->count - first) * sizeof(*seg));
+			return -IHRE_NO_MEMORY;
+		}
+		++img->count;
+		return SUCCESS;
+	}
+	/* Grow the segment at either end to take the data: */
+	seg = &img->segs[first];
+	seg_last = SEG_LAST(seg);
+	before = addr < seg->addr ? seg->addr - addr : 0;
+	after = last > seg_last ? last - seg_last : 0;
+	if (reserve_front(seg, before) || reserve_data(seg, seg->size + after))
+		return -IHRE_NO_MEMORY;
+	grow_front(seg, before);
+	seg->size += after;
+	if (img->overlap == IHRO_FIRST_WINS) {
+		/* Only the bytes not there already are put: */
+		memcpy(seg->data, data, before);
+		memcpy(seg->data + (seg->size - after), data + (size - after),
+			after);
+	} else {
+		/* New data replace what was there: */
+		memcpy(seg->data + (addr - seg->addr), data, size);
+	}
+	return SUCCESS;
+}
+
+static int height(const struct pending_seg *node)
+{
+	return node ? node->height : 0;
+}
+
+static void set_height(struct pending_seg *node)
+{
+	int left = height(node->left), right = height(node->right);
+	node->height = (left > right ? left : right) + 1;
+}
+
+static struct pending_seg *rotate_right(struct pending_seg *node)
+{
+	struct pending_seg *top = node->left;
+	node->left = top->right;
+	top->right = node;
+	set_height(node);
+	set_height(top);
+	return top;
+}
+
+static struct pending_seg *rotate_left(struct pending_seg *node)
+{
+	struct pending_seg *top = node->right;
+	node->right = top->left;
+	top->left = node;
+	set_height(node);
+	set_height(top);
+	return top;
+}
+
+/* Insert a segment in a tree, returning its new root. */
+static struct pending_seg *insert_seg(struct pending_seg *node,
+	struct pending_seg *seg)
+{
+	int diff;
+	if (!node) return seg;
+	if (seg->seg.addr < node->seg.addr)
+		node->left = insert_seg(node->left, seg);
+	else
+		node->right = insert_seg(node->right, seg);
+	set_height(node);
+	diff = height(node->left) - height(node->right);
+	if (diff > 1) {
+		if (height(node->left->left) < height(node->left->right))
+			node->left = rotate_left(node->left);
+		return rotate_right(node);
+	}
+	if (diff < -1) {
+		if (height(node->right->right) < height(node->right->left))
+			node->right = rotate_right(node->right);
+		return rotate_left(node);
+	}
+	return node;
+}
+
+/* Free a tree and the data of its segments. */
+static void free_tree(struct pending_seg *node)
+{
+	while (node) {
+		struct pending_seg *right = node->right;
+		free_tree(node->left);
+		free_data(&node->seg);
+		free(node);
+		node = right;
+	}
+}
+
+/* Put data which reach before the last segment of an image in its tree:
+ * bytes already in the image are replaced where they are or kept, as the
+ * policy says, and the rest go in new segments. */
+static int put_pending(struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	IHR_U32 last = addr + (IHR_U32)(size - 1), at = addr;
+	struct ihr_pending *pend = img->pending;
+	struct pending_seg *gaps = NULL, *gap;
+	struct ihr_segment *seg;
+	struct walk walk;
+	int covered = 0;
+	if (!pend) {
+		pend = calloc(1, sizeof(*pend));
+		if (!pend) return -IHRE_NO_MEMORY;
+		img->pending = pend;
+	}
+	/* Each gap between the segments already there gets a new one, listed
+	 * by their right links until the walk is over: */
+	walk_init(&walk, img, addr, last);
+	do {
+		seg = walk_next(&walk);
+		if (!seg || seg->addr > at) {
+			IHR_U32 to = seg ? seg->addr - 1 : last;
+			gap = malloc(sizeof(*gap));
+			if (!gap || new_segment(&gap->seg, at,
+					(size_t)(to - at) + 1,
+					data + (at - addr))) {
+				free(gap);
+				free_tree(gaps);
+				return -IHRE_NO_MEMORY;
+			}
+			gap->left = NULL;
+			gap->right = gaps;
+			gap->height = 1;
+			gaps = gap;
+		}
+		if (seg) {
+			at = SEG_LAST(seg) + 1;
+			covered = 1;
+		}
+	} while (seg && SEG_LAST(seg) < last);
+	if (covered && img->overlap != IHRO_FIRST_WINS) {
+		/* New data replace what was there: */
+		walk_init(&walk, img, addr, last);
+		while ((seg = walk_next(&walk)) != NULL) {
+			IHR_U32 from = SEG_FROM(seg, addr), to = SEG_LAST(seg);
+			if (to > last) to = last;
+			memcpy(seg->data + (from - seg->addr),
+				data + (from - addr), (size_t)(to - from) + 1);
+		}
+	}
+	if (pend->count == 0 || last > pend->last) pend->last = last;
+	while (gaps) {
+		gap = gaps;
+		gaps = gap->right;
+		gap->right = NULL;
+		pend->root = insert_seg(pend->root, gap);
+		++pend->count;
+	}
+	/* Merge the tree into the image once it is as big, so that merging
+	 * costs constant time for each segment. If memory runs out, it is
+	 * merged later: */
+	if (pend->count >= img->count) ihr_image_flush(img);
+	return SUCCESS;
+}
+
+/* Put data within the address space without wrapping around. Their overlaps
+ * must have been checked. */
+static int put_unwrapped(struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	const struct ihr_pending *pend = img->pending;
+	size_t first = find_segment(img, addr);
+	/* Data reaching no segment but the last, as in most files, go straight
+	 * in; others would move the segments after them, so they wait: */
+	if (first + 1 >= img->count
+	 && (!pend || pend->count == 0 || addr > pend->last))
+		return put_last(img, first, addr, size, data);
+	return put_pending(img, addr, size, data);
+}
+
+/* Join each run of touching segments of an image into the biggest of them, so
+ * that a byte is only copied into a segment at least twice the size of the one
+ * it was in. Segments which cannot be joined for want of memory are left as
+ * they are. */
+static int join_segments(struct ihr_image *img)
+{
+	struct ihr_segment *segs = img->segs;
+	size_t i = 0, out = 0;
+	int status = SUCCESS;
+	while (i < img->count) {
+		size_t end = i + 1, big = i, before = 0, after = 0, j;
+		struct ihr_segment *seg;
+		while (end < img->count
+		 && SEG_LAST(&segs[end - 1]) + 1 == segs[end].addr) {
+			if (segs[end].size > segs[big].size) big = end;
+			++end;
+		}
+		for (j = i; j < big; ++j) before += segs[j].size;
+		for (j = big + 1; j < end; ++j) after += segs[j].size;
+		seg = &segs[big];
+		if (end - i == 1 || reserve_front(seg, before)
+		 || reserve_data(seg, seg->size + after)) {
+			if (end - i > 1) status = -IHRE_NO_MEMORY;
+			for (; i < end; ++i) segs[out++] = segs[i];
+			continue;
+		}
+		grow_front(seg, before);
+		seg->size += after;
+		for (j = i; j < end; ++j) {
+			if (j == big) continue;
+			memcpy(seg->data + (segs[j].addr - seg->addr),
+				segs[j].data, segs[j].size);
+			free_data(&segs[j]);
+		}
+		segs[out++] = *seg;
+		i = end;
+	}
+	img->count = out;
+	return status;
+}
+
+/* Merges a tree into the segments of an image, which have been moved up to
+ * make room. */
+struct merge {
+	struct ihr_segment *segs;
+	size_t out; /* Where the next segment goes */
+	size_t at, end; /* The segments of the image not merged yet */
+};
+
+/* Merge the segments of a tree in order and free it. */
+static void merge_tree(struct merge *merge, struct pending_seg *node)
+{
+	while (node) {
+		struct pending_seg *right = node->right;
+		merge_tree(merge, node->left);
+		while (merge->at < merge->end
+		 && merge->segs[merge->at].addr < node->seg.addr)
+			merge->segs[merge->out++] = merge->segs[merge->at++];
+		merge->segs[merge->out++] = node->seg;
+		free(node);
+		node = right;
+	}
+}
+
+int ihr_image_flush(struct ihr_image *img)
+{
+	struct ihr_pending *pend = img->pending;
+	struct merge merge;
+	size_t n;
+	if (!pend || pend->count == 0) return SUCCESS;
+	n = pend->count;
+	if (img->count + n > img->cap) {
+		size_t cap = img->cap * 2 > img->count + n ? img->cap * 2
+			: img->count + n;
+		struct ihr_segment *segs = realloc(img->segs,
+			cap * sizeof(*segs));
+		if (!segs) return -IHRE_NO_MEMORY;
+		img->segs = segs;
+		img->cap = cap;
+	}
+	/* The segments of the image are moved up, so that the merged ones
+	 * never catch up with those still to merge: */
+	memmove(img->segs + n, img->segs, img->count * sizeof(*img->segs));
+	merge.segs = img->segs;
+	merge.out = 0;
+	merge.at = n;
+	merge.end = n + img->count;
+	merge_tree(&merge, pend->root);
+	memmove(img->segs + merge.out, img->segs + merge.at,
+		(merge.end - merge.at) * sizeof(*img->segs));
+	img->count += n;
+	pend->root = NULL;
+	pend->count = 0;
+	return join_segments(img);
+}
+
+/* Whether the data put in an image so far can be digested as they come: */
+#define DIGEST_EMPTY 0 /* No data have been put */
+#define DIGEST_ORDERED 1 /* Each piece came after the ones before */
+#define DIGEST_UNORDERED 2 /* A piece did not */
+
+void ihr_image_init(struct ihr_image *img, int file_type)
+{
+	img->file_type = file_type;
+	img->segs = NULL;
+	img->count = 0;
+	img->cap = 0;
+	img->base = 0;
+	img->start_type = -1;
+	img->start = 0;
+	img->digest = NULL;
+	img->fill = 0xFF;
+	img->overlap = IHRO_LAST_WINS;
+	img->on_overlap = NULL;
+	img->overlap_ctx = NULL;
+	img->order = DIGEST_EMPTY;
+	img->last = 0;
+	img->pending = NULL;
+}
+
+/* Give the digest of an image data being put, if they come after all the data
+ * put before. Otherwise, the digest is left to be worked out from the
+ * segments by ihr_image_digest. */
+static void digest_put(struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	if (img->order == DIGEST_UNORDERED) return;
+	if (size - 1 > (IHR_U32)(0xFFFFFFFF - addr)
+	 || (img->order == DIGEST_ORDERED && addr <= img->last)) {
+		img->order = DIGEST_UNORDERED;
+		return;
+	}
+	if (img->order == DIGEST_ORDERED)
+		digest_fill(img->digest, img->fill, addr - img->last - 1);
+	ihr_digest_update(img->digest, size, data);
+	img->order = DIGEST_ORDERED;
+	img->last = addr + (IHR_U32)(size - 1);
+}
+
+/* Put data as ihr_image_put does, once their overlaps have been checked. */
+static int put_checked(struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	if (size == 0) return SUCCESS;
+	if (img->digest) digest_put(img, addr, size, data);
+	/* Data running past the top of the address space wrap to 0: */
+	if (size - 1 > (IHR_U32)(0xFFFFFFFF - addr)) {
+		size_t first = (size_t)(0xFFFFFFFF - addr) + 1;
+		int status = put_unwrapped(img, addr, first, data);
+		if (status) return status;
+		addr = 0;
+		size -= first;
+		data += first;
+	}
+	return put_unwrapped(img, addr, size, data);
+}
+
+int ihr_image_put(struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data)
+{
+	int status = check_put(img, addr, size, data);
+	if (status) return status;
+	return put_checked(img, addr, size, data);
+}
+
+/* Put n pieces of data, checking them all before any is put. */
+static int put_pieces(struct ihr_image *img,
+	int n,
+	const IHR_U32 *addrs,
+	const size_t *sizes,
+	const IHR_U8 *const *datas)
+{
+	int i;
+	for (i = 0; i < n; ++i) {
+		int status = check_put(img, addrs[i], sizes[i], datas[i]);
+		if (status) return status;
+	}
+	for (i = 0; i < n; ++i) {
+		int status = put_checked(img, addrs[i], sizes[i], datas[i]);
+		if (status) return status;
+	}
+	return SUCCESS;
+}
+
+/* Work out where the data of a data record go, given the base address set by
+ * the last extended address record. The data are split where their addresses
+ * wrap around. Returns the number of pieces, up to 2, putting the address and
+ * size of each in addrs and sizes. */
+static int place_data(int file_type,
+	IHR_U32 base,
+	const struct ihr_record *rec,
+	IHR_U32 addrs[2],
+	size_t sizes[2])
+{
+	IHR_U32 addr = rec->addr;
+	if (rec->size == 0) return 0;
+	if (file_type == IHRT_I8 || file_type == IHRT_I16) {
+		/* Addresses wrap within the segment: */
+		size_t first = 0x10000 - rec->addr;
+		addrs[0] = base + addr;
+		if (first < rec->size) {
+			sizes[0] = first;
+			addrs[1] = base;
+			sizes[1] = rec->size - first;
+			return 2;
+		}
+	} else {
+		if (file_type == IHRT_I32) addr += base;
+		addrs[0] = addr;
+		/* Addresses wrap at the top of the address space: */
+		if ((IHR_U32)rec->size - 1 > (IHR_U32)(0xFFFFFFFF - addr)) {
+			sizes[0] = (size_t)(0xFFFFFFFF - addr) + 1;
+			addrs[1] = 0;
+			sizes[1] = rec->size - sizes[0];
+			return 2;
+		}
+	}
+	sizes[0] = rec->size;
+	return 1;
+}
+
+/* Put the data of a data record in the image. */
+static int put_data(struct ihr_image *img, const struct ihr_record *rec)
+{
+	IHR_U32 addrs[2];
+	size_t sizes[2];
+	const IHR_U8 *datas[2];
+	int n = place_data(img->file_type, img->base, rec, addrs, sizes);
+	datas[0] = rec->data.data;
+	if (n == 2) datas[1] = rec->data.data + sizes[0];
+	return put_pieces(img, n, addrs, sizes, datas);
+}
+
+/* Finish an image at its end record, giving 1 unless its data cannot be
+ * merged. */
+static int end_image(struct ihr_image *img)
+{
+	int status = ihr_image_flush(img);
+	return status ? status : 1;
+}
+
+static int image_add(struct ihr_image *img, const struct ihr_record *rec)
+{
+	switch (img->file_type) {
+	case IHRT_I8:
+	case IHRT_I16:
+	case IHRT_I32:
+		switch (rec->type) {
+		case IHRR_I_DATA:
+			return put_data(img, rec);
+		case IHRR_I_END_OF_FILE:
+			return end_image(img);
+		case IHRR_I_EXT_SEG_ADDR:
+			img->base = (IHR_U32)rec->data.ihex.base_addr << 4;
+			break;
+		case IHRR_I_EXT_LIN_ADDR:
+			img->base = (IHR_U32)rec->data.ihex.base_addr << 16;
+			break;
+		case IHRR_I_START_SEG_ADDR:
+			img->start_type = rec->type;
+			img->start = (IHR_U32)rec->data.ihex.start.code_seg << 16
+				| rec->data.ihex.start.instr_ptr;
+			break;
+		case IHRR_I_START_LIN_ADDR:
+			img->start_type = rec->type;
+			img->start = rec->data.ihex.ext_instr_ptr;
+			break;
+		}
+		break;
+	default:
+		switch (rec->type) {
+		case IHRR_S1_DATA_16:
+		case IHRR_S2_DATA_24:
+		case IHRR_S3_DATA_32:
+			return put_data(img, rec);
+		case IHRR_S7_START_32:
+		case IHRR_S8_START_24:
+		case IHRR_S9_START_16:
+			img->start_type = rec->type;
+			img->start = rec->addr;
+			return end_image(img);
+		}
+		break;
+	}
+	return SUCCESS;
+}
+
+int ihr_image_add(void *img, const struct ihr_record *rec)
+{
+#ifdef IHR_STATS
+	struct ihr_stats *stats = stats_now;
+	if (stats) {
+		int status;
+		STATS_TIMED(stats, IHRS_PLACE, status = image_add(img, rec));
+		return status;
+	}
+#endif
+	return image_add(img, rec);
+}
+
+const struct ihr_segment *ihr_image_find(const struct ihr_image *img,
+	IHR_U32 addr)
+{
+	size_t i = find_segment(img, addr);
+	const struct ihr_segment *seg;
+	if (i == img->count) return NULL;
+	seg = &img->segs[i];
+	if (seg->addr <= addr && addr - seg->addr < seg->size) return seg;
+	return NULL;
+}
+
+void ihr_image_digest(const struct ihr_image *img, struct ihr_digest *digest)
+{
+	size_t i;
+	if (img->digest != digest || img->order == DIGEST_UNORDERED) {
+		ihr_digest_init(digest, digest->flags);
+		for (i = 0; i < img->count; ++i) {
+			const struct ihr_segment *seg = &img->segs[i];
+			if (i > 0) {
+				digest_fill(digest, img->fill, seg->addr
+					- SEG_LAST(&img->segs[i - 1]) - 1);
+			}
+			ihr_digest_update(digest, seg->size, seg->data);
+		}
+	}
+	ihr_digest_end(digest);
+}
+
+void ihr_image_free(struct ihr_image *img)
+{
+	size_t i;
+	for (i = 0; i < img->count; ++i) {
+		free_data(&img->segs[i]);
+	}
+	free(img->segs);
+	if (img->pending) free_tree(img->pending->root);
+	free(img->pending);
+	ihr_image_init(img, img->file_type);
+}
+
+#if HAVE_SSE2
+/* Compare 16 bytes of x and y, giving all ones in each byte that matches. */
+static __m128i same_sse2(const IHR_U8 *x, const IHR_U8 *y)
+{
+	return _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)x),
+		_mm_loadu_si128((const __m128i *)y));
+}
+#endif /* HAVE_SSE2 */
+
+/* Count the bytes from the start of x and y which are the same if equal is
+ * nonzero, or which differ otherwise. */
+static size_t span(const IHR_U8 *x, const IHR_U8 *y, size_t size, int equal)
+{
+	size_t i = 0;
+#if HAVE_SSE2
+	int want = equal ? 0xFFFF : 0;
+	if (equal) {
+		/* Most of two versions of an image is usually the same, so it is
+		 * skipped a cache line at a time: */
+		for (; i + 64 <= size; i += 64) {
+			__m128i same = _mm_and_si128(
+				_mm_and_si128(same_sse2(x + i, y + i),
+					same_sse2(x + i + 16, y + i + 16)),
+				_mm_and_si128(same_sse2(x + i + 32, y + i + 32),
+					same_sse2(x + i + 48, y + i + 48)));
+			if (_mm_movemask_epi8(same) != 0xFFFF) break;
+		}
+	}
+	for (; i + 16 <= size; i += 16) {
+		if (_mm_movemask_epi8(same_sse2(x + i, y + i)) != want) break;
+	}
+#else
+	if (equal) {
+		while (i + 64 <= size && !memcmp(x + i, y + i, 64)) i += 64;
+	}
+#endif
+	equal = !!equal;
+	while (i < size && (x[i] == y[i]) == equal) ++i;
+	return i;
+}
+
+/* Add the addresses from first to last to diff, widened to whole pages. They
+ * must not start before any range already added. Returns the last address of
+ * the range they end up in, or 0 with *status set on failure. */
+static IHR_U32 add_range(struct ihr_diff *diff,
+	IHR_U32 first,
+	IHR_U32 last,
+	IHR_U32 page,
+	int *status)
+{
+	struct ihr_range *range;
+	first -= first % page;
+	if (page - 1 - last % page > 0xFFFFFFFF - last)
+		last = 0xFFFFFFFF;
+	else
+		last += page - 1 - last % page;
+	range = diff->count ? &diff->ranges[diff->count - 1] : NULL;
+	if (range && first - range->addr <= range->size) {
+		IHR_U32 end = range->addr + (IHR_U32)(range->size - 1);
+		if (last > end) range->size = (size_t)(last - range->addr) + 1;
+		return range->addr + (IHR_U32)(range->size - 1);
+	}
+	if (diff->count == diff->cap) {
+		size_t cap = diff->cap ? diff->cap * 2 : 16;
+		struct ihr_range *ranges = realloc(diff->ranges,
+			cap * sizeof(*ranges));
+		if (!ranges) {
+			*status = -IHRE_NO_MEMORY;
+			return 0;
+		}
+		diff->ranges = ranges;
+		diff->cap = cap;
+	}
+	range = &diff->ranges[diff->count++];
+	range->addr = first;
+	range->size = (size_t)(last - first) + 1;
+	return last;
+}
+
+/* Add where the bytes of x and y differ, x and y being at the addresses from
+ * first to last. */
+static int diff_bytes(struct ihr_diff *diff,
+	IHR_U32 first,
+	IHR_U32 last,
+	const IHR_U8 *x,
+	const IHR_U8 *y,
+	IHR_U32 page)
+{
+	size_t size = (size_t)(last - first) + 1, off = 0;
+	int status = SUCCESS;
+	while ((off += span(x + off, y + off, size - off, 1)) < size) {
+		size_t run = span(x + off, y + off, size - off, 0);
+		IHR_U32 end = add_range(diff, first + (IHR_U32)off,
+			first + (IHR_U32)(off + run - 1), page, &status);
+		if (status) return status;
+		/* The rest of the page need not be compared: */
+		if (end >= last) break;
+		off = (size_t)(end - first) + 1;
+	}
+	return SUCCESS;
+}
+
+void ihr_diff_init(struct ihr_diff *diff)
+{
+	diff->ranges = NULL;
+	diff->count = 0;
+	diff->cap = 0;
+}
+
+int ihr_image_diff(struct ihr_diff *diff,
+	const struct ihr_image *a,
+	const struct ihr_image *b,
+	IHR_U32 page)
+{
+	size_t i = 0, j = 0;
+	IHR_U32 at = 0;
+	int status = SUCCESS;
+	if (page == 0) page = 1;
+	diff->count = 0;
+	/* Go through the addresses in either image in order: */
+	for (;;) {
+		const struct ihr_segment *sa, *sb;
+		IHR_U32 first, last;
+		while (i < a->count && SEG_LAST(&a->segs[i]) < at) ++i;
+		while (j < b->count && SEG_LAST(&b->segs[j]) < at) ++j;
+		sa = i < a->count ? &a->segs[i] : NULL;
+		sb = j < b->count ? &b->segs[j] : NULL;
+		if (!sa && !sb) break;
+		if (sa && (!sb || SEG_FROM(sa, at) < SEG_FROM(sb, at))) {
+			/* Only in a: */
+			first = SEG_FROM(sa, at);
+			last = SEG_LAST(sa);
+			if (sb && sb->addr - 1 < last) last = sb->addr - 1;
+			add_range(diff, first, last, page, &status);
+		} else if (!sa || SEG_FROM(sb, at) < SEG_FROM(sa, at)) {
+			/* Only in b: */
+			first = SEG_FROM(sb, at);
+			last = SEG_LAST(sb);
+			if (sa && sa->addr - 1 < last) last = sa->addr - 1;
+			add_range(diff, first, last, page, &status);
+		} else {
+			/* In both: */
+			first = SEG_FROM(sa, at);
+			last = SEG_LAST(sa) < SEG_LAST(sb) ? SEG_LAST(sa)
+				: SEG_LAST(sb);
+			status = diff_bytes(diff, first, last,
+				sa->data + (first - sa->addr),
+				sb->data + (first - sb->addr), page);
+		}
+		if (status || last == 0xFFFFFFFF) break;
+		at = last + 1;
+	}
+	return status;
+}
+
+void ihr_diff_free(struct ihr_diff *diff)
+{
+	free(diff->ranges);
+	ihr_diff_init(diff);
+}
+
+/* Runs of an index are kept to this many bytes of data at most, so that a
+ * lookup only reads a few records. */
+#define MAX_RUN ((size_t)1 << 12)
+
+/* Update *base for an Intel HEX extended address record. Returns 1 if the
+ * record ends the file, or 0 otherwise. */
+static int follow_record(int file_type,
+	IHR_U32 *base,
+	const struct ihr_record *rec)
+{
+	if (file_type <= IHRT_I32) {
+		switch (rec->type) {
+		case IHRR_I_END_OF_FILE:
+			return 1;
+		case IHRR_I_EXT_SEG_ADDR:
+			*base = (IHR_U32)rec->data.ihex.base_addr << 4;
+			break;
+		case IHRR_I_EXT_LIN_ADDR:
+			*base = (IHR_U32)rec->data.ihex.base_addr << 16;
+			break;
+		}
+		return 0;
+	}
+	return rec->type == IHRR_S7_START_32 || rec->type == IHRR_S8_START_24
+		|| rec->type == IHRR_S9_START_16;
+}
+
+/* Add a piece of data at addr from the record at offset to the index. */
+static int index_piece(struct ihr_index *index,
+	IHR_U32 addr,
+	size_t size,
+	IHR_U32 base,
+	size_t offset,
+	size_t end)
+{
+	struct ihr_run *run = index->count ? &index->runs[index->count - 1]
+		: NULL;
+	if (run && run->size < MAX_RUN && addr >= run->addr
+	 && addr - run->addr == run->size) {
+		run->size += size;
+		run->end = end;
+		return SUCCESS;
+	}
+	if (index->count == index->cap) {
+		size_t cap = index->cap ? index->cap * 2 : 16;
+		struct ihr_run *runs = realloc(index->runs, cap * sizeof(*runs));
+		if (!runs) return -IHRE_NO_MEMORY;
+		index->runs = runs;
+		index->cap = cap;
+	}
+	run = &index->runs[index->count++];
+	run->addr = addr;
+	run->size = size;
+	run->base = base;
+	run->offset = offset;
+	run->end = end;
+	return SUCCESS;
+}
+
+static int compare_runs(const void *a, const void *b)
+{
+	const struct ihr_run *x = a, *y = b;
+	if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+void ihr_index_init(struct ihr_index *index, int file_type)
+{
+	index->file_type = file_type;
+	index->runs = NULL;
+	index->count = 0;
+	index->cap = 0;
+}
+
+int ihr_index_build(struct ihr_index *index,
+	size_t len,
+	const char *text,
+	struct ihr_error *err)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	IHR_U32 base = 0, reach = 0;
+	int reclen, status = 0;
+	size_t i;
+	err->code = 0;
+	err->line = 0;
+	err->column = 0;
+	ihr_iter_init(&iter, index->file_type, len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		if (reclen < 0) {
+			status = rec.type;
+			err->column = ~reclen;
+			break;
+		}
+		if (is_data(index->file_type, rec.type)) {
+			IHR_U32 addrs[2];
+			size_t sizes[2];
+			int n = place_data(index->file_type, base, &rec, addrs,
+				sizes);
+			int j;
+			for (j = 0; j < n && status == 0; ++j) {
+				status = index_piece(index, addrs[j], sizes[j],
+					base, iter.offset, iter.next);
+			}
+			if (status) break;
+		} else if (follow_record(index->file_type, &base, &rec)) {
+			status = 1;
+			break;
+		}
+	}
+	if (status < 0) {
+		err->code = -status;
+		err->line = iter.line;
+	}
+	/* Sort the runs, noting the highest address reached so far: */
+	qsort(index->runs, index->count, sizeof(*index->runs), compare_runs);
+	for (i = 0; i < index->count; ++i) {
+		struct ihr_run *run = &index->runs[i];
+		IHR_U32 last = run->addr + (run->size - 1);
+		if (i == 0 || last > reach) reach = last;
+		run->reach = reach;
+	}
+	return status;
+}
+
+static int compare_run_offsets(const void *a, const void *b)
+{
+	const struct ihr_run *x = *(const struct ihr_run *const *)a;
+	const struct ihr_run *y = *(const struct ihr_run *const *)b;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* Put the part of the data of rec from first to last in img. */
+static int put_clipped(struct ihr_image *img,
+	IHR_U32 base,
+	const struct ihr_record *rec,
+	IHR_U32 first,
+	IHR_U32 last)
+{
+	IHR_U32 addrs[2], starts[2];
+	size_t sizes[2], clipped[2], skipped = 0;
+	const IHR_U8 *datas[2];
+	int n = place_data(img->file_type, base, rec, addrs, sizes), i, kept = 0;
+	for (i = 0; i < n; skipped += sizes[i], ++i) {
+		IHR_U32 start = addrs[i], end = addrs[i] + (sizes[i] - 1);
+		if (end < first || start > last) continue;
+		if (start < first) start = first;
+		if (end > last) end = last;
+		starts[kept] = start;
+		clipped[kept] = (size_t)(end - start) + 1;
+		datas[kept] = rec->data.data + skipped + (start - addrs[i]);
+		++kept;
+	}
+	return put_pieces(img, kept, starts, clipped, datas);
+}
+
+int ihr_index_get(const struct ihr_index *index,
+	size_t len,
+	const char *text,
+	IHR_U32 addr,
+	size_t size,
+	struct ihr_image *img)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	const struct ihr_run **found;
+	IHR_U32 last;
+	size_t lo = 0, hi = index->count, n = 0, i;
+	int status = SUCCESS;
+	if (size == 0) return SUCCESS;
+	last = size - 1 > (IHR_U32)(0xFFFFFFFF - addr) ? 0xFFFFFFFF
+		: addr + (IHR_U32)(size - 1);
+	/* Find the first run which reaches addr: */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->runs[mid].reach < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (i = lo; i < index->count && index->runs[i].addr <= last; ++i) {
+		const struct ihr_run *run = &index->runs[i];
+		if (run->addr + (run->size - 1) >= addr) ++n;
+	}
+	if (n == 0) return SUCCESS;
+	found = malloc(n * sizeof(*found));
+	if (!found) return -IHRE_NO_MEMORY;
+	for (n = 0, i = lo; i < index->count && index->runs[i].addr <= last;
+			++i) {
+		const struct ihr_run *run = &index->runs[i];
+		if (run->addr + (run->size - 1) >= addr) found[n++] = run;
+	}
+	/* Read the runs in the order of the text, so that later data replace
+	 * earlier data as when the whole text is read: */
+	qsort(found, n, sizeof(*found), compare_run_offsets);
+	for (i = 0; i < n && status == SUCCESS; ++i) {
+		const struct ihr_run *run = found[i];
+		IHR_U32 base = run->base;
+		struct ihr_iter iter;
+		struct ihr_record rec;
+		int reclen;
+		if (run->end > len) {
+			status = -IHRE_INVALID_SIZE;
+			break;
+		}
+		ihr_iter_init(&iter, index->file_type, run->end, text, data);
+		iter.next = run->offset;
+		while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+			if (reclen < 0) {
+				status = rec.type;
+				break;
+			}
+			if (is_data(index->file_type, rec.type)) {
+				status = put_clipped(img, base, &rec, addr,
+					last);
+				if (status) break;
+			} else {
+				follow_record(index->file_type, &base, &rec);
+			}
+		}
+	}
+	free(found);
+	if (status == SUCCESS) status = ihr_image_flush(img);
+	return status;
+}
+
+void ihr_index_free(struct ihr_index *index)
+{
+	free(index->runs);
+	ihr_index_init(index, index->file_type);
+}
+
+void ihr_chunks_init(struct ihr_chunks *chunks,
+	int file_type,
+	size_t len,
+	const char *text)
+{
+	ihr_iter_init(&chunks->iter, file_type, len, text, chunks->data);
+	chunks->base = 0;
+	chunks->records = 0;
+	chunks->rest = NULL;
+	chunks->rest_addr = 0;
+	chunks->rest_size = 0;
+}
+
+int ihr_chunks_next(struct ihr_chunks *chunks,
+	struct ihr_chunk *chunk,
+	struct ihr_error *err)
+{
+	struct ihr_iter *iter = &chunks->iter;
+	struct ihr_record *rec = &chunks->rec;
+	int reclen;
+	err->code = 0;
+	err->line = 0;
+	err->column = 0;
+	if (chunks->rest) {
+		chunk->addr = chunks->rest_addr;
+		chunk->size = chunks->rest_size;
+		chunk->data = chunks->rest;
+		chunk->type = rec->type;
+		chunk->rec = rec;
+		chunks->rest = NULL;
+		return 1;
+	}
+	while ((reclen = ihr_iter_next(iter, rec)) != 0) {
+		int end;
+		if (reclen < 0) {
+			err->code = -rec->type;
+			err->line = iter->line;
+			err->column = ~reclen;
+			return rec->type;
+		}
+		chunk->type = rec->type;
+		chunk->rec = rec;
+		if (is_data(iter->file_type, rec->type)) {
+			IHR_U32 addrs[2];
+			size_t sizes[2];
+			int n = place_data(iter->file_type, chunks->base, rec,
+				addrs, sizes);
+			if (n == 0) {
+				if (!chunks->records) continue;
+				/* Empty data go where they would have: */
+				addrs[0] = iter->file_type <= IHRT_I32
+					? chunks->base + rec->addr : rec->addr;
+				sizes[0] = 0;
+			}
+			chunk->addr = addrs[0];
+			chunk->size = sizes[0];
+			chunk->data = rec->data.data;
+			if (n == 2) {
+				chunks->rest = rec->data.data + sizes[0];
+				chunks->rest_addr = addrs[1];
+				chunks->rest_size = sizes[1];
+			}
+			return 1;
+		}
+		/* Nothing after the end of the file is read: */
+		end = follow_record(iter->file_type, &chunks->base, rec);
+		if (end) iter->next = iter->len;
+		if (chunks->records) {
+			chunk->addr = rec->addr;
+			chunk->size = 0;
+			chunk->data = NULL;
+			return 1;
+		}
+		if (end) break;
+	}
+	return 0;
+}
+
+/* States of a stream between characters: */
+#define STREAM_BLANK 0 /* Between lines */
+#define STREAM_BLANK_CR 1 /* After a blank line ended by '\r' */
+#define STREAM_LINE 2 /* In a line */
+#define STREAM_LINE_CR 3 /* After a line ended by '\r' */
+
+/* Get ready for a new line. */
+static void stream_start_line(struct ihr_stream *stream)
+{
+	stream->state = STREAM_LINE;
+	stream->pos = 0;
+	stream->content = (size_t)-1;
+	stream->type = -1;
+	stream->bad = -1;
+	stream->npairs = 1; /* Only the first is known to exist */
+	stream->first_data = 0;
+	stream->ndata = 0;
+	stream->sum = 0;
+}
+
+void ihr_stream_init(struct ihr_stream *stream, int file_type)
+{
+	stream->file_type = file_type;
+	stream->state = STREAM_BLANK;
+	stream->line = 1;
+	stream->used = 0;
+	stream->err.code = 0;
+	stream->err.line = 0;
+	stream->err.column = 0;
+	stream->rec.data.data = stream->data;
+}
+
+/* Note the decoded pair with the given index. Once the first pair (the byte
+ * count) is known, so is the number of pairs in the record. */
+static void stream_pair(struct ihr_stream *stream, int idx, IHR_U8 byte)
+{
+	if (idx < stream->first_data || stream->first_data == 0) {
+		stream->head[idx] = byte;
+	} else if (idx < stream->first_data + stream->ndata) {
+		stream->data[idx - stream->first_data] = byte;
+		stream->sum += byte;
+	} else {
+		stream->cksum = byte;
+	}
+	if (idx != 0) return;
+	switch (stream->file_type) {
+	case IHRT_I8:
+	case IHRT_I16:
+	case IHRT_I32:
+		stream->first_data = 4;
+		stream->ndata = byte;
+		stream->npairs = 4 + byte + 1;
+		break;
+	default:
+		if (stream->type >= 0
+		 && valid_type(stream->file_type, stream->type)) {
+			int addr_size = srec_addr_size(stream->type);
+			int size = byte - addr_size - 1;
+			if (size < 0) break;
+			stream->first_data = 1 + addr_size;
+			switch (stream->type) {
+			case IHRR_S0_HEADER:
+			case IHRR_S1_DATA_16:
+			case IHRR_S2_DATA_24:
+			case IHRR_S3_DATA_32:
+				stream->ndata = size;
+				break;
+			}
+			stream->npairs = 1 + addr_size + stream->ndata + 1;
+		}
+		break;
+	}
+}
+
+/* Intel HEX pairs start after the ':', SREC ones after the type. */
+static size_t first_pair_pos(const struct ihr_stream *stream)
+{
+	return stream->file_type <= IHRT_I32 ? 1 : 2;
+}
+
+/* Handle the next character of a line, which may be part of its ending. The
+ * first pair which is not hex stops the decoding. */
+static void stream_char(struct ihr_stream *stream, char ch)
+{
+	size_t pos = stream->pos++;
+	size_t first_pair = first_pair_pos(stream);
+	size_t idx;
+	IHR_U8 nibble = nibbles[(unsigned char)ch];
+	if (pos == 0) {
+		stream->start = ch;
+		return;
+	}
+	if (pos < first_pair) {
+		stream->type = nibble & NOT_NIBBLE ? -2 : nibble;
+		return;
+	}
+	idx = (pos - first_pair) / 2;
+	if (stream->bad >= 0 || idx >= (size_t)stream->npairs) return;
+	if ((pos - first_pair) % 2 == 0) {
+		stream->high = nibble;
+		if (nibble & NOT_NIBBLE) stream->bad_first = ch;
+	} else if ((stream->high | nibble) & NOT_NIBBLE) {
+		stream->bad = idx;
+		if (!(stream->high & NOT_NIBBLE)) stream->bad_first = '0';
+	} else {
+		stream_pair(stream, idx, stream->high << 4 | nibble);
+	}
+}
+
+/* Decide how the text of a line would have been read by ihr_read. Returns the
+ * column at which reading failed, with rec.type set to the negated error code,
+ * or the length of the line otherwise. */
+static size_t stream_judge(struct ihr_stream *stream)
+{
+	struct ihr_record *rec = &stream->rec;
+	size_t len = stream->pos;
+	size_t content = stream->content < len ? stream->content : len;
+	size_t end;
+	IHR_U8 right_cksum = stream->sum;
+	int i;
+	if (stream->file_type <= IHRT_I32) {
+		int min_size = -1;
+		if (len < IHR_I_MIN_LENGTH) goto error_sub_min_length;
+		if (stream->start != ':') goto error_missing_start;
+		if (stream->bad >= 0 && stream->bad < 4) {
+			rec->type = -IHRE_NOT_HEX;
+			return 1 + stream->bad * 2;
+		}
+		rec->size = stream->head[0];
+		rec->addr = stream->head[1] << 8 | stream->head[2];
+		rec->type = stream->head[3];
+		if (!valid_type(stream->file_type, stream->head[3])) {
+			rec->type = -IHRE_INVALID_TYPE;
+			return 7;
+		}
+		end = 9 + ((size_t)rec->size + 1) * 2;
+		if (len < end) goto error_invalid_size;
+		switch (rec->type) {
+		case IHRR_I_EXT_SEG_ADDR:
+		case IHRR_I_EXT_LIN_ADDR:
+			min_size = 2;
+			break;
+		case IHRR_I_START_SEG_ADDR:
+		case IHRR_I_START_LIN_ADDR:
+			min_size = 4;
+			break;
+		}
+		if (rec->type == IHRR_I_END_OF_FILE ?
+				rec->size != 0 : (int)rec->size < min_size)
+			goto error_invalid_size;
+		if (stream->bad >= 0) goto error_bad_pair;
+		for (i = 0; i < 4; ++i) {
+			right_cksum += stream->head[i];
+		}
+		right_cksum = (~right_cksum + 1) & 0xFF;
+	} else {
+		int addr_size;
+		if (len < IHR_S_MIN_LENGTH) goto error_sub_min_length;
+		if (stream->start != 'S') goto error_missing_start;
+		if (stream->type < 0) {
+			rec->type = -IHRE_NOT_HEX;
+			return 1;
+		}
+		if (!valid_type(stream->file_type, stream->type)) {
+			rec->type = -IHRE_INVALID_TYPE;
+			return 1;
+		}
+		if (stream->bad == 0) {
+			rec->type = -IHRE_NOT_HEX;
+			return 2;
+		}
+		addr_size = srec_addr_size(stream->type);
+		if (stream->first_data == 0) goto error_invalid_size;
+		rec->type = stream->type;
+		rec->size = stream->head[0] - addr_size - 1;
+		rec->addr = 0;
+		for (i = 1; i <= addr_size; ++i) {
+			if (len < (size_t)i * 2 + 4) goto error_invalid_size;
+			if (stream->bad == i) {
+				rec->type = -IHRE_NOT_HEX;
+				return 2 + i * 2;
+			}
+			rec->addr = rec->addr << 8 | stream->head[i];
+		}
+		end = 4 + ((size_t)addr_size + stream->ndata + 1) * 2;
+		if (stream->ndata != rec->size || len < end)
+			goto error_invalid_size;
+		if (stream->bad >= 0) goto error_bad_pair;
+		for (i = 0; i <= addr_size; ++i) {
+			right_cksum += stream->head[i];
+		}
+		right_cksum = ~right_cksum & 0xFF;
+	}
+	/* Check that the line ends after the checksum, as find_line_end does: */
+	if (end < content) {
+		rec->type = rec->size < IHR_MAX_SIZE ?
+			-IHRE_INVALID_SIZE : -IHRE_EXPECTED_EOL;
+		return end;
+	}
+	if (stream->cksum != right_cksum) {
+		rec->type = -IHRE_INVALID_CHECKSUM;
+		return len;
+	}
+	if (stream->file_type <= IHRT_I32) {
+		IHR_U8 *data = stream->data;
+		switch (rec->type) {
+		case IHRR_I_DATA:
+		case IHRR_I_END_OF_FILE:
+			rec->data.data = data;
+			break;
+		case IHRR_I_EXT_SEG_ADDR:
+		case IHRR_I_EXT_LIN_ADDR:
+			rec->data.ihex.base_addr = ((IHR_U16)data[0] << 8)
+				| (IHR_U16)data[1];
+			break;
+		case IHRR_I_START_SEG_ADDR:
+			rec->data.ihex.start.code_seg = ((IHR_U16)data[0] << 8)
+				| (IHR_U16)data[1];
+			rec->data.ihex.start.instr_ptr = ((IHR_U16)data[2] << 8)
+				| (IHR_U16)data[3];
+			break;
+		case IHRR_I_START_LIN_ADDR:
+			rec->data.ihex.ext_instr_ptr = ((IHR_U32)data[0] << 24)
+				| ((IHR_U32)data[1] << 16)
+				| ((IHR_U32)data[2] << 8) | (IHR_U32)data[3];
+			break;
+		}
+	} else {
+		rec->data.data = stream->data;
+	}
+	return len;
+
+error_sub_min_length:
+	rec->type = -IHRE_SUB_MIN_LENGTH;
+	return 0;
+
+error_missing_start:
+	rec->type = -IHRE_MISSING_START;
+	return 0;
+
+error_invalid_size:
+	rec->type = -IHRE_INVALID_SIZE;
+	return 1;
+
+error_bad_pair:
+	/* The data or checksum had a pair which was not hex: */
+	rec->type = invalid_hex_error(&stream->bad_first);
+	return first_pair_pos(stream) + stream->bad * 2;
+}
+
+/* Finish the current line, passing its record to fn. Returns the value of fn,
+ * or the negated error code if the line could not be read. */
+static int stream_end_line(struct ihr_stream *stream,
+	ihr_record_fn *fn,
+	void *ctx)
+{
+	size_t column = stream_judge(stream);
+	size_t line = stream->line++;
+	int status;
+	stream->state = STREAM_BLANK;
+	if (stream->rec.type < 0) {
+		stream->err.code = -stream->rec.type;
+		stream->err.line = line;
+		stream->err.column = column;
+		return stream->rec.type;
+	}
+	if ((status = fn(ctx, &stream->rec)) < 0) {
+		stream->err.code = -status;
+		stream->err.line = line;
+		stream->err.column = 0;
+	}
+	return status;
+}
+
+int ihr_stream_feed(struct ihr_stream *stream,
+	size_t len,
+	const char *text,
+	ihr_record_fn *fn,
+	void *ctx)
+{
+	size_t i = 0;
+	int status = 0;
+	while (i < len && status == 0) {
+		char ch = text[i];
+		switch (stream->state) {
+		case STREAM_BLANK_CR:
+			stream->state = STREAM_BLANK;
+			if (ch == '\n') {
+				++i;
+				break;
+			}
+			/* FALLTHROUGH */
+		case STREAM_BLANK:
+			if (ch == '\n' || ch == '\r') {
+				++stream->line;
+				if (ch == '\r') stream->state = STREAM_BLANK_CR;
+				++i;
+				break;
+			}
+			stream_start_line(stream);
+			/* FALLTHROUGH */
+		case STREAM_LINE:
+			/* Decode whole blocks of data where possible: */
+			if (stream->bad < 0 && stream->ndata > 0) {
+				size_t pos = stream->pos - first_pair_pos(stream);
+				size_t idx = pos / 2;
+				size_t first = stream->first_data;
+				if (pos % 2 == 0 && idx >= first
+				 && idx < first + stream->ndata) {
+					size_t left = first + stream->ndata - idx;
+					size_t done;
+					if (left > (len - i) / 2)
+						left = (len - i) / 2;
+					done = decode_blocks(text + i,
+						stream->data + (idx - first),
+						left, &stream->sum);
+					stream->pos += done * 2;
+					i += done * 2;
+					if (i >= len) break;
+					ch = text[i];
+				}
+			}
+			stream_char(stream, ch);
+			++i;
+			if (ch == '\n') {
+				if (stream->content > stream->pos)
+					stream->content = stream->pos - 1;
+				status = stream_end_line(stream, fn, ctx);
+			} else if (ch == '\r') {
+				stream->content = stream->pos - 1;
+				stream->state = STREAM_LINE_CR;
+			}
+			break;
+		case STREAM_LINE_CR:
+			if (ch == '\n') {
+				stream_char(stream, ch);
+				++i;
+			}
+			status = stream_end_line(stream, fn, ctx);
+			break;
+		}
+	}
+	stream->used = i;
+	return status;
+}
+
+int ihr_stream_end(struct ihr_stream *stream, ihr_record_fn *fn, void *ctx)
+{
+	int status = 0;
+	if (stream->state == STREAM_LINE || stream->state == STREAM_LINE_CR)
+		status = stream_end_line(stream, fn, ctx);
+	stream->state = STREAM_BLANK;
+	return status;
 }
@@ -4,13 +4,17 @@
 #include <stddef.h>
 #include <limits.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef unsigned char IHR_U8;
 typedef unsigned short IHR_U16;
 typedef unsigned
-#if INT_MAX == SHORT_MAX /* int is 16 bits */
+#if UINT_MAX < 0xFFFFFFFF /* int is 16 bits */
 	long
 #else
-	short
+	int
 #endif /* int is 16 bits */
 IHR_U32;
 
@@ -28,6 +32,10 @@ IHR_U32;
 #define IHRE_MISSING_START	5
 #define IHRE_NOT_HEX		7
 #define IHRE_SUB_MIN_LENGTH	9
+#define IHRE_SYSTEM		10
+#define IHRE_NO_MEMORY		11
+#define IHRE_INVALID_ADDR	12
+#define IHRE_OVERLAP		13
 
 /* Intel HEX record types */
 #define IHRR_I_DATA		0x00
@@ -76,4 +84,468 @@ int ihr_read(int file_type,
 	const char *text,
 	struct ihr_record *rec);
 
+/* Like ihr_read, but the data are decoded over their own digits in text, and
+ * rec->data.data is pointed at them there. */
+int ihr_read_in_place(int file_type,
+	size_t len,
+	char *text,
+	struct ihr_record *rec);
+
+/* A reader for one file type, which reads as ihr_read does. */
+typedef int ihr_read_fn(size_t len, const char *text, struct ihr_record *rec);
+
+/* Get the reader for a file type, or NULL if it is not a valid type. Each is
+ * compiled for its file type alone, so it does not check it on every record as
+ * ihr_read does. */
+ihr_read_fn *ihr_reader(int file_type);
+
+/* The readers ihr_reader returns, for calling one directly: */
+ihr_read_fn ihr_read_i8, ihr_read_i16, ihr_read_i32;
+ihr_read_fn ihr_read_s19, ihr_read_s28, ihr_read_s37;
+
+#ifdef IHR_STATS
+/* Phases of reading which statistics time: */
+#define IHRS_SCAN 0 /* Finding records with ihr_scan */
+#define IHRS_DECODE 1 /* Decoding and checking records */
+#define IHRS_PLACE 2 /* Adding records to images */
+#define IHRS_PHASES 3
+
+#define IHR_STATS_TYPES 16
+
+/* Counts of what the library has read, kept for a thread while it is given to
+ * ihr_stats_use. Only built with IHR_STATS defined. */
+struct ihr_stats {
+	unsigned long records[IHR_STATS_TYPES]; /* Read, by IHRR_* type */
+	unsigned long errors[IHR_STATS_TYPES]; /* Failed, by IHRE_* code */
+	unsigned long bytes; /* Data bytes decoded */
+	unsigned long lines; /* Lines gone through by iterators, blank or not */
+	double ticks[IHRS_PHASES]; /* Processor ticks spent in each phase, as
+				      estimated from a sample of the calls */
+	/* The rest is private. */
+	unsigned sample;
+};
+
+void ihr_stats_init(struct ihr_stats *stats);
+
+void ihr_stats_use(struct ihr_stats *stats);
+
+struct ihr_stats *ihr_stats_current(void);
+
+void ihr_stats_merge(struct ihr_stats *dest, const struct ihr_stats *src);
+#endif /* IHR_STATS */
+
+/* Guess the file type of a text from the records near its start and end.
+ * Returns an IHRT_* value or a negated error. */
+int ihr_detect(size_t len, const char *text);
+
+/* Flags for digests: */
+#define IHRD_CRC32 0x1 /* CRC-32 as used by zlib and Ethernet */
+#define IHRD_CRC32C 0x2 /* CRC-32C (Castagnoli) */
+#define IHRD_SHA256 0x4
+
+#define IHR_DIGEST_BUF 256
+
+/* Digests of a run of bytes, worked out as the bytes are given. It is set up by
+ * ihr_digest_init and finished by ihr_digest_end, which sets the results. */
+struct ihr_digest {
+	int flags; /* IHRD_* flags of the digests worked out */
+	IHR_U32 crc32;
+	IHR_U32 crc32c;
+	IHR_U8 sha256[32];
+	/* The rest is private. */
+	IHR_U32 crc[2];
+	IHR_U32 state[8];
+	IHR_U32 count[2]; /* Bytes given, low 32 bits first */
+	size_t used; /* Bytes waiting in buf */
+	IHR_U8 buf[IHR_DIGEST_BUF];
+};
+
+void ihr_digest_init(struct ihr_digest *digest, int flags);
+
+void ihr_digest_update(struct ihr_digest *digest,
+	size_t size,
+	const IHR_U8 *data);
+
+void ihr_digest_end(struct ihr_digest *digest);
+
+/* A cursor over a buffer of many records. It is set up by ihr_iter_init or
+ * ihr_iter_init_in_place and advanced by ihr_iter_next. */
+struct ihr_iter {
+	int file_type;
+	size_t len;
+	const char *text;
+	IHR_U8 *data; /* IHR_MAX_SIZE bytes where record data are read, or NULL
+			 to only check them */
+	size_t offset; /* Offset in text of the last record read */
+	size_t next; /* Offset in text where the next record is looked for */
+	size_t line; /* Line number (starting at 1) of the last record read */
+	struct ihr_digest *digest; /* Given the data of each data record read, or
+				      NULL */
+	size_t end; /* Records are looked for only before end, though they may
+		       run past it; len unless changed */
+	/* The rest is private. */
+	int in_place; /* Whether data are decoded over text when data is NULL */
+};
+
+void ihr_iter_init(struct ihr_iter *iter,
+	int file_type,
+	size_t len,
+	const char *text,
+	IHR_U8 *data);
+
+void ihr_iter_init_in_place(struct ihr_iter *iter,
+	int file_type,
+	size_t len,
+	char *text);
+
+int ihr_iter_next(struct ihr_iter *iter, struct ihr_record *rec);
+
+/* Receives each record read from a file. Returns 0 to keep reading, a positive
+ * number to stop, or a negative error code to fail. */
+typedef int ihr_record_fn(void *ctx, const struct ihr_record *rec);
+
+/* Where and why reading a file failed. */
+struct ihr_error {
+	int code; /* IHRE_* code */
+	size_t line; /* Line number, starting at 1 */
+	size_t column; /* Column, starting at 0 */
+};
+
+int ihr_validate(int file_type,
+	size_t len,
+	const char *text,
+	struct ihr_error *err);
+
+/* Data from a text at their absolute address, given by ihr_chunks_next. */
+struct ihr_chunk {
+	IHR_U32 addr; /* Where the data go, or the address field of a record
+			 without data */
+	size_t size;
+	const IHR_U8 *data; /* Valid until the next call of ihr_chunks_next */
+	int type; /* The IHRR_* type of the record */
+	const struct ihr_record *rec; /* The whole record, valid as data is */
+};
+
+/* Reads the data of a text, following extended address records. */
+struct ihr_chunks {
+	struct ihr_iter iter; /* Reads the records */
+	IHR_U32 base; /* Set by the last extended address record */
+	int records; /* If set, records without data are given as empty chunks
+			too */
+	/* The rest is private. */
+	const IHR_U8 *rest; /* Data left over when addresses wrap, or NULL */
+	IHR_U32 rest_addr;
+	size_t rest_size;
+	struct ihr_record rec;
+	IHR_U8 data[IHR_MAX_SIZE];
+};
+
+void ihr_chunks_init(struct ihr_chunks *chunks,
+	int file_type,
+	size_t len,
+	const char *text);
+
+int ihr_chunks_next(struct ihr_chunks *chunks,
+	struct ihr_chunk *chunk,
+	struct ihr_error *err);
+
+/* Records read by ihr_read_batch, kept as arrays of each field rather than an
+ * array of structures. The arrays and the arena share one allocation made by
+ * ihr_batch_init. */
+struct ihr_batch {
+	size_t cap; /* Records there is room for */
+	size_t count; /* Records read */
+	IHR_U32 *addrs;
+	size_t *offsets; /* Where the data of each record start in data */
+	IHR_U8 *sizes;
+	char *types;
+	IHR_U8 *data; /* The data of every record, one after another */
+	size_t data_len;
+	struct ihr_error err; /* Why reading stopped, if it failed */
+};
+
+int ihr_batch_init(struct ihr_batch *batch, size_t cap);
+
+int ihr_read_batch(struct ihr_iter *iter, struct ihr_batch *batch);
+
+void ihr_batch_free(struct ihr_batch *batch);
+
+/* Where the records of a text are, found by ihr_scan. Record i is the text from
+ * starts[i] to starts[i + 1], which may have blank lines after it. */
+struct ihr_lines {
+	size_t *starts; /* Offset of each line which is not blank, then the
+			   length of the text */
+	size_t *numbers; /* Line number of each, starting at 1 */
+	size_t count; /* Lines found */
+	size_t cap;
+	size_t stray; /* Index of the first line which does not start as a
+			 record of the file type would, or count if none */
+};
+
+void ihr_lines_init(struct ihr_lines *lines);
+
+int ihr_scan(struct ihr_lines *lines,
+	int file_type,
+	size_t len,
+	const char *text);
+
+void ihr_lines_free(struct ihr_lines *lines);
+
+/* A run of bytes at consecutive addresses. */
+struct ihr_segment {
+	IHR_U32 addr;
+	size_t size;
+	size_t cap; /* Bytes allocated for data */
+	IHR_U8 *data;
+	/* The rest is private. */
+	size_t front; /* Bytes allocated before data */
+};
+
+/* What an image does with data put where there are data already: */
+#define IHRO_LAST_WINS	0 /* The new data replace the old */
+#define IHRO_FIRST_WINS	1 /* The old data are kept */
+#define IHRO_ERROR	2 /* Differing data fail with IHRE_OVERLAP */
+
+/* Told of size bytes from addr where new data overlap old ones in an image,
+ * and whether any of those bytes differ. Returns 0 to go on, or a negative
+ * error code to fail. */
+typedef int ihr_overlap_fn(void *ctx, IHR_U32 addr, size_t size, int conflict);
+
+/* The memory contents described by a file, built up record by record. */
+struct ihr_image {
+	int file_type;
+	struct ihr_segment *segs; /* Sorted by address, neither overlapping nor
+				     adjacent */
+	size_t count;
+	size_t cap;
+	IHR_U32 base; /* Set by the last extended address record */
+	int start_type; /* Type of the start address record, or -1 if none */
+	IHR_U32 start; /* Start address, or CS:IP for IHRR_I_START_SEG_ADDR */
+	struct ihr_digest *digest; /* Given the data in address order as they are
+				      put, or NULL */
+	IHR_U8 fill; /* Byte given to the digest for gaps between segments */
+	int overlap; /* IHRO_* value */
+	ihr_overlap_fn *on_overlap; /* Told of each overlap, or NULL */
+	void *overlap_ctx;
+	/* The rest is private. */
+	int order;
+	IHR_U32 last;
+	struct ihr_pending *pending; /* Data not yet in segs, or NULL */
+};
+
+void ihr_image_init(struct ihr_image *img, int file_type);
+
+int ihr_image_add(void *img, const struct ihr_record *rec);
+
+int ihr_image_put(struct ihr_image *img,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data);
+
+int ihr_image_flush(struct ihr_image *img);
+
+const struct ihr_segment *ihr_image_find(const struct ihr_image *img,
+	IHR_U32 addr);
+
+void ihr_image_digest(const struct ihr_image *img, struct ihr_digest *digest);
+
+void ihr_image_free(struct ihr_image *img);
+
+/* A range of addresses. */
+struct ihr_range {
+	IHR_U32 addr;
+	size_t size;
+};
+
+/* Where two images differ. */
+struct ihr_diff {
+	struct ihr_range *ranges; /* Sorted by address, neither overlapping nor
+				     adjacent */
+	size_t count;
+	size_t cap;
+};
+
+void ihr_diff_init(struct ihr_diff *diff);
+
+int ihr_image_diff(struct ihr_diff *diff,
+	const struct ihr_image *a,
+	const struct ihr_image *b,
+	IHR_U32 page);
+
+void ihr_diff_free(struct ihr_diff *diff);
+
+/* A run of data at consecutive addresses from consecutive records. */
+struct ihr_run {
+	IHR_U32 addr; /* Address of the first byte */
+	IHR_U32 reach; /* Highest address in this run or any before it */
+	IHR_U32 base; /* Intel HEX base address before the first record */
+	size_t size; /* Bytes of data */
+	size_t offset; /* Offset in the text of the first record */
+	size_t end; /* Offset in the text after the last record */
+};
+
+/* Where the data of a text are, for reading a few addresses quickly. */
+struct ihr_index {
+	int file_type;
+	struct ihr_run *runs; /* Sorted by address */
+	size_t count;
+	size_t cap;
+};
+
+void ihr_index_init(struct ihr_index *index, int file_type);
+
+int ihr_index_build(struct ihr_index *index,
+	size_t len,
+	const char *text,
+	struct ihr_error *err);
+
+int ihr_index_get(const struct ihr_index *index,
+	size_t len,
+	const char *text,
+	IHR_U32 addr,
+	size_t size,
+	struct ihr_image *img);
+
+void ihr_index_free(struct ihr_index *index);
+
+/* A parser which is given text in pieces of any size. It is set up by
+ * ihr_stream_init and given text by ihr_stream_feed. */
+struct ihr_stream {
+	struct ihr_record rec; /* The last record read */
+	struct ihr_error err; /* The last error */
+	size_t used; /* Bytes of the last text given which were used */
+	/* The rest is private. */
+	int file_type;
+	int state;
+	size_t line;
+	size_t pos;
+	size_t content;
+	char start;
+	IHR_U8 high;
+	int type;
+	int bad;
+	char bad_first;
+	int npairs;
+	int first_data;
+	int ndata;
+	unsigned sum;
+	IHR_U8 cksum;
+	IHR_U8 head[5];
+	IHR_U8 data[IHR_MAX_SIZE];
+};
+
+void ihr_stream_init(struct ihr_stream *stream, int file_type);
+
+int ihr_stream_feed(struct ihr_stream *stream,
+	size_t len,
+	const char *text,
+	ihr_record_fn *fn,
+	void *ctx);
+
+int ihr_stream_end(struct ihr_stream *stream, ihr_record_fn *fn, void *ctx);
+
+/* Flags for writing: */
+#define IHRW_CRLF 0x1 /* End lines with "\r\n" rather than "\n" */
+
+/* Write rec as a line of text. text must have room for IHR_MAX_LENGTH
+ * characters. Returns the number written or a negated error. */
+int ihr_write(int file_type,
+	int flags,
+	const struct ihr_record *rec,
+	char *text);
+
+/* Writes runs of data as records, along with the extended address records they
+ * need. It is set up by ihr_writer_init and given data by ihr_write_data. */
+struct ihr_writer {
+	int file_type;
+	int flags;
+	IHR_U8 rec_size; /* Most data bytes in a record */
+	IHR_U32 base; /* Intel HEX base address of the last record written */
+	size_t len; /* Characters written by the last call */
+	size_t used; /* Bytes of data written by the last call */
+};
+
+void ihr_writer_init(struct ihr_writer *writer, int file_type, int flags);
+
+int ihr_write_data(struct ihr_writer *writer,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data,
+	size_t cap,
+	char *text);
+
+/* Defined in ihr_posix.c, which needs a POSIX system: */
+
+/* An image loaded by ihr_cache_load. The segments of img point into a mapping
+ * of the cache file, so img must not be changed or given to ihr_image_free. */
+struct ihr_cache {
+	struct ihr_image img;
+	/* The rest is private. */
+	void *map;
+	size_t map_len;
+};
+
+int ihr_load_file(const char *path,
+	int file_type,
+	ihr_record_fn *fn,
+	void *ctx,
+	struct ihr_error *err);
+
+int ihr_load_files(size_t count,
+	const char *const *paths,
+	int file_type,
+	ihr_record_fn *fn,
+	void *const *ctxs,
+	struct ihr_error *errs);
+
+int ihr_image_read(struct ihr_image *img,
+	size_t len,
+	const char *text,
+	int threads,
+	struct ihr_error *err);
+
+/* Flag for ihr_check_files to only validate the files: */
+#define IHRC_VALIDATE 0x100
+
+/* What ihr_check_files found in a file. */
+struct ihr_file_result {
+	int status; /* As ihr_image_read or ihr_validate would return */
+	struct ihr_error err;
+	size_t segments; /* Segments in the image of the file */
+	size_t size; /* Bytes of data in the image */
+	struct ihr_digest digest; /* Of the image, as ihr_image_digest gives */
+};
+
+int ihr_check_files(size_t count,
+	const char *const *paths,
+	int file_type,
+	int flags,
+	int threads,
+	struct ihr_file_result *results);
+
+int ihr_index_save(const struct ihr_index *index,
+	const char *path,
+	const char *text_path);
+
+int ihr_index_load(struct ihr_index *index,
+	const char *path,
+	const char *text_path);
+
+int ihr_cache_save(const struct ihr_image *img,
+	const char *path,
+	size_t len,
+	const char *text);
+
+int ihr_cache_load(struct ihr_cache *cache,
+	int file_type,
+	const char *path,
+	size_t len,
+	const char *text);
+
+void ihr_cache_free(struct ihr_cache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* IHR_INCLUDED */
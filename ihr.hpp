@@ -0,0 +1,297 @@
+#ifndef IHR_HPP_INCLUDED
+#define IHR_HPP_INCLUDED
+
+/* A C++20 range over the records of a text, built on ihr_chunks. Nothing is
+ * allocated: the data of each record are decoded into a buffer in the range,
+ * or over their own digits in a writable text.
+ *
+ * Readers for a file type known at compile time, ihr::reader<F> for each of
+ * the formats in ihr::format, follow the range. */
+
+#include "ihr.h"
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <string_view>
+
+namespace ihr {
+
+/* A record read from a text. Its members are valid until the range moves on. */
+struct record {
+	int type; /* IHRR_* */
+	IHR_U32 addr; /* Absolute address of the data, or the address field of
+			 a record without data */
+	std::span<const std::byte> data; /* Empty for records without data */
+	std::size_t line; /* Line number, starting at 1 */
+	const ihr_record *raw; /* The record as ihr_read gives it */
+};
+
+/* Either a value or the ihr_error which took its place, in the manner of
+ * std::expected. */
+template <class T>
+class result {
+public:
+	result() : value_(), error_() {}
+	result(const T &value) : value_(value), error_() {}
+	explicit result(const ihr_error &error) : value_(), error_(error) {}
+
+	bool has_value() const { return error_.code == 0; }
+	explicit operator bool() const { return has_value(); }
+	/* The value, which is only meaningful if has_value(): */
+	const T &value() const { return value_; }
+	const T &operator*() const { return value_; }
+	const T *operator->() const { return &value_; }
+	/* Why there is no value, with code 0 if there is one: */
+	const ihr_error &error() const { return error_; }
+
+private:
+	T value_;
+	ihr_error error_;
+};
+
+/* Picks the constructor of records which decodes in place. */
+struct in_place_t {
+	explicit in_place_t() = default;
+};
+inline constexpr in_place_t in_place{};
+
+/* The records of a text, for range-for and <algorithm>. Each gives a result
+ * holding a record or the error of a bad one; reading goes on after an error
+ * from the next line, and stops after an end record. The data of records which
+ * run past the top of a segment or of the address space are given as two
+ * records of the same type. A range can be iterated once. */
+class records {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = result<record>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type *;
+		using reference = const value_type &;
+
+		iterator() : range_(nullptr) {}
+		explicit iterator(records *range) : range_(range) {}
+
+		reference operator*() const { return range_->current_; }
+		pointer operator->() const { return &range_->current_; }
+		iterator &operator++()
+		{
+			range_->next();
+			return *this;
+		}
+		iterator operator++(int)
+		{
+			iterator old = *this;
+			range_->next();
+			return old;
+		}
+
+		/* Iterators are equal if both are at the end or both are in
+		 * the same range, which has one position: */
+		friend bool operator==(const iterator &a, const iterator &b)
+		{
+			return a.at_end() == b.at_end()
+				&& (a.at_end() || a.range_ == b.range_);
+		}
+
+	private:
+		bool at_end() const { return !range_ || range_->done_; }
+
+		records *range_;
+	};
+
+	/* Read the records of text, decoding their data into the range. */
+	records(std::string_view text, int file_type) : done_(false),
+		started_(false)
+	{
+		ihr_chunks_init(&chunks_, file_type, text.size(), text.data());
+		chunks_.records = 1;
+	}
+
+	/* Read the records of text, decoding their data over their digits. */
+	records(in_place_t, std::span<char> text, int file_type) : done_(false),
+		started_(false)
+	{
+		ihr_chunks_init(&chunks_, file_type, text.size(), text.data());
+		ihr_iter_init_in_place(&chunks_.iter, file_type, text.size(),
+			text.data());
+		chunks_.records = 1;
+	}
+
+	/* Iterators point into the range, so it stays put: */
+	records(const records &) = delete;
+	records &operator=(const records &) = delete;
+
+	iterator begin()
+	{
+		if (!started_) {
+			started_ = true;
+			next();
+		}
+		return iterator(this);
+	}
+
+	iterator end() { return iterator(); }
+
+private:
+	void next()
+	{
+		ihr_chunk chunk;
+		ihr_error err;
+		int status = ihr_chunks_next(&chunks_, &chunk, &err);
+		if (status == 0) {
+			done_ = true;
+		} else if (status < 0) {
+			current_ = result<record>(err);
+		} else {
+			const std::byte *data =
+				reinterpret_cast<const std::byte *>(chunk.data);
+			record rec;
+			rec.type = chunk.type;
+			rec.addr = chunk.addr;
+			rec.data = std::span<const std::byte>(data, chunk.size);
+			rec.line = chunks_.iter.line;
+			rec.raw = chunk.rec;
+			current_ = result<record>(rec);
+		}
+	}
+
+	ihr_chunks chunks_;
+	result<record> current_;
+	bool done_;
+	bool started_;
+};
+
+namespace format {
+
+constexpr unsigned bit(int type) { return 1U << type; }
+
+/* Each format has its IHRT_* file type, the IHRR_* record types it allows as a
+ * bit for each, the number of bytes in the address of its data records, the
+ * highest address its data can have, and the C reader for it. */
+struct I8 {
+	static constexpr int file_type = IHRT_I8;
+	static constexpr unsigned types = bit(IHRR_I_DATA)
+		| bit(IHRR_I_END_OF_FILE);
+	static constexpr int addr_size = 2;
+	static constexpr IHR_U32 top = 0xFFFF;
+	static constexpr ihr_read_fn *read = ihr_read_i8;
+};
+
+struct I16 {
+	static constexpr int file_type = IHRT_I16;
+	static constexpr unsigned types = bit(IHRR_I_DATA)
+		| bit(IHRR_I_END_OF_FILE) | bit(IHRR_I_EXT_SEG_ADDR)
+		| bit(IHRR_I_START_SEG_ADDR);
+	static constexpr int addr_size = 2;
+	static constexpr IHR_U32 top = 0xFFFFF;
+	static constexpr ihr_read_fn *read = ihr_read_i16;
+};
+
+struct I32 {
+	static constexpr int file_type = IHRT_I32;
+	static constexpr unsigned types = bit(IHRR_I_DATA)
+		| bit(IHRR_I_END_OF_FILE) | bit(IHRR_I_EXT_LIN_ADDR)
+		| bit(IHRR_I_START_LIN_ADDR);
+	static constexpr int addr_size = 2;
+	static constexpr IHR_U32 top = 0xFFFFFFFF;
+	static constexpr ihr_read_fn *read = ihr_read_i32;
+};
+
+struct S19 {
+	static constexpr int file_type = IHRT_S19;
+	static constexpr unsigned types = bit(IHRR_S0_HEADER)
+		| bit(IHRR_S5_COUNT_16) | bit(IHRR_S1_DATA_16)
+		| bit(IHRR_S9_START_16);
+	static constexpr int addr_size = 2;
+	static constexpr IHR_U32 top = 0xFFFF;
+	static constexpr ihr_read_fn *read = ihr_read_s19;
+};
+
+struct S28 {
+	static constexpr int file_type = IHRT_S28;
+	static constexpr unsigned types = bit(IHRR_S0_HEADER)
+		| bit(IHRR_S5_COUNT_16) | bit(IHRR_S2_DATA_24)
+		| bit(IHRR_S8_START_24) | bit(IHRR_S6_COUNT_24);
+	static constexpr int addr_size = 3;
+	static constexpr IHR_U32 top = 0xFFFFFF;
+	static constexpr ihr_read_fn *read = ihr_read_s28;
+};
+
+struct S37 {
+	static constexpr int file_type = IHRT_S37;
+	static constexpr unsigned types = bit(IHRR_S0_HEADER)
+		| bit(IHRR_S5_COUNT_16) | bit(IHRR_S3_DATA_32)
+		| bit(IHRR_S7_START_32) | bit(IHRR_S6_COUNT_24);
+	static constexpr int addr_size = 4;
+	static constexpr IHR_U32 top = 0xFFFFFFFF;
+	static constexpr ihr_read_fn *read = ihr_read_s37;
+};
+
+} /* namespace format */
+
+/* Reads the records of the format F, one of those in ihr::format. What the
+ * format allows is worked out at compile time, and read calls the C reader for
+ * the format directly, so it reads as ihr_read does without looking at the
+ * file type. */
+template <class F>
+class reader {
+public:
+	using format_type = F;
+	static constexpr int file_type = F::file_type;
+	static constexpr bool srec = file_type >= IHRT_S19;
+
+	/* Whether records of the IHRR_* type may be in the format: */
+	static constexpr bool valid(int type)
+	{
+		return type >= 0 && type < 16 && (F::types >> type & 1);
+	}
+
+	/* The number of bytes in the address of a record of a valid type: */
+	static constexpr int addr_size(int type)
+	{
+		constexpr int srec_sizes[16] = {
+			2, 2, 3, 4, 2, 2, 3, 4, 3, 2, 2, 2, 2, 2, 2, 2
+		};
+		return srec ? srec_sizes[type & 15] : 2;
+	}
+
+	/* Read the record at the start of text as ihr_read does. */
+	static int read(std::string_view text, ihr_record &rec)
+	{
+		return F::read(text.size(), text.data(), &rec);
+	}
+
+	/* Read the record at the start of text, decoding its data into the
+	 * reader. Returns the length of the record, or 0 if it is bad, when
+	 * error() gives its error code. */
+	std::size_t operator()(std::string_view text)
+	{
+		int reclen;
+		rec_.data.data = data_;
+		reclen = read(text, rec_);
+		return reclen < 0 ? 0 : reclen;
+	}
+
+	/* The record last read by operator(), whose data are valid until the
+	 * next: */
+	const ihr_record &record() const { return rec_; }
+	std::span<const std::byte> data() const
+	{
+		const std::byte *data =
+			reinterpret_cast<const std::byte *>(data_);
+		return std::span<const std::byte>(data,
+			rec_.type >= 0 ? rec_.size : 0);
+	}
+	/* The error code of the record last read, or 0 if it was good: */
+	int error() const { return rec_.type < 0 ? -rec_.type : 0; }
+
+private:
+	ihr_record rec_{};
+	IHR_U8 data_[IHR_MAX_SIZE];
+};
+
+} /* namespace ihr */
+
+#endif /* IHR_HPP_INCLUDED */
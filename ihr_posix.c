@@ -0,0 +1,1661 @@
+#define _POSIX_C_SOURCE 200112L
+#define _XOPEN_SOURCE 600 /* For pread */
+
+/* io_uring is used where the kernel headers have it. Build with IHR_NO_IO_URING
+ * to always read files with pread instead. */
+#if defined(__linux__) && defined(__GNUC__) && !defined(IHR_NO_IO_URING) \
+ && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		define HAVE_IO_URING 1
+#		define _DEFAULT_SOURCE /* For syscall */
+#	endif
+#endif
+#ifndef HAVE_IO_URING
+#	define HAVE_IO_URING 0
+#endif
+
+#include "ihr.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if HAVE_IO_URING
+#	include <linux/io_uring.h>
+#	include <sys/syscall.h>
+/* Headers with this flag have the operations which open and close files: */
+#	ifdef IORING_FEAT_CUR_PERSONALITY
+#		define HAVE_RING_OPEN 1
+#	endif
+#endif
+#ifndef HAVE_RING_OPEN
+#	define HAVE_RING_OPEN 0
+#endif
+
+/* The part of a mapping already read is given back to the system in pieces of
+ * this size, so that big files do not stay resident as a whole. */
+#define UNMAP_CHUNK ((size_t)1 << 22)
+
+/* Texts are not split into pieces smaller than this for parallel reading. */
+#define MIN_PART ((size_t)1 << 16)
+
+/* Map the file at path for reading. On success, *len is set to its size and
+ * *text to the mapping, or to NULL if the file is empty. Returns -IHRE_SYSTEM
+ * on failure with errno set. */
+static int map_file(const char *path, size_t *len, char **text)
+{
+	struct stat st;
+	int fd;
+	void *map;
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -IHRE_SYSTEM;
+	if (fstat(fd, &st)) goto error;
+	if (st.st_size == 0) {
+		*len = 0;
+		*text = NULL;
+		close(fd);
+		return 0;
+	}
+	if ((off_t)(size_t)st.st_size != st.st_size) {
+		errno = EFBIG;
+		goto error;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) goto error;
+	close(fd);
+	posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+	*len = st.st_size;
+	*text = map;
+	return 0;
+
+error:
+	{
+		int errnum = errno;
+		close(fd);
+		errno = errnum;
+	}
+	return -IHRE_SYSTEM;
+}
+
+int ihr_load_file(const char *path,
+	int file_type,
+	ihr_record_fn *fn,
+	void *ctx,
+	struct ihr_error *err)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	char *text;
+	size_t len, unmapped = 0;
+	int reclen, status = 0;
+	err->code = 0;
+	err->line = 0;
+	err->column = 0;
+	if ((status = map_file(path, &len, &text)) < 0) {
+		err->code = -status;
+		return status;
+	}
+	ihr_iter_init(&iter, file_type, len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		if (reclen < 0) {
+			err->code = -rec.type;
+			err->line = iter.line;
+			err->column = ~reclen;
+			status = rec.type;
+			break;
+		}
+		if ((status = fn(ctx, &rec)) != 0) {
+			if (status < 0) {
+				err->code = -status;
+				err->line = iter.line;
+			}
+			break;
+		}
+		/* Give back whole pages that have been read: */
+		if (iter.next - unmapped >= UNMAP_CHUNK) {
+			size_t end = iter.next - iter.next % UNMAP_CHUNK;
+			munmap(text + unmapped, end - unmapped);
+			unmapped = end;
+		}
+	}
+	if (len > unmapped) munmap(text + unmapped, len - unmapped);
+	return status;
+}
+
+/* One piece of a text being read in parallel. */
+struct part {
+	const struct ihr_image *img; /* The image being built */
+	const char *text; /* The piece */
+	size_t end; /* Its length */
+	size_t len; /* The length of the rest of the text */
+	/* Data before the first extended address record, placed as if the
+	 * base address were 0: */
+	struct ihr_image before;
+	/* Data after it, placed at their absolute addresses: */
+	struct ihr_image after;
+	int has_base; /* Whether after is in use */
+	int check; /* Whether the records are only checked, not added */
+#ifdef IHR_STATS
+	int counted; /* Whether stats are kept */
+	struct ihr_stats stats; /* What reading the piece counted */
+#endif
+	pthread_t thread;
+	int threaded; /* Whether the piece is read on its own thread */
+	int status; /* As would be returned for the whole text */
+	size_t line; /* Counting from the start of the piece */
+	size_t column;
+};
+
+static void read_piece(struct part *part)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	struct ihr_image *img = &part->before;
+	int reclen;
+	if (part->check) {
+		/* Records are checked as in the whole text, so the last one of
+		 * the piece may run past its end and fail as it would there: */
+		ihr_iter_init(&iter, part->img->file_type, part->len, part->text,
+			NULL);
+		iter.end = part->end;
+		while ((reclen = ihr_iter_next(&iter, &rec)) > 0);
+		if (reclen < 0) {
+			part->status = rec.type;
+			part->line = iter.line;
+			part->column = ~reclen;
+		}
+		return;
+	}
+	/* Records starting in the piece are read as in the whole text, so the
+	 * last one may run past its end and fail as it would there. Each is
+	 * read by one piece only, so that it is counted once in statistics: */
+	ihr_iter_init(&iter, part->img->file_type, part->len, part->text, data);
+	iter.end = part->end;
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		if (reclen < 0) {
+			part->status = rec.type;
+			part->line = iter.line;
+			part->column = ~reclen;
+			break;
+		}
+		if (!part->has_base && (part->img->file_type == IHRT_I16
+				|| part->img->file_type == IHRT_I32)
+		 && (rec.type == IHRR_I_EXT_SEG_ADDR
+				|| rec.type == IHRR_I_EXT_LIN_ADDR)) {
+			part->has_base = 1;
+			img = &part->after;
+		}
+		if ((part->status = ihr_image_add(img, &rec)) != 0) {
+			part->line = iter.line;
+			break;
+		}
+	}
+}
+
+static void *read_part(void *arg)
+{
+#ifdef IHR_STATS
+	/* Each piece counts on its own, to be merged with the rest later: */
+	struct part *part = arg;
+	struct ihr_stats *outer = ihr_stats_current();
+	if (part->counted) {
+		ihr_stats_init(&part->stats);
+		ihr_stats_use(&part->stats);
+	}
+	read_piece(part);
+	ihr_stats_use(outer);
+#else
+	read_piece(arg);
+#endif
+	return NULL;
+}
+
+/* Move the segments of src into img, adding offset to their addresses. Buffers
+ * of segments which can go after the last one of img are taken over instead of
+ * copied, unless img has a digest to be given the data. src is left empty. */
+static int move_segments(struct ihr_image *img,
+	struct ihr_image *src,
+	IHR_U32 offset)
+{
+	IHR_U32 put_last = 0; /* The last address of the data put below */
+	int status, put = 0;
+	size_t i;
+	/* Pending data must be in the segments, to be taken over in order: */
+	status = ihr_image_flush(src);
+	if (status == 0) status = ihr_image_flush(img);
+	for (i = 0; i < src->count && status == 0; ++i) {
+		struct ihr_segment *seg = &src->segs[i];
+		struct ihr_segment *last = img->count ?
+			&img->segs[img->count - 1] : NULL;
+		IHR_U32 addr = seg->addr + offset;
+		/* Data put out of order may wait anywhere up to put_last: */
+		if (!img->digest
+		 && seg->size - 1 <= (IHR_U32)(0xFFFFFFFF - addr)
+		 && (!last || (last->addr < addr
+				&& addr - last->addr > last->size))
+		 && (!put || addr > put_last)) {
+			if (img->count == img->cap) {
+				size_t cap = img->cap ? img->cap * 2 : 16;
+				struct ihr_segment *segs = realloc(img->segs,
+					cap * sizeof(*segs));
+				if (!segs) {
+					status = -IHRE_NO_MEMORY;
+					break;
+				}
+				img->segs = segs;
+				img->cap = cap;
+			}
+			img->segs[img->count] = *seg;
+			img->segs[img->count].addr = addr;
+			++img->count;
+			/* The buffer is img's now: */
+			seg->data = NULL;
+			seg->front = 0;
+			continue;
+		}
+		status = ihr_image_put(img, addr, seg->size, seg->data);
+		if (seg->size - 1 > (IHR_U32)(0xFFFFFFFF - addr))
+			put_last = 0xFFFFFFFF;
+		else if (!put || addr + (IHR_U32)(seg->size - 1) > put_last)
+			put_last = addr + (IHR_U32)(seg->size - 1);
+		put = 1;
+	}
+	ihr_image_free(src);
+	return status;
+}
+
+/* Count the line endings before text + len as ihr_iter does. */
+static size_t count_lines(size_t len, const char *text)
+{
+	size_t lines = 0, i;
+	for (i = 0; i < len; ++i) {
+		if (text[i] == '\n'
+		 || (text[i] == '\r' && (i + 1 >= len || text[i + 1] != '\n')))
+			++lines;
+	}
+	return lines;
+}
+
+/* Split text after line feeds into nparts pieces for img. Every line feed ends
+ * a record or blank line, so the pieces read the same as the whole text. */
+static void split_text(const struct ihr_image *img,
+	size_t len,
+	const char *text,
+	size_t nparts,
+	struct part *parts)
+{
+	size_t start, i;
+	for (start = 0, i = 0; i < nparts; ++i) {
+		struct part *part = &parts[i];
+		size_t end = len / nparts * (i + 1);
+		if (i + 1 == nparts) {
+			end = len;
+		} else {
+			const char *lf;
+			if (end < start) end = start;
+			lf = memchr(text + end, '\n', len - end);
+			end = lf ? (size_t)(lf - text) + 1 : len;
+		}
+		part->img = img;
+		part->text = text + start;
+		part->end = end - start;
+		part->len = len - start;
+		ihr_image_init(&part->before, img->file_type);
+		ihr_image_init(&part->after, img->file_type);
+		part->before.overlap = img->overlap;
+		part->after.overlap = img->overlap;
+		start = end;
+	}
+}
+
+/* Put the pieces of text which have been read into img in order, stopping
+ * where reading the whole text would have stopped. The pieces are freed.
+ * Returns as ihr_image_read does. */
+static int join_parts(struct ihr_image *img,
+	const char *text,
+	size_t nparts,
+	struct part *parts,
+	struct ihr_error *err)
+{
+	size_t i;
+	int status = 0, flushed;
+	for (i = 0; i < nparts; ++i) {
+		struct part *part = &parts[i];
+		if (status != 0) {
+			ihr_image_free(&part->before);
+			ihr_image_free(&part->after);
+			continue;
+		}
+		if (part->after.start_type >= 0) {
+			img->start_type = part->after.start_type;
+			img->start = part->after.start;
+		} else if (part->before.start_type >= 0) {
+			img->start_type = part->before.start_type;
+			img->start = part->before.start;
+		}
+		status = move_segments(img, &part->before, img->base);
+		if (part->has_base) {
+			int moved;
+			img->base = part->after.base;
+			moved = move_segments(img, &part->after, 0);
+			if (status == 0) status = moved;
+		}
+		if (status == 0 && part->status != 0) {
+			status = part->status;
+			if (status < 0) {
+				err->code = -status;
+				err->line = count_lines(part->text - text, text)
+					+ part->line;
+				err->column = part->column;
+			}
+		} else if (status < 0) {
+			err->code = -status;
+		}
+	}
+	/* The data read before an error are kept, so they are merged too: */
+	flushed = ihr_image_flush(img);
+	if (flushed && status >= 0) {
+		status = flushed;
+		err->code = -status;
+	}
+	return status;
+}
+
+int ihr_image_read(struct ihr_image *img,
+	size_t len,
+	const char *text,
+	int threads,
+	struct ihr_error *err)
+{
+	struct part *parts;
+	size_t nparts, i;
+	int status;
+	err->code = 0;
+	err->line = 0;
+	err->column = 0;
+	if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	nparts = threads > 0 ? (size_t)threads : 1;
+	if (nparts > len / MIN_PART) nparts = len / MIN_PART;
+	/* Overlaps are reported and failed on in the order of the text, with
+	 * the line they are on, so one thread reads it all: */
+	if (nparts == 0 || img->on_overlap || img->overlap == IHRO_ERROR)
+		nparts = 1;
+	parts = calloc(nparts, sizeof(*parts));
+	if (!parts) {
+		err->code = IHRE_NO_MEMORY;
+		return -IHRE_NO_MEMORY;
+	}
+	split_text(img, len, text, nparts, parts);
+#ifdef IHR_STATS
+	for (i = 0; i < nparts; ++i)
+		parts[i].counted = ihr_stats_current() != NULL;
+#endif
+	/* The first piece is read on this thread, as are any others for which
+	 * a thread could not be started: */
+	for (i = 1; i < nparts; ++i) {
+		parts[i].threaded = !pthread_create(&parts[i].thread, NULL,
+			read_part, &parts[i]);
+	}
+	read_part(&parts[0]);
+	for (i = 1; i < nparts; ++i) {
+		if (parts[i].threaded)
+			pthread_join(parts[i].thread, NULL);
+		else
+			read_part(&parts[i]);
+	}
+	status = join_parts(img, text, nparts, parts, err);
+#ifdef IHR_STATS
+	for (i = 0; i < nparts; ++i) {
+		if (parts[i].counted)
+			ihr_stats_merge(ihr_stats_current(), &parts[i].stats);
+	}
+#endif
+	free(parts);
+	return status;
+}
+
+/* Files are split into pieces of about this size for ihr_check_files, so that
+ * a big file is shared between the threads. */
+#define CHECK_PART ((size_t)1 << 23)
+
+/* The task which maps a file and splits it into pieces. */
+#define OPEN_FILE ((size_t)-1)
+
+/* A file being checked. */
+struct check_file {
+	char *text;
+	size_t len;
+	struct ihr_image img;
+	struct part *parts;
+	size_t nparts;
+	size_t left; /* Pieces not yet read */
+};
+
+/* A file to open or a piece of one to read. */
+struct task {
+	size_t file;
+	size_t part; /* Or OPEN_FILE */
+};
+
+/* A thread of a pool, with its own tasks. It takes the newest of them, and
+ * when it has none left, takes the oldest task of another. */
+struct worker {
+	struct pool *pool;
+	size_t id;
+	pthread_mutex_t lock; /* Guards the tasks */
+	struct task *tasks;
+	size_t head, tail; /* The tasks are those from head up to tail */
+	size_t cap;
+	pthread_t thread;
+	int threaded;
+};
+
+struct pool {
+	const char *const *paths;
+	int file_type;
+	int flags;
+	struct ihr_file_result *results;
+	struct check_file *files;
+	struct worker *workers;
+	size_t nworkers;
+	pthread_mutex_t lock; /* Guards the counts below and the left counts of
+				 files */
+	pthread_cond_t wake; /* Signalled when there is more to do or all is
+				done */
+	size_t queued; /* Tasks waiting in the workers */
+	size_t pending; /* Tasks queued or being done */
+#ifdef IHR_STATS
+	struct ihr_stats *stats; /* Of the calling thread, or NULL */
+#endif
+};
+
+/* Give worker a task. Returns 0, or -1 if memory ran out, in which case the
+ * caller must do the task itself. */
+static int push_task(struct worker *worker, size_t file, size_t part)
+{
+	struct pool *pool = worker->pool;
+	/* The task is counted before another worker can take it and count it
+	 * off: */
+	pthread_mutex_lock(&pool->lock);
+	++pool->queued;
+	++pool->pending;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_lock(&worker->lock);
+	if (worker->tail == worker->cap) {
+		if (worker->head > 0) {
+			memmove(worker->tasks, worker->tasks + worker->head,
+				(worker->tail - worker->head)
+					* sizeof(*worker->tasks));
+			worker->tail -= worker->head;
+			worker->head = 0;
+		} else {
+			size_t cap = worker->cap ? worker->cap * 2 : 16;
+			struct task *tasks = realloc(worker->tasks,
+				cap * sizeof(*tasks));
+			if (!tasks) {
+				pthread_mutex_unlock(&worker->lock);
+				pthread_mutex_lock(&pool->lock);
+				--pool->queued;
+				--pool->pending;
+				pthread_mutex_unlock(&pool->lock);
+				return -1;
+			}
+			worker->tasks = tasks;
+			worker->cap = cap;
+		}
+	}
+	worker->tasks[worker->tail].file = file;
+	worker->tasks[worker->tail].part = part;
+	++worker->tail;
+	pthread_mutex_unlock(&worker->lock);
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/* Take a task for worker, from its own or another's. Returns 1 if one was
+ * found, or 0 otherwise. */
+static int take_task(struct worker *worker, struct task *task)
+{
+	struct pool *pool = worker->pool;
+	size_t i;
+	int found = 0;
+	pthread_mutex_lock(&worker->lock);
+	if (worker->tail > worker->head) {
+		*task = worker->tasks[--worker->tail];
+		found = 1;
+	}
+	pthread_mutex_unlock(&worker->lock);
+	for (i = 1; i < pool->nworkers && !found; ++i) {
+		struct worker *victim =
+			&pool->workers[(worker->id + i) % pool->nworkers];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->tail > victim->head) {
+			*task = victim->tasks[victim->head++];
+			found = 1;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	if (found) {
+		pthread_mutex_lock(&pool->lock);
+		--pool->queued;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return found;
+}
+
+/* Put together the pieces of a file which have all been read, and give its
+ * result. */
+static void finish_file(struct pool *pool, size_t i)
+{
+	struct check_file *file = &pool->files[i];
+	struct ihr_file_result *result = &pool->results[i];
+	size_t j;
+	result->status = join_parts(&file->img, file->text, file->nparts,
+		file->parts, &result->err);
+#ifdef IHR_STATS
+	if (pool->stats) {
+		pthread_mutex_lock(&pool->lock);
+		for (j = 0; j < file->nparts; ++j)
+			ihr_stats_merge(pool->stats, &file->parts[j].stats);
+		pthread_mutex_unlock(&pool->lock);
+	}
+#endif
+	result->segments = file->img.count;
+	for (j = 0; j < file->img.count; ++j)
+		result->size += file->img.segs[j].size;
+	if (result->digest.flags && !(pool->flags & IHRC_VALIDATE))
+		ihr_image_digest(&file->img, &result->digest);
+	ihr_image_free(&file->img);
+	free(file->parts);
+	file->parts = NULL;
+	if (file->text) munmap(file->text, file->len);
+}
+
+/* Read a piece of a file, finishing the file if it was the last. */
+static void check_part(struct pool *pool, size_t i, size_t part)
+{
+	struct check_file *file = &pool->files[i];
+	int last;
+	read_part(&file->parts[part]);
+	pthread_mutex_lock(&pool->lock);
+	last = --file->left == 0;
+	pthread_mutex_unlock(&pool->lock);
+	if (last) finish_file(pool, i);
+}
+
+/* Map a file and split it into pieces, which are given to worker. The first is
+ * read straight away. */
+static void open_file(struct worker *worker, size_t i)
+{
+	struct pool *pool = worker->pool;
+	struct check_file *file = &pool->files[i];
+	struct ihr_file_result *result = &pool->results[i];
+	size_t nparts, j;
+	int status = map_file(pool->paths[i], &file->len, &file->text);
+	if (status < 0) {
+		result->status = status;
+		result->err.code = -status;
+		return;
+	}
+	nparts = file->len / CHECK_PART;
+	if (nparts == 0) nparts = 1;
+	file->parts = calloc(nparts, sizeof(*file->parts));
+	if (!file->parts) {
+		result->status = -IHRE_NO_MEMORY;
+		result->err.code = IHRE_NO_MEMORY;
+		if (file->text) munmap(file->text, file->len);
+		return;
+	}
+	ihr_image_init(&file->img, pool->file_type);
+	split_text(&file->img, file->len, file->text, nparts, file->parts);
+	for (j = 0; j < nparts; ++j) {
+		file->parts[j].check = (pool->flags & IHRC_VALIDATE) != 0;
+#ifdef IHR_STATS
+		file->parts[j].counted = pool->stats != NULL;
+#endif
+	}
+	file->nparts = nparts;
+	file->left = nparts;
+	/* The last pieces are given first, since the others take the oldest: */
+	for (j = nparts; j-- > 1;) {
+		if (push_task(worker, i, j)) check_part(pool, i, j);
+	}
+	check_part(pool, i, 0);
+}
+
+static void *work(void *arg)
+{
+	struct worker *worker = arg;
+	struct pool *pool = worker->pool;
+	struct task task;
+	for (;;) {
+		int done;
+		if (take_task(worker, &task)) {
+			if (task.part == OPEN_FILE)
+				open_file(worker, task.file);
+			else
+				check_part(pool, task.file, task.part);
+			pthread_mutex_lock(&pool->lock);
+			if (--pool->pending == 0)
+				pthread_cond_broadcast(&pool->wake);
+			pthread_mutex_unlock(&pool->lock);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		while (pool->queued == 0 && pool->pending > 0)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		done = pool->pending == 0;
+		pthread_mutex_unlock(&pool->lock);
+		if (done) break;
+	}
+	return NULL;
+}
+
+int ihr_check_files(size_t count,
+	const char *const *paths,
+	int file_type,
+	int flags,
+	int threads,
+	struct ihr_file_result *results)
+{
+	struct pool pool;
+	size_t i;
+	int status = 0;
+	for (i = 0; i < count; ++i) {
+		struct ihr_file_result *result = &results[i];
+		result->status = 0;
+		result->err.code = 0;
+		result->err.line = 0;
+		result->err.column = 0;
+		result->segments = 0;
+		result->size = 0;
+		ihr_digest_init(&result->digest,
+			flags & (IHRD_CRC32 | IHRD_CRC32C | IHRD_SHA256));
+	}
+	if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pool.paths = paths;
+	pool.file_type = file_type;
+	pool.flags = flags;
+	pool.results = results;
+	pool.nworkers = threads > 0 ? (size_t)threads : 1;
+	pool.queued = 0;
+	pool.pending = 0;
+#ifdef IHR_STATS
+	pool.stats = ihr_stats_current();
+#endif
+	pool.files = calloc(count ? count : 1, sizeof(*pool.files));
+	pool.workers = calloc(pool.nworkers, sizeof(*pool.workers));
+	if (!pool.files || !pool.workers) {
+		free(pool.files);
+		free(pool.workers);
+		for (i = 0; i < count; ++i) {
+			results[i].status = -IHRE_NO_MEMORY;
+			results[i].err.code = IHRE_NO_MEMORY;
+		}
+		return count ? -IHRE_NO_MEMORY : 0;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.wake, NULL);
+	for (i = 0; i < pool.nworkers; ++i) {
+		pool.workers[i].pool = &pool;
+		pool.workers[i].id = i;
+		pthread_mutex_init(&pool.workers[i].lock, NULL);
+	}
+	/* The files are dealt out, and the threads even out the work between
+	 * them as they go: */
+	for (i = 0; i < count; ++i) {
+		if (push_task(&pool.workers[i % pool.nworkers], i, OPEN_FILE))
+			open_file(&pool.workers[0], i);
+	}
+	/* This thread is the first worker, and does the work of any others for
+	 * which a thread could not be started: */
+	for (i = 1; i < pool.nworkers; ++i) {
+		pool.workers[i].threaded = !pthread_create(
+			&pool.workers[i].thread, NULL, work, &pool.workers[i]);
+	}
+	work(&pool.workers[0]);
+	for (i = 1; i < pool.nworkers; ++i) {
+		if (pool.workers[i].threaded)
+			pthread_join(pool.workers[i].thread, NULL);
+	}
+	for (i = 0; i < pool.nworkers; ++i) {
+		pthread_mutex_destroy(&pool.workers[i].lock);
+		free(pool.workers[i].tasks);
+	}
+	pthread_cond_destroy(&pool.wake);
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.workers);
+	free(pool.files);
+	for (i = 0; i < count && status == 0; ++i) {
+		if (results[i].status < 0) status = results[i].status;
+	}
+	return status;
+}
+
+/* ihr_load_files reads this many files at once, each into a buffer of this
+ * size. */
+#define LOAD_SLOTS 16
+#define LOAD_BUF ((size_t)1 << 18)
+
+/* A file being read by ihr_load_files. */
+struct slot {
+	size_t file; /* Index of the file in the paths */
+	int fd; /* -1 if the slot is free */
+	char *buf;
+	size_t have; /* Bytes at the start of buf left from the last read */
+	off_t offset; /* Where in the file the next read starts */
+	size_t line; /* Lines before the start of buf */
+};
+
+/* The state shared by the ways of reading files. */
+struct load {
+	size_t count;
+	const char *const *paths;
+	int file_type;
+	ihr_record_fn *fn;
+	void *const *ctxs;
+	struct ihr_error *errs;
+	int *statuses;
+	size_t next; /* The next file to open */
+	struct slot slots[LOAD_SLOTS];
+};
+
+/* Set the error of a file which could not be read. */
+static void load_failed(struct load *load, size_t file, int code)
+{
+	load->statuses[file] = -code;
+	load->errs[file].code = code;
+	load->errs[file].line = 0;
+	load->errs[file].column = 0;
+}
+
+/* Start reading the file numbered file, opened as fd, in slot. */
+static void load_begin(struct slot *slot, size_t file, int fd)
+{
+	slot->file = file;
+	slot->fd = fd;
+	slot->have = 0;
+	slot->offset = 0;
+	slot->line = 0;
+}
+
+/* Open the next file which can be opened in slot. Returns 0 if there are no
+ * more files, or 1 otherwise. */
+static int load_open(struct load *load, struct slot *slot)
+{
+	while (load->next < load->count) {
+		size_t file = load->next++;
+		int fd = open(load->paths[file], O_RDONLY);
+		if (fd < 0) {
+			load_failed(load, file, IHRE_SYSTEM);
+			continue;
+		}
+		load_begin(slot, file, fd);
+		return 1;
+	}
+	return 0;
+}
+
+/* Read the records of the got bytes just read into the buffer of slot, after
+ * those left from before. A record cut off at the end of the buffer is left for
+ * the next read, unless the end of the file was reached. Returns 0 to read on,
+ * or 1 if the file is done. */
+static int load_parse(struct load *load, struct slot *slot, size_t got)
+{
+	struct ihr_error *err = &load->errs[slot->file];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	size_t len = slot->have + got, cut = len;
+	int at_end = got == 0, reclen, status = 0;
+	if (!at_end) {
+		/* Cut after the last line feed, or after the last carriage
+		 * return if there is none and it is not the last byte: */
+		while (cut > 0 && slot->buf[cut - 1] != '\n') --cut;
+		if (cut == 0) {
+			cut = len - 1;
+			while (cut > 0 && slot->buf[cut - 1] != '\r') --cut;
+		}
+		/* A buffer with no line ending in it is read anyway. Nothing
+		 * that long can be a record, so reading stops at an error: */
+		if (cut == 0 && len == LOAD_BUF) cut = len;
+	}
+	/* The buffer is private, so the data are decoded in place: */
+	ihr_iter_init_in_place(&iter, load->file_type, cut, slot->buf);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		if (reclen < 0) {
+			err->code = -rec.type;
+			err->line = slot->line + iter.line;
+			err->column = ~reclen;
+			status = rec.type;
+			break;
+		}
+		if ((status = load->fn(load->ctxs[slot->file], &rec)) != 0) {
+			if (status < 0) {
+				err->code = -status;
+				err->line = slot->line + iter.line;
+			}
+			break;
+		}
+	}
+	if (status != 0 || at_end) {
+		load->statuses[slot->file] = status;
+		return 1;
+	}
+	/* The iterator counted the line after the last line ending: */
+	if (cut > 0) slot->line += iter.line - 1;
+	memmove(slot->buf, slot->buf + cut, len - cut);
+	slot->have = len - cut;
+	return 0;
+}
+
+/* Finish with the file in slot. */
+static void load_close(struct slot *slot)
+{
+	close(slot->fd);
+	slot->fd = -1;
+}
+
+/* Read the files one after another with pread. */
+static void load_pread(struct load *load)
+{
+	struct slot *slot = &load->slots[0];
+	while (load_open(load, slot)) {
+		for (;;) {
+			ssize_t got = pread(slot->fd, slot->buf + slot->have,
+				LOAD_BUF - slot->have, slot->offset);
+			if (got < 0) {
+				if (errno == EINTR) continue;
+				load_failed(load, slot->file, IHRE_SYSTEM);
+				break;
+			}
+			slot->offset += got;
+			if (load_parse(load, slot, got)) break;
+		}
+		load_close(slot);
+	}
+}
+
+#if HAVE_IO_URING
+/* The entries of the rings, enough for an open or a read and a close for each
+ * slot: */
+#define RING_ENTRIES (2 * LOAD_SLOTS)
+
+/* What an entry of the ring does, kept in the low two bits of its user data: */
+#define RING_OPEN 0
+#define RING_READ 1
+#define RING_CLOSE 2
+
+/* The file descriptor of a slot whose file is being opened on the ring: */
+#define RING_OPENING (-2)
+
+/* The rings shared with the kernel. */
+struct ring {
+	int fd;
+	void *sq_map, *cq_map;
+	size_t sq_map_len, cq_map_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned queued; /* Entries put in the submission queue but not yet
+			    given to the kernel */
+	unsigned pending; /* Entries given to the kernel but not finished */
+	unsigned closing; /* Files being closed on the ring */
+	int fixed; /* Whether the buffers are registered */
+	int open_ops; /* Whether files are opened and closed on the ring */
+	struct iovec iovs[LOAD_SLOTS];
+};
+
+static void ring_free(struct ring *ring)
+{
+	if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_len);
+	if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_len);
+	close(ring->fd);
+}
+
+/* Set up a ring with room for an open or read and a close for every slot, and
+ * register the buffers of the slots with it if the kernel lets us. Returns 0,
+ * or -1 if io_uring is not there to use. */
+static int ring_init(struct ring *ring, struct load *load)
+{
+	struct io_uring_params params;
+	char *sq, *cq;
+	int i;
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+	if (ring->fd < 0) return -1;
+	ring->sq_map_len = params.sq_off.array
+		+ params.sq_entries * sizeof(unsigned);
+	ring->cq_map_len = params.cq_off.cqes
+		+ params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_map_len > ring->sq_map_len)
+			ring->sq_map_len = ring->cq_map_len;
+		ring->cq_map_len = ring->sq_map_len;
+	}
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		ring->sq_map = NULL;
+		goto error;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_len,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			ring->cq_map = NULL;
+			goto error;
+		}
+	}
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto error;
+	}
+	sq = ring->sq_map;
+	cq = ring->cq_map;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	for (i = 0; i < LOAD_SLOTS; ++i) {
+		ring->iovs[i].iov_base = load->slots[i].buf;
+		ring->iovs[i].iov_len = LOAD_BUF;
+	}
+	/* Registered buffers are pinned once rather than for every read. This
+	 * fails if too much memory would be locked, but reads work without: */
+	ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+		IORING_REGISTER_BUFFERS, ring->iovs, LOAD_SLOTS) == 0;
+	/* Kernels too old to open files on the ring fail the first open with
+	 * EINVAL, and ring_opened goes back to opening them itself: */
+	ring->open_ops = HAVE_RING_OPEN;
+	return 0;
+
+error:
+	ring_free(ring);
+	return -1;
+}
+
+/* Get the next free entry of the submission queue, cleared, with user data
+ * saying what it does: op, and arg, the number of a slot or a file descriptor
+ * to close. It is not seen by the kernel until ring_push. */
+static struct io_uring_sqe *ring_entry(struct ring *ring, int op, int arg)
+{
+	unsigned idx = *ring->sq_tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (unsigned long)arg << 2 | op;
+	ring->sq_array[idx] = idx;
+	return sqe;
+}
+
+/* Put the entry from ring_entry in the submission queue. */
+static void ring_push(struct ring *ring)
+{
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+	++ring->queued;
+}
+
+/* Queue a read into the buffer of the slot numbered i, after what is left in
+ * it. */
+static void ring_read(struct ring *ring, struct slot *slot, int i)
+{
+	struct io_uring_sqe *sqe = ring_entry(ring, RING_READ, i);
+	sqe->fd = slot->fd;
+	sqe->off = slot->offset;
+	if (ring->fixed) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->addr = (unsigned long)(slot->buf + slot->have);
+		sqe->len = LOAD_BUF - slot->have;
+		sqe->buf_index = i;
+	} else {
+		/* The iovec is only read when the read is submitted: */
+		ring->iovs[i].iov_base = slot->buf + slot->have;
+		ring->iovs[i].iov_len = LOAD_BUF - slot->have;
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = (unsigned long)&ring->iovs[i];
+		sqe->len = 1;
+	}
+	ring_push(ring);
+}
+
+/* Start on the next file in the slot numbered i, if there is one, opening it on
+ * the ring if the kernel can. Returns 1 if the slot was given a file, or 0 if
+ * there are no more. */
+static int ring_start(struct ring *ring, struct load *load, int i)
+{
+	struct slot *slot = &load->slots[i];
+#if HAVE_RING_OPEN
+	if (ring->open_ops) {
+		struct io_uring_sqe *sqe;
+		if (load->next >= load->count) return 0;
+		slot->file = load->next++;
+		slot->fd = RING_OPENING;
+		sqe = ring_entry(ring, RING_OPEN, i);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)load->paths[slot->file];
+		sqe->open_flags = O_RDONLY;
+		ring_push(ring);
+		return 1;
+	}
+#endif
+	if (!load_open(load, slot)) return 0;
+	ring_read(ring, slot, i);
+	return 1;
+}
+
+/* Go on with the slot numbered i, whose file was opened on the ring as res, or
+ * with the negated error code res. */
+static void ring_opened(struct ring *ring, struct load *load, int i, int res)
+{
+	struct slot *slot = &load->slots[i];
+	if (res == -EINVAL) {
+		/* The kernel cannot open files on the ring, so from now on
+		 * they are opened and closed directly: */
+		ring->open_ops = 0;
+		res = open(load->paths[slot->file], O_RDONLY);
+	}
+	if (res < 0) {
+		load_failed(load, slot->file, IHRE_SYSTEM);
+		slot->fd = -1;
+		return;
+	}
+	load_begin(slot, slot->file, res);
+	ring_read(ring, slot, i);
+}
+
+/* Finish with the file in slot, closing it on the ring if the kernel can. */
+static void ring_close(struct ring *ring, struct slot *slot)
+{
+#if HAVE_RING_OPEN
+	if (ring->open_ops) {
+		struct io_uring_sqe *sqe = ring_entry(ring, RING_CLOSE,
+			slot->fd);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = slot->fd;
+		ring_push(ring);
+		++ring->closing;
+		slot->fd = -1;
+		return;
+	}
+#endif
+	load_close(slot);
+}
+
+/* Take note that a file was closed on the ring, with the result res. */
+static void ring_closed(struct ring *ring, int fd, int res)
+{
+	--ring->closing;
+	if (res == -EINVAL) {
+		ring->open_ops = 0;
+		close(fd);
+	}
+}
+
+/* Go on with the slot numbered i, into whose buffer res bytes were read, or
+ * which failed with the negated error code res. Returns 1 if the slot is done
+ * with its file. */
+static int ring_got(struct ring *ring, struct load *load, int i, int res)
+{
+	struct slot *slot = &load->slots[i];
+	if (res >= 0) {
+		slot->offset += res;
+		if (!load_parse(load, slot, res)) {
+			ring_read(ring, slot, i);
+			return 0;
+		}
+	} else if (res == -EINTR || res == -EAGAIN) {
+		ring_read(ring, slot, i);
+		return 0;
+	} else {
+		load_failed(load, slot->file, IHRE_SYSTEM);
+	}
+	ring_close(ring, slot);
+	return 1;
+}
+
+/* Read the files with up to LOAD_SLOTS reads in flight, reading the records of
+ * each buffer as soon as it is filled. Files are opened and closed on the ring
+ * too where the kernel can. Each system call submits what was queued and,
+ * while several entries are in flight, waits for half of them to finish, so the
+ * records of that many buffers are read between calls. Returns -1 if io_uring
+ * could not be set up, or 0 otherwise. */
+static int load_ring(struct load *load)
+{
+	struct ring ring;
+	int i, active = 0;
+	if (ring_init(&ring, load)) return -1;
+	for (i = 0; i < LOAD_SLOTS; ++i) active += ring_start(&ring, load, i);
+	while (active > 0 || ring.closing > 0) {
+		unsigned head, tail, wait = (ring.pending + ring.queued) / 2;
+		int got = syscall(__NR_io_uring_enter, ring.fd, ring.queued,
+			wait > 1 ? wait : 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		ring.queued -= got;
+		ring.pending += got;
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			struct io_uring_cqe *cqe =
+				&ring.cqes[head & *ring.cq_mask];
+			int res = cqe->res, arg = cqe->user_data >> 2;
+			--ring.pending;
+			switch (cqe->user_data & 3) {
+			case RING_OPEN:
+				ring_opened(&ring, load, arg, res);
+				break;
+			case RING_READ:
+				if (!ring_got(&ring, load, arg, res)) continue;
+				break;
+			case RING_CLOSE:
+				ring_closed(&ring, arg, res);
+				continue;
+			}
+			/* The slot is free unless its file was opened: */
+			if (load->slots[arg].fd == -1
+			 && !ring_start(&ring, load, arg))
+				--active;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	/* If waiting on the ring failed, so do the files not yet read: */
+	for (i = 0; i < LOAD_SLOTS && active > 0; ++i) {
+		struct slot *slot = &load->slots[i];
+		if (slot->fd == -1) continue;
+		load_failed(load, slot->file, IHRE_SYSTEM);
+		if (slot->fd >= 0) load_close(slot);
+	}
+	for (; load->next < load->count; ++load->next)
+		load_failed(load, load->next, IHRE_SYSTEM);
+	ring_free(&ring);
+	return 0;
+}
+#endif /* HAVE_IO_URING */
+
+int ihr_load_files(size_t count,
+	const char *const *paths,
+	int file_type,
+	ihr_record_fn *fn,
+	void *const *ctxs,
+	struct ihr_error *errs)
+{
+	struct load load;
+	char *bufs;
+	size_t i;
+	int status = 0;
+	load.count = count;
+	load.paths = paths;
+	load.file_type = file_type;
+	load.fn = fn;
+	load.ctxs = ctxs;
+	load.errs = errs;
+	load.next = 0;
+	for (i = 0; i < count; ++i) {
+		errs[i].code = 0;
+		errs[i].line = 0;
+		errs[i].column = 0;
+	}
+	bufs = malloc(LOAD_SLOTS * LOAD_BUF);
+	load.statuses = calloc(count ? count : 1, sizeof(*load.statuses));
+	if (!bufs || !load.statuses) {
+		free(bufs);
+		free(load.statuses);
+		for (i = 0; i < count; ++i) errs[i].code = IHRE_NO_MEMORY;
+		return count ? -IHRE_NO_MEMORY : 0;
+	}
+	for (i = 0; i < LOAD_SLOTS; ++i) {
+		load.slots[i].buf = bufs + i * LOAD_BUF;
+		load.slots[i].fd = -1;
+	}
+#if HAVE_IO_URING
+	if (load_ring(&load))
+#endif
+		load_pread(&load);
+	for (i = 0; i < count && status == 0; ++i) {
+		if (load.statuses[i] < 0) status = load.statuses[i];
+	}
+	free(load.statuses);
+	free(bufs);
+	return status;
+}
+
+/* Saved indices start with this, followed by the file type, the number of
+ * runs, and the size and modification time of the text they were built from,
+ * then the runs. Numbers are stored little-endian. */
+#define INDEX_MAGIC "IHRINDX1"
+#define INDEX_HEAD 36
+#define INDEX_RUN 36
+
+static unsigned char *put_u32(unsigned char *buf, IHR_U32 num)
+{
+	buf[0] = num & 0xFF;
+	buf[1] = num >> 8 & 0xFF;
+	buf[2] = num >> 16 & 0xFF;
+	buf[3] = num >> 24 & 0xFF;
+	return buf + 4;
+}
+
+/* Sizes are stored in eight bytes whatever the size of size_t. */
+static unsigned char *put_u64(unsigned char *buf, unsigned long num)
+{
+	buf = put_u32(buf, num & 0xFFFFFFFF);
+	return put_u32(buf, num >> 16 >> 16);
+}
+
+static IHR_U32 get_u32(const unsigned char *buf)
+{
+	return (IHR_U32)buf[0] | (IHR_U32)buf[1] << 8 | (IHR_U32)buf[2] << 16
+		| (IHR_U32)buf[3] << 24;
+}
+
+/* Returns 0 if the number does not fit in an unsigned long. */
+static int get_u64(const unsigned char *buf, unsigned long *num)
+{
+	IHR_U32 high = get_u32(buf + 4);
+	*num = (unsigned long)high << 16 << 16;
+	if ((*num >> 16 >> 16) != high) return 0;
+	*num |= get_u32(buf);
+	return 1;
+}
+
+/* Write the header describing the text at text_path into buf. */
+static int put_index_head(unsigned char *buf,
+	const struct ihr_index *index,
+	size_t count,
+	const char *text_path)
+{
+	struct stat st;
+	if (stat(text_path, &st)) return -IHRE_SYSTEM;
+	memcpy(buf, INDEX_MAGIC, 8);
+	buf = put_u32(buf + 8, index->file_type);
+	buf = put_u64(buf, count);
+	buf = put_u64(buf, st.st_size);
+	put_u64(buf, st.st_mtime);
+	return 0;
+}
+
+/* Find the path of the index of the file at text_path. The result must be
+ * freed. */
+static char *index_path(const char *path, const char *text_path)
+{
+	char *def;
+	if (path) {
+		def = malloc(strlen(path) + 1);
+		if (def) strcpy(def, path);
+	} else {
+		def = malloc(strlen(text_path) + sizeof(".idx"));
+		if (def) strcat(strcpy(def, text_path), ".idx");
+	}
+	return def;
+}
+
+/* Write all of buf to fd. Returns -IHRE_SYSTEM on failure with errno set. */
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *pos = buf;
+	while (size > 0) {
+		ssize_t written = write(fd, pos, size);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return -IHRE_SYSTEM;
+		}
+		pos += written;
+		size -= written;
+	}
+	return 0;
+}
+
+/* Open a new temporary file to be renamed to dest by finish_temp, so that
+ * readers never see dest half written. *tmp is set to its path. Returns the
+ * file descriptor or -IHRE_SYSTEM or -IHRE_NO_MEMORY. */
+static int open_temp(const char *dest, char **tmp)
+{
+	int fd;
+	if (!(*tmp = malloc(strlen(dest) + 32))) return -IHRE_NO_MEMORY;
+	sprintf(*tmp, "%s.%ld.tmp", dest, (long)getpid());
+	fd = open(*tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		int errnum = errno;
+		free(*tmp);
+		errno = errnum;
+		return -IHRE_SYSTEM;
+	}
+	return fd;
+}
+
+/* Close a file from open_temp, renaming it to dest if status is 0 or removing
+ * it otherwise. Returns the final status. */
+static int finish_temp(int fd, char *tmp, const char *dest, int status)
+{
+	int errnum;
+	if (status == 0 && fsync(fd)) status = -IHRE_SYSTEM;
+	if (close(fd) && status == 0) status = -IHRE_SYSTEM;
+	if (status == 0 && rename(tmp, dest)) status = -IHRE_SYSTEM;
+	errnum = errno;
+	if (status) unlink(tmp);
+	free(tmp);
+	errno = errnum;
+	return status;
+}
+
+int ihr_index_save(const struct ihr_index *index,
+	const char *path,
+	const char *text_path)
+{
+	size_t size = INDEX_HEAD + index->count * INDEX_RUN, i;
+	unsigned char *buf, *pos;
+	char *dest, *tmp;
+	int fd, status = -IHRE_NO_MEMORY;
+	if ((size - INDEX_HEAD) / INDEX_RUN != index->count
+	 || !(buf = malloc(size)))
+		return -IHRE_NO_MEMORY;
+	if (!(dest = index_path(path, text_path))) goto end;
+	if ((status = put_index_head(buf, index, index->count, text_path)))
+		goto end;
+	for (pos = buf + INDEX_HEAD, i = 0; i < index->count; ++i) {
+		const struct ihr_run *run = &index->runs[i];
+		pos = put_u32(pos, run->addr);
+		pos = put_u32(pos, run->reach);
+		pos = put_u32(pos, run->base);
+		pos = put_u64(pos, run->size);
+		pos = put_u64(pos, run->offset);
+		pos = put_u64(pos, run->end);
+	}
+	if ((status = fd = open_temp(dest, &tmp)) >= 0)
+		status = finish_temp(fd, tmp, dest, write_all(fd, buf, size));
+
+end:
+	{
+		int errnum = errno;
+		free(dest);
+		free(buf);
+		errno = errnum;
+	}
+	return status;
+}
+
+int ihr_index_load(struct ihr_index *index,
+	const char *path,
+	const char *text_path)
+{
+	unsigned char head[INDEX_HEAD];
+	const unsigned char *pos;
+	char *dest, *text;
+	size_t len, count, i;
+	unsigned long num;
+	struct ihr_run *runs;
+	int status;
+	if (!(dest = index_path(path, text_path))) return -IHRE_NO_MEMORY;
+	status = map_file(dest, &len, &text);
+	free(dest);
+	if (status) return errno == ENOENT ? 1 : status;
+	pos = (const unsigned char *)text;
+	/* The index must be for a text of the same type, size, and time: */
+	status = 1;
+	if (len < INDEX_HEAD || memcmp(pos, INDEX_MAGIC, 8)
+	 || (int)get_u32(pos + 8) != index->file_type
+	 || !get_u64(pos + 12, &num) || (count = num) != num
+	 || (len - INDEX_HEAD) / INDEX_RUN != count
+	 || (len - INDEX_HEAD) % INDEX_RUN != 0)
+		goto end;
+	if ((status = put_index_head(head, index, count, text_path)))
+		goto end;
+	status = 1;
+	if (memcmp(head, pos, INDEX_HEAD)) goto end;
+	if (count > index->cap) {
+		runs = realloc(index->runs, count * sizeof(*runs));
+		if (!runs) {
+			status = -IHRE_NO_MEMORY;
+			goto end;
+		}
+		index->runs = runs;
+		index->cap = count;
+	}
+	get_u64(pos + 20, &num);
+	for (pos += INDEX_HEAD, i = 0; i < count; ++i, pos += INDEX_RUN) {
+		struct ihr_run *run = &index->runs[i];
+		unsigned long size, offset, end;
+		run->addr = get_u32(pos);
+		run->reach = get_u32(pos + 4);
+		run->base = get_u32(pos + 8);
+		if (!get_u64(pos + 12, &size) || !get_u64(pos + 20, &offset)
+		 || !get_u64(pos + 28, &end) || size == 0 || offset > end
+		 || end > num)
+			goto end;
+		run->size = size;
+		run->offset = offset;
+		run->end = end;
+	}
+	index->count = count;
+	status = 0;
+
+end:
+	if (len > 0) munmap(text, len);
+	return status;
+}
+
+/* Cache files start with this, followed by the file type, the start record
+ * type (all ones for none), the start address, the base address, the number of
+ * segments, and the length and hash of the text they were read from. Then come
+ * the address, size, and file offset of each segment, and then the data of
+ * each segment, starting on a page boundary. Numbers are little-endian. */
+#define CACHE_MAGIC "IHRCACH1"
+#define CACHE_HEAD 56
+#define CACHE_SEG 24
+#define CACHE_PAGE ((size_t)1 << 12)
+
+/* Constants from xxHash: */
+#define HASH_PRIME1 0x9E3779B1
+#define HASH_PRIME2 0x85EBCA77
+#define HASH_PRIME3 0xC2B2AE3D
+
+static IHR_U32 hash_round(IHR_U32 hash, IHR_U32 word)
+{
+	hash = (hash + word * HASH_PRIME2) & 0xFFFFFFFF;
+	hash = (hash << 13 | hash >> 19) & 0xFFFFFFFF;
+	return hash * HASH_PRIME1 & 0xFFFFFFFF;
+}
+
+/* Hash text into 16 bytes at buf, so that a changed text can be told apart.
+ * Words are taken four at a time, one into each part of the hash, so that the
+ * parts can be worked out in parallel. */
+static void hash_text(size_t len, const char *text, unsigned char *buf)
+{
+	const unsigned char *pos = (const unsigned char *)text;
+	unsigned char tail[16];
+	IHR_U32 hash[4];
+	size_t left;
+	int i;
+	hash[0] = HASH_PRIME1;
+	hash[1] = HASH_PRIME2;
+	hash[2] = HASH_PRIME3;
+	hash[3] = 0;
+	for (left = len; left >= 16; left -= 16, pos += 16) {
+		hash[0] = hash_round(hash[0], get_u32(pos));
+		hash[1] = hash_round(hash[1], get_u32(pos + 4));
+		hash[2] = hash_round(hash[2], get_u32(pos + 8));
+		hash[3] = hash_round(hash[3], get_u32(pos + 12));
+	}
+	memset(tail, 0, sizeof(tail));
+	if (left > 0) memcpy(tail, pos, left);
+	for (i = 0; i < 4; ++i) {
+		IHR_U32 h = hash_round(hash[i], get_u32(tail + i * 4));
+		h ^= len & 0xFFFFFFFF;
+		h ^= h >> 15;
+		h = h * HASH_PRIME2 & 0xFFFFFFFF;
+		h ^= h >> 13;
+		h = h * HASH_PRIME3 & 0xFFFFFFFF;
+		h ^= h >> 16;
+		put_u32(buf + i * 4, h);
+	}
+}
+
+static size_t page_up(size_t size)
+{
+	return (size + CACHE_PAGE - 1) / CACHE_PAGE * CACHE_PAGE;
+}
+
+/* Write the header of a cache of img, read from text, into buf. */
+static void put_cache_head(unsigned char *buf,
+	const struct ihr_image *img,
+	size_t len,
+	const char *text)
+{
+	memcpy(buf, CACHE_MAGIC, 8);
+	buf = put_u32(buf + 8, img->file_type);
+	buf = put_u32(buf, img->start_type < 0 ? 0xFFFFFFFF
+		: (IHR_U32)img->start_type);
+	buf = put_u32(buf, img->start);
+	buf = put_u32(buf, img->base);
+	buf = put_u64(buf, img->count);
+	buf = put_u64(buf, len);
+	hash_text(len, text, buf);
+}
+
+int ihr_cache_save(const struct ihr_image *img,
+	const char *path,
+	size_t len,
+	const char *text)
+{
+	static const unsigned char zeros[CACHE_PAGE];
+	size_t size = CACHE_HEAD + img->count * CACHE_SEG, offset, i;
+	unsigned char *buf, *pos;
+	char *tmp;
+	int fd, status;
+	if ((size - CACHE_HEAD) / CACHE_SEG != img->count
+	 || !(buf = malloc(size)))
+		return -IHRE_NO_MEMORY;
+	put_cache_head(buf, img, len, text);
+	offset = page_up(size);
+	for (pos = buf + CACHE_HEAD, i = 0; i < img->count; ++i) {
+		pos = put_u32(pos, img->segs[i].addr);
+		pos = put_u32(pos, 0);
+		pos = put_u64(pos, img->segs[i].size);
+		pos = put_u64(pos, offset);
+		offset += page_up(img->segs[i].size);
+	}
+	if ((status = fd = open_temp(path, &tmp)) < 0) goto end;
+	status = write_all(fd, buf, size);
+	for (i = 0; i < img->count && status == 0; ++i) {
+		const struct ihr_segment *seg = &img->segs[i];
+		/* Pad what was written last up to a page boundary: */
+		status = write_all(fd, zeros, page_up(size) - size);
+		if (status == 0) status = write_all(fd, seg->data, seg->size);
+		size = seg->size;
+	}
+	status = finish_temp(fd, tmp, path, status);
+
+end:
+	{
+		int errnum = errno;
+		free(buf);
+		errno = errnum;
+	}
+	return status;
+}
+
+int ihr_cache_load(struct ihr_cache *cache,
+	int file_type,
+	const char *path,
+	size_t len,
+	const char *text)
+{
+	struct ihr_image *img = &cache->img;
+	unsigned char head[CACHE_HEAD];
+	const unsigned char *pos;
+	char *map;
+	size_t map_len, count, i;
+	unsigned long num;
+	IHR_U32 start_type;
+	int status;
+	ihr_image_init(img, file_type);
+	cache->map = NULL;
+	cache->map_len = 0;
+	status = map_file(path, &map_len, &map);
+	if (status) return errno == ENOENT ? 1 : status;
+	pos = (const unsigned char *)map;
+	/* The cache must be of the same text: */
+	status = 1;
+	if (map_len < CACHE_HEAD || memcmp(pos, CACHE_MAGIC, 8)
+	 || get_u32(pos + 8) != (IHR_U32)file_type
+	 || !get_u64(pos + 24, &num) || (count = num) != num
+	 || (map_len - CACHE_HEAD) / CACHE_SEG < count)
+		goto end;
+	start_type = get_u32(pos + 12);
+	img->start_type = start_type == 0xFFFFFFFF ? -1 : (int)start_type;
+	img->start = get_u32(pos + 16);
+	img->base = get_u32(pos + 20);
+	img->count = count;
+	put_cache_head(head, img, len, text);
+	img->count = 0;
+	if (memcmp(head, pos, CACHE_HEAD)) goto end;
+	if (count > 0 && !(img->segs = malloc(count * sizeof(*img->segs)))) {
+		status = -IHRE_NO_MEMORY;
+		goto end;
+	}
+	/* The segments are checked so that a damaged cache cannot be read out
+	 * of bounds: */
+	for (pos += CACHE_HEAD, i = 0; i < count; ++i, pos += CACHE_SEG) {
+		struct ihr_segment *seg = &img->segs[i];
+		const struct ihr_segment *last = i > 0 ? seg - 1 : NULL;
+		unsigned long size, offset;
+		if (!get_u64(pos + 8, &size) || !get_u64(pos + 16, &offset)
+		 || size == 0 || offset % CACHE_PAGE != 0 || offset > map_len
+		 || size > map_len - offset || size - 1 > 0xFFFFFFFF)
+			goto end;
+		seg->addr = get_u32(pos);
+		seg->size = size;
+		seg->cap = 0;
+		seg->front = 0;
+		seg->data = (IHR_U8 *)map + offset;
+		if (seg->size - 1 > (IHR_U32)(0xFFFFFFFF - seg->addr)
+		 || (last && (last->addr >= seg->addr
+				|| seg->addr - last->addr <= last->size)))
+			goto end;
+	}
+	img->count = count;
+	cache->map = map;
+	cache->map_len = map_len;
+	return 0;
+
+end:
+	free(img->segs);
+	ihr_image_init(img, file_type);
+	if (map_len > 0) munmap(map, map_len);
+	return status;
+}
+
+void ihr_cache_free(struct ihr_cache *cache)
+{
+	free(cache->img.segs);
+	ihr_image_init(&cache->img, cache->img.file_type);
+	if (cache->map_len > 0) munmap(cache->map, cache->map_len);
+	cache->map = NULL;
+	cache->map_len = 0;
+}
@@ -0,0 +1,541 @@
+/* ihrconv: convert between Intel HEX, SREC, and flat binary files.
+ *
+ * The input is read in blocks by a separate thread while the main thread reads
+ * records and writes the output, so memory use does not grow with the size of
+ * the files. Binary output is written in address order as the data arrive;
+ * data going back to a lower address need the output to be a regular file. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "ihr.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TYPE_BIN -1 /* Flat binary, as opposed to an IHRT_* type */
+#define TYPE_NONE -2 /* Not given */
+
+#define BLOCK_SIZE ((size_t)1 << 18) /* Bytes read at once */
+#define NBLOCKS 4 /* Blocks which can be read ahead */
+#define OUT_SIZE ((size_t)1 << 16) /* Characters of text written at once */
+
+static const char *progname = "ihrconv";
+
+static void print_usage(void)
+{
+	fprintf(stderr, "Usage: %s [-i TYPE] -o TYPE [-b ADDR] [-f BYTE] "
+		"[-r SIZE] [-c] [IN [OUT]]\n", progname);
+	fputs("Convert between the types i8, i16, i32, s19, s28, s37, and bin.\n"
+		"  -i TYPE  Type of the input, guessed from the text if not "
+		"given\n"
+		"  -o TYPE  Type of the output\n"
+		"  -b ADDR  Address of the first byte of binary input or output\n",
+		stderr);
+	fputs("  -f BYTE  Value to fill gaps in binary output with "
+		"(default 0xFF)\n"
+		"  -r SIZE  Most data bytes in an output record\n"
+		"  -c       End output lines with CR LF\n"
+		"IN and OUT default to standard input and output, as does '-'.\n",
+		stderr);
+}
+
+/* Blocks read from the input by their own thread. */
+static struct reader {
+	int fd;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char blocks[NBLOCKS][BLOCK_SIZE];
+	long lens[NBLOCKS]; /* Bytes in each block, 0 at the end, -1 on error */
+	unsigned long filled; /* Blocks read so far */
+	unsigned long taken; /* Blocks used so far */
+	int errnum;
+} reader;
+
+/* The state of a conversion. */
+static struct conv {
+	int in_type;
+	int out_type;
+	IHR_U32 base; /* Set by the last extended address record read */
+	int start_type; /* START_* */
+	IHR_U32 start; /* Linear start address */
+	IHR_U16 code_seg, instr_ptr; /* Start given as CS:IP */
+	/* For text output: */
+	struct ihr_writer writer;
+	char text[OUT_SIZE];
+	/* For binary output: */
+	int have_origin;
+	IHR_U32 origin; /* Address of the first byte */
+	unsigned long pos; /* Offset where the file is positioned */
+	unsigned long end; /* Size of the file so far */
+	int fill;
+	FILE *out;
+	const char *error; /* Why the callback failed */
+} conv;
+
+#define START_NONE 0
+#define START_LINEAR 1
+#define START_SEGMENT 2
+
+static int parse_type(const char *name)
+{
+	static const char *const names[] = {
+		"i8", "i16", "i32", "s19", "s28", "s37"
+	};
+	int i;
+	if (!strcmp(name, "bin")) return TYPE_BIN;
+	for (i = 0; i < 6; ++i) {
+		if (!strcmp(name, names[i])) return IHRT_I8 + i;
+	}
+	fprintf(stderr, "%s: unknown type '%s'\n", progname, name);
+	exit(2);
+}
+
+static unsigned long parse_number(const char *arg, unsigned long max)
+{
+	char *end;
+	unsigned long num;
+	errno = 0;
+	num = strtoul(arg, &end, 0);
+	if (errno || *end || end == arg || num > max) {
+		fprintf(stderr, "%s: bad number '%s'\n", progname, arg);
+		exit(2);
+	}
+	return num;
+}
+
+static const char *error_message(int code)
+{
+	switch (code) {
+	case IHRE_EXPECTED_EOL:
+		return "expected line ending";
+	case IHRE_INVALID_CHECKSUM:
+		return "stored checksum does not match computed checksum";
+	case IHRE_INVALID_SIZE:
+		return "invalid byte count for record";
+	case IHRE_INVALID_TYPE:
+		return "invalid record type";
+	case IHRE_MISSING_START:
+		return "expected the start of a record";
+	case IHRE_NOT_HEX:
+		return "character pair is not a hexadecimal digit pair";
+	case IHRE_SUB_MIN_LENGTH:
+		return "record too short";
+	case IHRE_SYSTEM:
+		return strerror(errno);
+	case IHRE_NO_MEMORY:
+		return "out of memory";
+	case IHRE_INVALID_ADDR:
+		return "address out of range for the output type";
+	case IHRE_OVERLAP:
+		return "data overlap differing data";
+	default:
+		return "unknown error";
+	}
+}
+
+static void *read_blocks(void *arg)
+{
+	long len;
+	(void)arg;
+	do {
+		char *block;
+		pthread_mutex_lock(&reader.lock);
+		while (reader.filled - reader.taken == NBLOCKS)
+			pthread_cond_wait(&reader.cond, &reader.lock);
+		block = reader.blocks[reader.filled % NBLOCKS];
+		pthread_mutex_unlock(&reader.lock);
+		do {
+			len = read(reader.fd, block, BLOCK_SIZE);
+		} while (len < 0 && errno == EINTR);
+		pthread_mutex_lock(&reader.lock);
+		if (len < 0) reader.errnum = errno;
+		reader.lens[reader.filled % NBLOCKS] = len;
+		++reader.filled;
+		pthread_cond_signal(&reader.cond);
+		pthread_mutex_unlock(&reader.lock);
+	} while (len > 0);
+	return NULL;
+}
+
+/* Wait for the next block of input. Returns its length, which is 0 at the end
+ * or -1 on error. */
+static long next_block(const char **block)
+{
+	long len;
+	pthread_mutex_lock(&reader.lock);
+	while (reader.filled == reader.taken)
+		pthread_cond_wait(&reader.cond, &reader.lock);
+	*block = reader.blocks[reader.taken % NBLOCKS];
+	len = reader.lens[reader.taken % NBLOCKS];
+	if (len < 0) errno = reader.errnum;
+	pthread_mutex_unlock(&reader.lock);
+	return len;
+}
+
+/* Give the last block back to the reader. */
+static void release_block(void)
+{
+	pthread_mutex_lock(&reader.lock);
+	++reader.taken;
+	pthread_cond_signal(&reader.cond);
+	pthread_mutex_unlock(&reader.lock);
+}
+
+static int write_out(const void *data, size_t size)
+{
+	if (fwrite(data, 1, size, conv.out) != size) {
+		conv.error = strerror(errno);
+		return -IHRE_SYSTEM;
+	}
+	return 0;
+}
+
+/* Write size bytes of data at addr to binary output. */
+static int put_binary(IHR_U32 addr, size_t size, const IHR_U8 *data)
+{
+	unsigned long offset;
+	if (!conv.have_origin) {
+		conv.origin = addr;
+		conv.have_origin = 1;
+	}
+	if (addr < conv.origin) {
+		conv.error = "data below the first address of the output";
+		return -IHRE_INVALID_ADDR;
+	}
+	offset = addr - conv.origin;
+	if (offset > conv.end) {
+		/* Fill the gap since the end of the file: */
+		static IHR_U8 fill[BLOCK_SIZE];
+		if (fill[0] != conv.fill) memset(fill, conv.fill, sizeof(fill));
+		if (conv.pos != conv.end
+		 && fseek(conv.out, conv.end, SEEK_SET)) goto seek_error;
+		while (conv.end < offset) {
+			size_t gap = offset - conv.end < sizeof(fill) ?
+				offset - conv.end : sizeof(fill);
+			if (write_out(fill, gap)) return -IHRE_SYSTEM;
+			conv.end += gap;
+		}
+		conv.pos = offset;
+	} else if (offset != conv.pos) {
+		if (fseek(conv.out, offset, SEEK_SET)) goto seek_error;
+		conv.pos = offset;
+	}
+	if (write_out(data, size)) return -IHRE_SYSTEM;
+	conv.pos += size;
+	if (conv.pos > conv.end) conv.end = conv.pos;
+	return 0;
+
+seek_error:
+	conv.error = "data out of order need the output to be a regular file";
+	return -IHRE_SYSTEM;
+}
+
+/* Write size bytes of data at addr to text output. */
+static int put_text(IHR_U32 addr, size_t size, const IHR_U8 *data)
+{
+	while (size > 0) {
+		int status = ihr_write_data(&conv.writer, addr, size, data,
+			OUT_SIZE, conv.text);
+		if (write_out(conv.text, conv.writer.len)) return -IHRE_SYSTEM;
+		if (status < 0) {
+			conv.error = error_message(-status);
+			return status;
+		}
+		addr += conv.writer.used;
+		data += conv.writer.used;
+		size -= conv.writer.used;
+	}
+	return 0;
+}
+
+static int put(IHR_U32 addr, size_t size, const IHR_U8 *data)
+{
+	if (conv.out_type == TYPE_BIN) return put_binary(addr, size, data);
+	return put_text(addr, size, data);
+}
+
+/* Write a single record to text output. */
+static int put_record(const struct ihr_record *rec)
+{
+	int len = ihr_write(conv.out_type, conv.writer.flags, rec, conv.text);
+	if (len < 0) {
+		conv.error = error_message(-len);
+		return len;
+	}
+	return write_out(conv.text, len);
+}
+
+/* Handle a record read from Intel HEX input. */
+static int take_ihex(const struct ihr_record *rec)
+{
+	switch (rec->type) {
+	case IHRR_I_DATA:
+		if (conv.in_type != IHRT_I32
+		 && (size_t)rec->addr + rec->size > 0x10000) {
+			/* The data wrap around within the segment: */
+			size_t first = 0x10000 - rec->addr;
+			int status = put(conv.base + rec->addr, first,
+				rec->data.data);
+			if (status) return status;
+			return put(conv.base, rec->size - first,
+				rec->data.data + first);
+		}
+		return put(conv.base + rec->addr, rec->size, rec->data.data);
+	case IHRR_I_END_OF_FILE:
+		return 1;
+	case IHRR_I_EXT_SEG_ADDR:
+		conv.base = (IHR_U32)rec->data.ihex.base_addr << 4;
+		break;
+	case IHRR_I_EXT_LIN_ADDR:
+		conv.base = (IHR_U32)rec->data.ihex.base_addr << 16;
+		break;
+	case IHRR_I_START_SEG_ADDR:
+		conv.start_type = START_SEGMENT;
+		conv.code_seg = rec->data.ihex.start.code_seg;
+		conv.instr_ptr = rec->data.ihex.start.instr_ptr;
+		conv.start = ((IHR_U32)conv.code_seg << 4) + conv.instr_ptr;
+		break;
+	case IHRR_I_START_LIN_ADDR:
+		conv.start_type = START_LINEAR;
+		conv.start = rec->data.ihex.ext_instr_ptr;
+		break;
+	}
+	return 0;
+}
+
+/* Handle a record read from SREC input. */
+static int take_srec(const struct ihr_record *rec)
+{
+	switch (rec->type) {
+	case IHRR_S0_HEADER:
+		if (conv.out_type >= IHRT_S19) return put_record(rec);
+		break;
+	case IHRR_S1_DATA_16:
+	case IHRR_S2_DATA_24:
+	case IHRR_S3_DATA_32:
+		return put(rec->addr, rec->size, rec->data.data);
+	case IHRR_S7_START_32:
+	case IHRR_S8_START_24:
+	case IHRR_S9_START_16:
+		conv.start_type = START_LINEAR;
+		conv.start = rec->addr;
+		return 1;
+	}
+	return 0;
+}
+
+static int take_record(void *ctx, const struct ihr_record *rec)
+{
+	(void)ctx;
+	return conv.in_type <= IHRT_I32 ? take_ihex(rec) : take_srec(rec);
+}
+
+/* Write the start address, if the output can hold it, and the end record. */
+static int finish(void)
+{
+	struct ihr_record rec;
+	int status;
+	rec.addr = 0;
+	rec.size = 0;
+	switch (conv.out_type) {
+	case TYPE_BIN:
+		return 0;
+	case IHRT_I16:
+		if (conv.start_type == START_LINEAR && conv.start <= 0xFFFFF) {
+			conv.code_seg = (conv.start >> 4) & 0xF000;
+			conv.instr_ptr = conv.start & 0xFFFF;
+		} else if (conv.start_type != START_SEGMENT) {
+			break;
+		}
+		rec.type = IHRR_I_START_SEG_ADDR;
+		rec.data.ihex.start.code_seg = conv.code_seg;
+		rec.data.ihex.start.instr_ptr = conv.instr_ptr;
+		if ((status = put_record(&rec))) return status;
+		break;
+	case IHRT_I32:
+		if (conv.start_type == START_NONE) break;
+		rec.type = IHRR_I_START_LIN_ADDR;
+		rec.data.ihex.ext_instr_ptr = conv.start;
+		if ((status = put_record(&rec))) return status;
+		break;
+	case IHRT_S19:
+	case IHRT_S28:
+	case IHRT_S37:
+		/* The start address goes in the end record: */
+		rec.type = IHRR_S9_START_16 + IHRT_S19 - conv.out_type;
+		rec.addr = conv.start;
+		if (conv.start_type != START_NONE
+		 && conv.start > (0xFFFFFFFF >> (IHRT_S37 - conv.out_type) * 8)) {
+			conv.error = "start address out of range for the output "
+				"type";
+			return -IHRE_INVALID_ADDR;
+		}
+		return put_record(&rec);
+	}
+	rec.type = IHRR_I_END_OF_FILE;
+	return put_record(&rec);
+}
+
+/* Convert text input, stopping at the end record. */
+static int convert_text(void)
+{
+	struct ihr_stream stream;
+	const char *block;
+	long len;
+	int status = 0;
+	int first = 1, guessed = 0;
+	while ((len = next_block(&block)) > 0) {
+		if (first && conv.in_type == TYPE_NONE) {
+			/* No type was given, so guess it: */
+			conv.in_type = ihr_detect(len, block);
+			if (conv.in_type < 0) {
+				fprintf(stderr, "%s: cannot tell the type of the "
+					"input; give it with -i\n", progname);
+				return -1;
+			}
+			/* The extended address records of a big file may all
+			 * be beyond what ihr_detect looks at. I32 allows every
+			 * I8 record, so it is the safer guess: */
+			if (conv.in_type == IHRT_I8) conv.in_type = IHRT_I32;
+			guessed = 1;
+		}
+		if (first) ihr_stream_init(&stream, conv.in_type);
+		first = 0;
+		status = ihr_stream_feed(&stream, len, block, take_record, NULL);
+		release_block();
+		if (status != 0) break;
+	}
+	if (len < 0) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		return -1;
+	}
+	if (status == 0 && !first)
+		status = ihr_stream_end(&stream, take_record, NULL);
+	if (status < 0) {
+		fprintf(stderr, "%s: line %lu, column %lu: %s\n", progname,
+			(unsigned long)stream.err.line,
+			(unsigned long)stream.err.column,
+			conv.error ? conv.error : error_message(-status));
+		if (guessed && status == -IHRE_INVALID_TYPE) {
+			fprintf(stderr, "%s: the input type was guessed; give "
+				"it with -i\n", progname);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/* Convert binary input, starting at addr. */
+static int convert_binary(IHR_U32 addr)
+{
+	const char *block;
+	long len;
+	while ((len = next_block(&block)) > 0) {
+		int status = put(addr, len, (const IHR_U8 *)block);
+		release_block();
+		if (status < 0) {
+			fprintf(stderr, "%s: %s\n", progname, conv.error);
+			return -1;
+		}
+		addr += len;
+	}
+	if (len < 0) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t thread;
+	unsigned long addr = 0;
+	int have_addr = 0, crlf = 0, rec_size = 0, opt, status;
+	if (argc > 0) progname = argv[0];
+	conv.in_type = TYPE_NONE;
+	conv.out_type = TYPE_NONE;
+	conv.fill = 0xFF;
+	while ((opt = getopt(argc, argv, "i:o:b:f:r:c")) != -1) {
+		switch (opt) {
+		case 'i':
+			conv.in_type = parse_type(optarg);
+			break;
+		case 'o':
+			conv.out_type = parse_type(optarg);
+			break;
+		case 'b':
+			addr = parse_number(optarg, 0xFFFFFFFF);
+			have_addr = 1;
+			break;
+		case 'f':
+			conv.fill = parse_number(optarg, 0xFF);
+			break;
+		case 'r':
+			rec_size = parse_number(optarg, IHR_MAX_SIZE);
+			break;
+		case 'c':
+			crlf = 1;
+			break;
+		default:
+			print_usage();
+			return 2;
+		}
+	}
+	if (conv.out_type == TYPE_NONE || argc - optind > 2) {
+		print_usage();
+		return 2;
+	}
+	reader.fd = 0;
+	if (optind < argc && strcmp(argv[optind], "-")) {
+		reader.fd = open(argv[optind], O_RDONLY);
+		if (reader.fd < 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname, argv[optind],
+				strerror(errno));
+			return 1;
+		}
+	}
+	conv.out = stdout;
+	if (optind + 1 < argc && strcmp(argv[optind + 1], "-")) {
+		conv.out = fopen(argv[optind + 1], "wb");
+		if (!conv.out) {
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				argv[optind + 1], strerror(errno));
+			return 1;
+		}
+	}
+	if (conv.out_type != TYPE_BIN) {
+		ihr_writer_init(&conv.writer, conv.out_type,
+			crlf ? IHRW_CRLF : 0);
+		if (rec_size > 0 && rec_size < conv.writer.rec_size)
+			conv.writer.rec_size = rec_size;
+	} else if (have_addr && conv.in_type != TYPE_BIN) {
+		conv.origin = addr;
+		conv.have_origin = 1;
+	}
+	pthread_mutex_init(&reader.lock, NULL);
+	pthread_cond_init(&reader.cond, NULL);
+	if ((errno = pthread_create(&thread, NULL, read_blocks, NULL))) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		return 1;
+	}
+	if (conv.in_type == TYPE_BIN) {
+		status = convert_binary(addr);
+	} else {
+		status = convert_text();
+	}
+	if (status == 0 && finish() < 0) {
+		fprintf(stderr, "%s: %s\n", progname, conv.error);
+		status = -1;
+	}
+	if (fclose(conv.out) && status == 0) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		status = -1;
+	}
+	/* The reader thread may still be waiting for input, so it is not
+	 * joined; exiting stops it. */
+	return status < 0;
+}
@@ -20,6 +20,14 @@ const char *errstr(int code)
 		return "Character pair is not a hexidecimal digit pair";
 	case IHRE_SUB_MIN_LENGTH:
 		return "Record text below minimum possible size";
+	case IHRE_SYSTEM:
+		return "System error";
+	case IHRE_NO_MEMORY:
+		return "Out of memory";
+	case IHRE_INVALID_ADDR:
+		return "Address out of range for file type";
+	case IHRE_OVERLAP:
+		return "Data overlap differing data";
 	default:
 		return "Uknown error";
 	}
@@ -59,3 +67,58 @@ int read_or_live(int type,
 	}
 	return len;
 }
+
+unsigned long random_seed = 1;
+
+unsigned long next_random(void)
+{
+	random_seed = random_seed * 1103515245 + 12345;
+	return random_seed >> 16 & 0x7FFF;
+}
+
+size_t write_text(const struct text_shape *shape, size_t cap, char *text)
+{
+	static const IHR_U32 tops[] = {
+		0xFFFF, 0xFFFFF, 0xFFFFFFFF, 0xFFFF, 0xFFFFFF, 0xFFFFFFFF
+	};
+	IHR_U8 data[4096];
+	struct ihr_writer writer;
+	struct ihr_record rec;
+	IHR_U32 top = tops[shape->file_type], addr = 0;
+	IHR_U8 most;
+	size_t len = 0;
+	ihr_writer_init(&writer, shape->file_type, shape->flags);
+	most = writer.rec_size;
+	/* Room is kept for the end record: */
+	while (cap - len >= 3 * IHR_MAX_LENGTH) {
+		size_t size = next_random() % shape->max_run + 1, i;
+		IHR_U32 gap = ((IHR_U32)next_random() << 15 | next_random())
+			% (shape->max_gap + 1);
+		for (i = 0; i < size; ++i) data[i] = next_random();
+		if (size - 1 > top - addr) addr = 0;
+		writer.rec_size = shape->rec_size ? shape->rec_size
+			: next_random() % most + 1;
+		assert(!ihr_write_data(&writer, addr, size, data,
+			cap - len - IHR_MAX_LENGTH, text + len));
+		len += writer.len;
+		if (writer.used < size) break;
+		addr = size + gap - 1 > top - addr ? 0 : addr + size + gap;
+	}
+	if (shape->end) {
+		rec.type = shape->file_type <= IHRT_I32 ? IHRR_I_END_OF_FILE
+			: IHRR_S9_START_16 + IHRT_S19 - shape->file_type;
+		rec.addr = 0;
+		rec.size = 0;
+		len += ihr_write(shape->file_type, 0, &rec, text + len);
+	}
+	return len;
+}
+
+void damage_text(char *text, size_t len, size_t count)
+{
+	static const char junk[] = "\n\r0Fx :S";
+	while (count-- > 0) {
+		size_t at = ((size_t)next_random() << 15 | next_random()) % len;
+		text[at] = junk[next_random() % (sizeof(junk) - 1)];
+	}
+}
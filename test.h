@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 const char *errstr(int code);
 
 int read_or_die(int type,
@@ -17,3 +21,32 @@ int read_or_live(int type,
 	struct ihr_record *rec,
 	int line,
 	int expected_err);
+
+/* The state of next_random, which a test may set to get other numbers. */
+extern unsigned long random_seed;
+
+/* A pseudo-random number from 0 to 0x7FFF. */
+unsigned long next_random(void);
+
+/* What write_text writes. */
+struct text_shape {
+	int file_type;
+	int flags; /* Given to ihr_writer_init */
+	size_t max_run; /* Runs of data are 1 to max_run bytes, at most 4096 */
+	IHR_U32 max_gap; /* Runs are 0 to max_gap bytes apart, below 2^30 */
+	IHR_U8 rec_size; /* Data bytes in a record, or 0 for a random size for
+			    each run */
+	int end; /* Whether an end record is written last */
+};
+
+/* Write runs of random data at rising addresses into the cap characters of
+ * text, starting again from 0 at the top of the addresses of the file type,
+ * until it is nearly full. Returns the length of the text. */
+size_t write_text(const struct text_shape *shape, size_t cap, char *text);
+
+/* Put count characters which can break a record at random places in text. */
+void damage_text(char *text, size_t len, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,105 @@
+#include "../test.h"
+#include <string.h>
+
+#define TEXT_SIZE (1 << 16)
+#define MAX_RESULTS (TEXT_SIZE / 8)
+
+static char text[TEXT_SIZE];
+static size_t text_len;
+
+/* A record or error read by an iterator: */
+static struct result {
+	int type;
+	IHR_U8 size;
+	IHR_U32 addr;
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_error err;
+} expected[MAX_RESULTS];
+static size_t n_expected;
+
+/* Fill text with records of random sizes, then damage some of it. */
+static void make_text(int file_type)
+{
+	struct text_shape shape = {0, 0, IHR_MAX_SIZE, 300, 0, 0};
+	struct ihr_record rec;
+	shape.file_type = file_type;
+	text_len = write_text(&shape, TEXT_SIZE, text);
+	rec.type = IHRR_I_START_LIN_ADDR;
+	rec.data.ihex.ext_instr_ptr = 0x12345678;
+	text_len += ihr_write(file_type, 0, &rec, text + text_len);
+	damage_text(text, text_len, text_len / 2000);
+}
+
+static void read_records(int file_type)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	int reclen;
+	n_expected = 0;
+	ihr_iter_init(&iter, file_type, text_len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		struct result *res = &expected[n_expected++];
+		res->type = rec.type;
+		if (reclen < 0) {
+			res->err.code = -rec.type;
+			res->err.line = iter.line;
+			res->err.column = ~reclen;
+			continue;
+		}
+		res->size = rec.size;
+		res->addr = rec.addr;
+		memcpy(res->data, data, rec.size);
+	}
+}
+
+/* Read the text in batches and compare with what the iterator read. */
+static void compare(int file_type, size_t cap)
+{
+	struct ihr_batch batch;
+	struct ihr_iter iter;
+	size_t n = 0;
+	int status;
+	assert(ihr_batch_init(&batch, cap) == 0);
+	ihr_iter_init(&iter, file_type, text_len, text, NULL);
+	do {
+		size_t i;
+		status = ihr_read_batch(&iter, &batch);
+		assert(batch.count <= cap);
+		for (i = 0; i < batch.count; ++i, ++n) {
+			struct result *res = &expected[n];
+			assert(batch.types[i] == res->type);
+			assert(batch.sizes[i] == res->size);
+			assert(batch.addrs[i] == res->addr);
+			assert(!memcmp(batch.data + batch.offsets[i], res->data,
+				res->size));
+			if (i > 0) {
+				assert(batch.offsets[i] == batch.offsets[i - 1]
+					+ batch.sizes[i - 1]);
+			}
+		}
+		if (status < 0) {
+			struct result *res = &expected[n++];
+			assert(status == res->type);
+			assert(batch.err.code == res->err.code);
+			assert(batch.err.line == res->err.line);
+			assert(batch.err.column == res->err.column);
+		}
+	} while (status < 0 || batch.count == cap);
+	assert(n == n_expected);
+	ihr_batch_free(&batch);
+}
+
+int main(void)
+{
+	int round;
+	random_seed = 13;
+	for (round = 0; round < 8; ++round) {
+		make_text(IHRT_I32);
+		read_records(IHRT_I32);
+		compare(IHRT_I32, 1);
+		compare(IHRT_I32, 7);
+		compare(IHRT_I32, 4096);
+	}
+	return 0;
+}
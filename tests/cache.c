@@ -0,0 +1,70 @@
+#include "../test.h"
+#include <string.h>
+
+static const char path[] = "cache.bin";
+
+static const char text[] =
+	":020000040001F9\n"
+	":10000000000102030405060708090A0B0C0D0E0F78\n"
+	":10FFF800F8F9FAFBFCFDFEFF000102030405060701\n"
+	":020000040800F2\n"
+	":0400100001020304E2\n"
+	":0400000508000123CB\n"
+	":00000001FF\n";
+
+static void check_same(const struct ihr_image *a, const struct ihr_image *b)
+{
+	size_t i;
+	assert(a->file_type == b->file_type);
+	assert(a->start_type == b->start_type);
+	assert(a->start == b->start);
+	assert(a->base == b->base);
+	assert(a->count == b->count);
+	for (i = 0; i < a->count; ++i) {
+		assert(a->segs[i].addr == b->segs[i].addr);
+		assert(a->segs[i].size == b->segs[i].size);
+		assert(!memcmp(a->segs[i].data, b->segs[i].data,
+			a->segs[i].size));
+	}
+}
+
+int main(void)
+{
+	size_t len = sizeof(text) - 1;
+	struct ihr_image img, empty;
+	struct ihr_cache cache;
+	struct ihr_error err;
+	char changed[sizeof(text)];
+	ihr_image_init(&img, IHRT_I32);
+	assert(ihr_image_read(&img, len, text, 1, &err) == 1);
+	assert(img.count == 3);
+	assert(img.start_type == IHRR_I_START_LIN_ADDR);
+	/* There is nothing to load at first: */
+	remove(path);
+	assert(ihr_cache_load(&cache, IHRT_I32, path, len, text) == 1);
+	assert(cache.img.count == 0);
+	/* What is saved is loaded back, with the data in pages of the file: */
+	assert(!ihr_cache_save(&img, path, len, text));
+	assert(!ihr_cache_load(&cache, IHRT_I32, path, len, text));
+	check_same(&img, &cache.img);
+	assert((size_t)cache.img.segs[0].data % 4096 == 0);
+	assert((size_t)cache.img.segs[2].data % 4096 == 0);
+	assert(ihr_image_find(&cache.img, 0x20000)->addr == 0x1FFF8);
+	ihr_cache_free(&cache);
+	/* A cache is not loaded for a changed text or another type: */
+	memcpy(changed, text, sizeof(text));
+	changed[20] = '1';
+	assert(ihr_cache_load(&cache, IHRT_I32, path, len, changed) == 1);
+	assert(ihr_cache_load(&cache, IHRT_I32, path, len - 1, text) == 1);
+	assert(ihr_cache_load(&cache, IHRT_I16, path, len, text) == 1);
+	assert(cache.img.count == 0);
+	/* An image with no data can be cached too: */
+	ihr_image_init(&empty, IHRT_S19);
+	assert(!ihr_cache_save(&empty, path, 0, NULL));
+	assert(!ihr_cache_load(&cache, IHRT_S19, path, 0, NULL));
+	check_same(&empty, &cache.img);
+	ihr_cache_free(&cache);
+	ihr_image_free(&img);
+	remove(path);
+	return 0;
+}
@@ -0,0 +1,115 @@
+#include "../test.h"
+#include <string.h>
+
+#define FILES 12
+
+static char *text;
+static size_t cap = (size_t)20 << 20;
+
+/* Put a record which is cut short just before offset, where a line feed is put,
+ * blanking out the rest of the lines it is put on. */
+static void cut_short(size_t offset, size_t len)
+{
+	size_t i = offset - 3;
+	while (i > 0 && text[i - 1] != '\n') text[--i] = '\n';
+	memcpy(text + offset - 3, ":00", 3);
+	for (i = offset; i < len && text[i] != '\n'; ++i) text[i] = '\n';
+}
+
+static void write_file(const char *path, size_t len)
+{
+	FILE *file = fopen(path, "wb");
+	assert(file);
+	assert(fwrite(text, 1, len, file) == len);
+	fclose(file);
+}
+
+/* Read a file whole on one thread, for what the results should be. */
+static void expect(const char *path, int flags, struct ihr_file_result *want)
+{
+	FILE *file = fopen(path, "rb");
+	struct ihr_image img;
+	size_t len, i;
+	memset(want, 0, sizeof(*want));
+	ihr_digest_init(&want->digest,
+		flags & (IHRD_CRC32 | IHRD_CRC32C | IHRD_SHA256));
+	if (!file) {
+		want->status = -IHRE_SYSTEM;
+		want->err.code = IHRE_SYSTEM;
+		return;
+	}
+	len = fread(text, 1, cap, file);
+	fclose(file);
+	if (flags & IHRC_VALIDATE) {
+		want->status = ihr_validate(IHRT_I32, len, text, &want->err);
+		return;
+	}
+	ihr_image_init(&img, IHRT_I32);
+	want->status = ihr_image_read(&img, len, text, 1, &want->err);
+	want->segments = img.count;
+	for (i = 0; i < img.count; ++i) want->size += img.segs[i].size;
+	if (want->digest.flags) ihr_image_digest(&img, &want->digest);
+	ihr_image_free(&img);
+}
+
+int main(void)
+{
+	static char names[FILES][32];
+	static const int flag_sets[] = {0, IHRD_CRC32 | IHRD_SHA256,
+		IHRC_VALIDATE};
+	static const int thread_counts[] = {1, 3, 0};
+	/* Runs of data a little apart, so that the image has segments and the
+	 * text has extended address records all through it: */
+	static const struct text_shape shape = {IHRT_I32, 0, 4096, 512, 0, 0};
+	const char *paths[FILES];
+	static struct ihr_file_result results[FILES], wants[FILES];
+	int i, f, t;
+	text = malloc(cap);
+	assert(text);
+	for (i = 0; i < FILES; ++i) {
+		/* Two are big enough to be split: */
+		size_t size = i == 2 || i == 9 ? cap - (cap >> 3)
+			: next_random() * 20;
+		size_t len;
+		sprintf(names[i], "check-files-%d.hex", i);
+		paths[i] = names[i];
+		/* One is missing: */
+		if (i == 5) continue;
+		len = write_text(&shape, size, text);
+		/* A bad digit somewhere, even in the last piece of a big file: */
+		if (i % 3 == 0 && len > 0)
+			text[len - 1 - next_random() * 97 % len] = 'x';
+		/* One has a record cut short where it is split in two: */
+		if (i == 2) cut_short(len / 2, len);
+		write_file(paths[i], len);
+	}
+	for (f = 0; f < 3; ++f) {
+		for (i = 0; i < FILES; ++i)
+			expect(paths[i], flag_sets[f], &wants[i]);
+		for (t = 0; t < 3; ++t) {
+			int first = 0;
+			int status = ihr_check_files(FILES, paths, IHRT_I32,
+				flag_sets[f], thread_counts[t], results);
+			for (i = 0; i < FILES; ++i) {
+				struct ihr_file_result *got = &results[i];
+				struct ihr_file_result *want = &wants[i];
+				assert(got->status == want->status);
+				assert(got->err.code == want->err.code);
+				assert(got->err.line == want->err.line);
+				assert(got->err.column == want->err.column);
+				assert(got->segments == want->segments);
+				assert(got->size == want->size);
+				assert(got->digest.crc32 == want->digest.crc32);
+				assert(!memcmp(got->digest.sha256,
+					want->digest.sha256, 32));
+				if (first == 0 && want->status < 0)
+					first = want->status;
+			}
+			assert(status == first);
+		}
+	}
+	assert(results[5].err.code == IHRE_SYSTEM);
+	for (i = 0; i < FILES; ++i) remove(paths[i]);
+	free(text);
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include "../test.h"
+#include <string.h>
+
+static char text[1 << 16];
+/* Write data records at random addresses, some near where addresses wrap, with
+ * extended address records between them and sometimes an end record. */
+static size_t write_wrapping(int file_type)
+{
+	static const char data_types[] = {IHRR_I_DATA, IHRR_I_DATA,
+		IHRR_I_DATA, IHRR_S1_DATA_16, IHRR_S2_DATA_24, IHRR_S3_DATA_32};
+	static const char end_types[] = {IHRR_I_END_OF_FILE,
+		IHRR_I_END_OF_FILE, IHRR_I_END_OF_FILE, IHRR_S9_START_16,
+		IHRR_S8_START_24, IHRR_S7_START_32};
+	static const IHR_U32 tops[] = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+		0xFFFFFF, 0xFFFFFFFF};
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	size_t len = 0, i;
+	while (len < sizeof(text) - 2 * IHR_MAX_LENGTH) {
+		unsigned long pick = next_random() % 100;
+		int n;
+		rec.data.data = data;
+		if (pick < 10 && (file_type == IHRT_I16
+		 || file_type == IHRT_I32)) {
+			rec.type = file_type == IHRT_I16 ? IHRR_I_EXT_SEG_ADDR
+				: IHRR_I_EXT_LIN_ADDR;
+			rec.size = 2;
+			rec.addr = 0;
+			rec.data.ihex.base_addr = next_random() << 1
+				| (pick & 1 ? 0xF000 : 0);
+		} else if (pick < 11) {
+			rec.type = end_types[file_type];
+			rec.size = 0;
+			rec.addr = 0;
+		} else {
+			rec.type = data_types[file_type];
+			rec.size = next_random() % 64;
+			rec.addr = (next_random() << 15 | next_random())
+				* 3 & tops[file_type];
+			/* Sometimes the data run past the top: */
+			if (pick < 30) rec.addr = tops[file_type] - rec.addr % 40;
+			for (i = 0; i < rec.size; ++i) data[i] = next_random();
+		}
+		n = ihr_write(file_type, 0, &rec, text + len);
+		assert(n > 0);
+		len += n;
+	}
+	return len;
+}
+
+static void check_same(struct ihr_image *a, struct ihr_image *b)
+{
+	size_t i;
+	assert(!ihr_image_flush(a) && !ihr_image_flush(b));
+	assert(a->count == b->count);
+	for (i = 0; i < a->count; ++i) {
+		assert(a->segs[i].addr == b->segs[i].addr);
+		assert(a->segs[i].size == b->segs[i].size);
+		assert(!memcmp(a->segs[i].data, b->segs[i].data,
+			a->segs[i].size));
+	}
+}
+
+/* The chunks put in an image make the same image as reading the records. */
+static void check(int file_type, size_t len)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_image want, got;
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	struct ihr_chunks chunks;
+	struct ihr_chunk chunk;
+	struct ihr_error err;
+	size_t records = 0, line = 0;
+	int reclen, status;
+	ihr_image_init(&want, file_type);
+	ihr_iter_init(&iter, file_type, len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		assert(reclen > 0);
+		++records;
+		status = ihr_image_add(&want, &rec);
+		assert(status >= 0);
+		if (status) break;
+	}
+	ihr_image_init(&got, file_type);
+	ihr_chunks_init(&chunks, file_type, len, text);
+	while ((status = ihr_chunks_next(&chunks, &chunk, &err)) != 0) {
+		assert(status == 1);
+		assert(err.code == 0);
+		assert(chunk.size > 0);
+		assert(!ihr_image_put(&got, chunk.addr, chunk.size,
+			chunk.data));
+	}
+	assert(err.code == 0);
+	/* It stays at the end: */
+	assert(ihr_chunks_next(&chunks, &chunk, &err) == 0);
+	check_same(&want, &got);
+	ihr_image_free(&got);
+	/* Every record is given when asked for, each on a new line: */
+	ihr_image_init(&got, file_type);
+	ihr_chunks_init(&chunks, file_type, len, text);
+	chunks.records = 1;
+	while ((status = ihr_chunks_next(&chunks, &chunk, &err)) != 0) {
+		assert(status == 1);
+		assert(chunk.type == chunk.rec->type);
+		if (chunks.iter.line != line) --records;
+		line = chunks.iter.line;
+		if (chunk.size > 0) {
+			assert(!ihr_image_put(&got, chunk.addr, chunk.size,
+				chunk.data));
+		}
+	}
+	assert(records == 0);
+	check_same(&want, &got);
+	ihr_image_free(&want);
+	ihr_image_free(&got);
+}
+
+int main(void)
+{
+	struct ihr_chunks chunks;
+	struct ihr_chunk chunk;
+	struct ihr_error err;
+	int file_type, trial;
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		for (trial = 0; trial < 20; ++trial) {
+			size_t len = write_wrapping(file_type);
+			check(file_type, len);
+		}
+	}
+	/* Errors say where they are, and reading goes on after them: */
+	strcpy(text, ":0100000041BE\n:0100010042BD\n:0100020043BA\n");
+	ihr_chunks_init(&chunks, IHRT_I8, strlen(text), text);
+	assert(ihr_chunks_next(&chunks, &chunk, &err) == 1);
+	assert(chunk.addr == 0 && chunk.size == 1 && chunk.data[0] == 0x41);
+	assert(ihr_chunks_next(&chunks, &chunk, &err) == -IHRE_INVALID_CHECKSUM);
+	assert(err.code == IHRE_INVALID_CHECKSUM && err.line == 2);
+	assert(ihr_chunks_next(&chunks, &chunk, &err) == 1);
+	assert(chunk.addr == 2 && chunk.data[0] == 0x43 && err.code == 0);
+	assert(ihr_chunks_next(&chunks, &chunk, &err) == 0);
+	return 0;
+}
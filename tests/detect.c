@@ -0,0 +1,70 @@
+#include "../test.h"
+#include <string.h>
+
+#define BIG_SIZE (1 << 18)
+
+static char big[BIG_SIZE];
+
+static int detect(const char *text)
+{
+	return ihr_detect(strlen(text), text);
+}
+
+/* Fill big with data records, putting first at the start and last at the end
+ * if they are not NULL. */
+static size_t make_big(const char *first, const char *last)
+{
+	static const char data[] = ":10C20000E0A5E6F6FDFFE0AEE00FE6FCFDFFE6FD93\n";
+	size_t len = 0;
+	if (first) {
+		strcpy(big, first);
+		len = strlen(first);
+	}
+	while (len + sizeof(data) + 64 < BIG_SIZE) {
+		memcpy(big + len, data, sizeof(data) - 1);
+		len += sizeof(data) - 1;
+	}
+	if (last) {
+		strcpy(big + len, last);
+		len += strlen(last);
+	}
+	return len;
+}
+
+int main(void)
+{
+	size_t len;
+	/* Intel HEX: */
+	assert(detect(":0B0010006164647265737320676170A7\n:00000001FF\n")
+		== IHRT_I8);
+	assert(detect("\r\n:020000021000EC\n:00000001FF\n") == IHRT_I16);
+	assert(detect(":020000041234B4\n:0400000512345678E3\n") == IHRT_I32);
+	assert(detect(":020000021000EC\n:020000041234B4\n")
+		== -IHRE_INVALID_TYPE);
+	/* SREC: */
+	assert(detect("S00600004844521B\nS1130000285F245F\nS9030000FC\n")
+		== IHRT_S19);
+	assert(detect("S20712345601020356\nS8041234565F\n") == IHRT_S28);
+	assert(detect("S5030001FB\nS6040000010A\n") == IHRT_S28);
+	assert(detect("S30689ABCDEF0900\nS70589ABCDEF0A\n") == IHRT_S37);
+	assert(detect("S00600004844521B\n") == IHRT_S19);
+	assert(detect("S1130000285F245F\nS6040000010A\n") == -IHRE_INVALID_TYPE);
+	assert(detect("S1130000285F245F\nS30689ABCDEF0900\n")
+		== -IHRE_INVALID_TYPE);
+	/* No records: */
+	assert(detect("") == -IHRE_MISSING_START);
+	assert(detect("\n\n") == -IHRE_MISSING_START);
+	assert(detect("hello\n") == -IHRE_MISSING_START);
+	/* Records at either end of a big text are seen: */
+	len = make_big(":020000041234B4\n", ":00000001FF\n");
+	assert(ihr_detect(len, big) == IHRT_I32);
+	len = make_big(NULL, ":0400000312345678E5\n:00000001FF\n");
+	assert(ihr_detect(len, big) == IHRT_I16);
+	len = make_big(NULL, ":00000001FF\n");
+	assert(ihr_detect(len, big) == IHRT_I8);
+	/* Records in the middle are not looked at: */
+	len = make_big(NULL, ":00000001FF\n");
+	memcpy(big + len / 2 - len / 2 % 44, ":020000041234B4\n", 16);
+	assert(ihr_detect(len, big) == IHRT_I8);
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "../test.h"
+#include <string.h>
+
+#define SPACE 0x40000
+
+static IHR_U8 present[2][SPACE], values[2][SPACE];
+static struct ihr_range expected[SPACE];
+static size_t n_expected;
+/* Put random data in both images and in the arrays describing them. Blocks are
+ * put in one image or both, and sometimes changed a little in the second. */
+static void fill(struct ihr_image imgs[2], IHR_U32 base)
+{
+	static IHR_U8 data[8192];
+	int block, which;
+	for (block = 0; block < 64; ++block) {
+		size_t off = next_random() * 8 % SPACE, i;
+		size_t size = next_random() % sizeof(data) + 1;
+		int where = next_random() % 4;
+		if (size > SPACE - off) size = SPACE - off;
+		for (i = 0; i < size; ++i) data[i] = next_random();
+		for (which = 0; which < 2; ++which) {
+			if (where == which) continue;
+			if (which == 1 && where == 3 && size > 1) {
+				data[next_random() % size] ^= 0x10;
+				data[size - 1] ^= next_random() % 2;
+			}
+			assert(!ihr_image_put(&imgs[which], base + off, size,
+				data));
+			memset(present[which] + off, 1, size);
+			memcpy(values[which] + off, data, size);
+		}
+	}
+}
+
+/* Work out the ranges which should differ a byte at a time. */
+static void find_expected(IHR_U32 base, IHR_U32 page)
+{
+	size_t k;
+	n_expected = 0;
+	for (k = 0; k < SPACE; ++k) {
+		IHR_U32 addr = base + k, first, last;
+		struct ihr_range *range = &expected[n_expected];
+		if (present[0][k] == present[1][k]
+		 && (!present[0][k] || values[0][k] == values[1][k]))
+			continue;
+		first = addr - addr % page;
+		last = page - 1 - addr % page > 0xFFFFFFFF - addr ? 0xFFFFFFFF
+			: addr + (page - 1 - addr % page);
+		if (n_expected > 0 && first - range[-1].addr <= range[-1].size) {
+			range[-1].size = (size_t)(last - range[-1].addr) + 1;
+		} else {
+			++n_expected;
+			range->addr = first;
+			range->size = (size_t)(last - first) + 1;
+		}
+	}
+}
+
+static void check(IHR_U32 base, IHR_U32 page)
+{
+	struct ihr_image imgs[2];
+	struct ihr_diff diff;
+	size_t i;
+	memset(present, 0, sizeof(present));
+	ihr_image_init(&imgs[0], IHRT_I32);
+	ihr_image_init(&imgs[1], IHRT_I32);
+	fill(imgs, base);
+	assert(!ihr_image_flush(&imgs[0]) && !ihr_image_flush(&imgs[1]));
+	find_expected(base, page);
+	assert(n_expected > 0);
+	ihr_diff_init(&diff);
+	assert(!ihr_image_diff(&diff, &imgs[0], &imgs[1], page));
+	assert(diff.count == n_expected);
+	for (i = 0; i < diff.count; ++i) {
+		assert(diff.ranges[i].addr == expected[i].addr);
+		assert(diff.ranges[i].size == expected[i].size);
+	}
+	/* The same image has no differences: */
+	assert(!ihr_image_diff(&diff, &imgs[1], &imgs[1], page));
+	assert(diff.count == 0);
+	ihr_diff_free(&diff);
+	ihr_image_free(&imgs[0]);
+	ihr_image_free(&imgs[1]);
+}
+
+int main(void)
+{
+	static const IHR_U32 pages[] = {1, 2, 256, 1000, 4096};
+	static const IHR_U32 bases[] = {0, 0x08000000, 0xFFFFFFFF - SPACE + 1};
+	size_t p, b;
+	int trial;
+	for (b = 0; b < sizeof(bases) / sizeof(*bases); ++b) {
+		for (p = 0; p < sizeof(pages) / sizeof(*pages); ++p) {
+			for (trial = 0; trial < 4; ++trial)
+				check(bases[b], pages[p]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include "../test.h"
+#include <string.h>
+
+#define SPACE 0x10000
+
+static IHR_U8 bytes[1 << 17], flat[SPACE], present[SPACE];
+/* Work out a CRC a bit at a time. */
+static IHR_U32 slow_crc(IHR_U32 poly, const IHR_U8 *data, size_t size)
+{
+	IHR_U32 crc = 0xFFFFFFFF;
+	size_t i;
+	int bit;
+	for (i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (bit = 0; bit < 8; ++bit)
+			crc = crc & 1 ? crc >> 1 ^ poly : crc >> 1;
+	}
+	return ~crc & 0xFFFFFFFF;
+}
+
+static void check_sha256(const struct ihr_digest *digest, const char *hex)
+{
+	int i;
+	for (i = 0; i < 32; ++i) {
+		unsigned byte;
+		assert(sscanf(hex + i * 2, "%2x", &byte) == 1);
+		assert(digest->sha256[i] == byte);
+	}
+}
+
+/* Digest data given in random pieces and compare the CRCs with slow_crc. */
+static void check_pieces(size_t size)
+{
+	struct ihr_digest digest;
+	size_t at = 0;
+	ihr_digest_init(&digest, IHRD_CRC32 | IHRD_CRC32C | IHRD_SHA256);
+	while (at < size) {
+		size_t piece = next_random() % 700;
+		if (piece > size - at) piece = size - at;
+		ihr_digest_update(&digest, piece, bytes + at);
+		at += piece;
+	}
+	ihr_digest_end(&digest);
+	assert(digest.crc32 == slow_crc(0xEDB88320, bytes, size));
+	assert(digest.crc32c == slow_crc(0x82F63B78, bytes, size));
+}
+
+static void check_known(void)
+{
+	static const char million_a[] = "cdc76e5c9914fb9281a1c7e284d73e67"
+		"f1809a48a497200e046d39ccc7112cd0";
+	struct ihr_digest digest;
+	int i;
+	ihr_digest_init(&digest, IHRD_CRC32 | IHRD_CRC32C | IHRD_SHA256);
+	ihr_digest_end(&digest);
+	assert(digest.crc32 == 0 && digest.crc32c == 0);
+	check_sha256(&digest, "e3b0c44298fc1c149afbf4c8996fb924"
+		"27ae41e4649b934ca495991b7852b855");
+	ihr_digest_init(&digest, IHRD_CRC32 | IHRD_CRC32C | IHRD_SHA256);
+	ihr_digest_update(&digest, 9, (const IHR_U8 *)"123456789");
+	ihr_digest_end(&digest);
+	assert(digest.crc32 == 0xCBF43926);
+	assert(digest.crc32c == 0xE3069283);
+	ihr_digest_init(&digest, IHRD_SHA256);
+	ihr_digest_update(&digest, 56, (const IHR_U8 *)
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+	ihr_digest_end(&digest);
+	check_sha256(&digest, "248d6a61d20638b8e5c026930c3e6039"
+		"a33ce45964ff2167f6ecedd419db06c1");
+	memset(bytes, 'a', 1000);
+	ihr_digest_init(&digest, IHRD_SHA256);
+	for (i = 0; i < 1000; ++i) {
+		ihr_digest_update(&digest, 1000, bytes);
+	}
+	ihr_digest_end(&digest);
+	check_sha256(&digest, million_a);
+}
+
+/* Write records for random blocks of data at increasing or random addresses,
+ * keeping what the image and the flat stream of data should be. */
+static size_t write_blocks(char *text, size_t cap, int ordered,
+	struct ihr_digest *stream)
+{
+	struct ihr_writer writer;
+	size_t len = 0, at = 0;
+	int block;
+	ihr_writer_init(&writer, IHRT_I32, 0);
+	memset(present, 0, sizeof(present));
+	for (block = 0; block < 32; ++block) {
+		size_t off, size = next_random() % 1500 + 1, i;
+		IHR_U8 *data = bytes + block * 2048;
+		if (ordered) {
+			off = at + next_random() % 300;
+			if (off + size > SPACE) break;
+			at = off + size;
+		} else {
+			off = next_random() * 2 % (SPACE - size);
+		}
+		for (i = 0; i < size; ++i) data[i] = next_random();
+		memcpy(flat + off, data, size);
+		memset(present + off, 1, size);
+		ihr_digest_update(stream, size, data);
+		assert(!ihr_write_data(&writer, 0x08000000 + off, size, data,
+			cap - len, text + len));
+		assert(writer.used == size);
+		len += writer.len;
+	}
+	return len;
+}
+
+/* Digest the bytes of flat from the first to the last present, with the rest
+ * filled with fill. */
+static void flat_digest(struct ihr_digest *digest, IHR_U8 fill)
+{
+	size_t first = 0, end = SPACE, i;
+	while (!present[first]) ++first;
+	while (!present[end - 1]) --end;
+	for (i = first; i < end; ++i) {
+		IHR_U8 byte = present[i] ? flat[i] : fill;
+		ihr_digest_update(digest, 1, &byte);
+	}
+	ihr_digest_end(digest);
+}
+
+static void check_image(int ordered, int threads)
+{
+	static char text[SPACE * 3];
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_digest want, stream, got, flat_want, again;
+	struct ihr_image img;
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	struct ihr_error err;
+	int flags = IHRD_CRC32 | IHRD_CRC32C | IHRD_SHA256, reclen;
+	size_t len;
+	ihr_digest_init(&flat_want, flags);
+	len = write_blocks(text, sizeof(text), ordered, &flat_want);
+	ihr_digest_end(&flat_want);
+	ihr_image_init(&img, IHRT_I32);
+	ihr_digest_init(&got, flags);
+	img.digest = &got;
+	img.fill = 0x00;
+	if (threads) {
+		assert(!ihr_image_read(&img, len, text, threads, &err));
+	} else {
+		ihr_iter_init(&iter, IHRT_I32, len, text, data);
+		ihr_digest_init(&stream, flags);
+		iter.digest = &stream;
+		while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+			assert(reclen > 0);
+			assert(ihr_image_add(&img, &rec) >= 0);
+		}
+		assert(!ihr_image_flush(&img));
+		ihr_digest_end(&stream);
+		assert(stream.crc32 == flat_want.crc32);
+		assert(stream.crc32c == flat_want.crc32c);
+		assert(!memcmp(stream.sha256, flat_want.sha256, 32));
+	}
+	ihr_image_digest(&img, &got);
+	ihr_digest_init(&want, flags);
+	flat_digest(&want, 0x00);
+	assert(got.crc32 == want.crc32);
+	assert(got.crc32c == want.crc32c);
+	assert(!memcmp(got.sha256, want.sha256, 32));
+	/* A digest not given while building is worked out from the segments: */
+	ihr_digest_init(&again, flags);
+	ihr_image_digest(&img, &again);
+	assert(again.crc32 == want.crc32);
+	assert(!memcmp(again.sha256, want.sha256, 32));
+	ihr_image_free(&img);
+}
+
+int main(void)
+{
+	size_t sizes[] = {0, 1, 15, 16, 63, 64, 65, 127, 255, 256, 257, 1000,
+		4096, 100003, sizeof(bytes)};
+	size_t i;
+	check_known();
+	for (i = 0; i < sizeof(bytes); ++i) bytes[i] = next_random();
+	for (i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+		check_pieces(sizes[i]);
+	}
+	for (i = 0; i < 8; ++i) {
+		check_image(1, 0);
+		check_image(0, 0);
+		check_image(1, 2);
+		check_image(0, 2);
+	}
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include "../test.h"
+#include "../ihr.hpp"
+#include <cstdio>
+#include <cstring>
+
+static char text[1 << 16];
+
+static_assert(ihr::reader<ihr::format::S28>::valid(IHRR_S2_DATA_24));
+static_assert(!ihr::reader<ihr::format::S28>::valid(IHRR_S3_DATA_32));
+static_assert(ihr::reader<ihr::format::S37>::addr_size(IHRR_S7_START_32) == 4);
+static_assert(ihr::reader<ihr::format::I32>::addr_size(IHRR_I_DATA) == 2);
+
+/* Check that the types the format allows are those ihr_read allows. */
+template <class F>
+static void check_types()
+{
+	using reader = ihr::reader<F>;
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	char line[32];
+	int type;
+	for (type = 0; type < 16; ++type) {
+		int reclen;
+		/* The type is checked before anything after it: */
+		if (reader::srec) {
+			std::sprintf(line, "S%X0300000000\n", type);
+		} else {
+			std::sprintf(line, ":000000%02X00\n", type);
+		}
+		rec.data.data = data;
+		reclen = ihr_read(F::file_type, std::strlen(line), line, &rec);
+		assert(reader::valid(type)
+			== (reclen >= 0 || rec.type != -IHRE_INVALID_TYPE));
+	}
+}
+
+/* Check that the address of each valid SREC type is as wide as the format
+ * says, by the length of a record of that type written without data. */
+template <class F>
+static void check_addr_sizes()
+{
+	using reader = ihr::reader<F>;
+	struct ihr_record rec;
+	char line[32];
+	int type;
+	for (type = 0; type < 16; ++type) {
+		if (!reader::valid(type)) continue;
+		rec.type = type;
+		rec.size = 0;
+		rec.addr = 0;
+		assert(ihr_write(F::file_type, 0, &rec, line)
+			== 7 + 2 * reader::addr_size(type));
+	}
+	assert(reader::addr_size(reader::srec ? F::file_type - IHRT_S19 + 1
+		: IHRR_I_DATA) == F::addr_size);
+}
+
+/* Read each record of the text with the reader and with ihr_read, which must
+ * agree. */
+template <class F>
+static void check_reads(size_t len)
+{
+	ihr::reader<F> read;
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	size_t at = 0;
+	while (at < len) {
+		std::string_view rest(text + at, len - at);
+		size_t reclen = read(rest);
+		int reclen2;
+		rec.data.data = data;
+		reclen2 = ihr_read(F::file_type, len - at, text + at, &rec);
+		assert(ihr::reader<F>::read(rest, rec) == reclen2);
+		assert(read.record().type == rec.type);
+		if (reclen2 < 0) {
+			const char *end;
+			assert(reclen == 0 && read.error() == -rec.type);
+			/* Go on from the next line: */
+			end = static_cast<const char *>(
+				std::memchr(text + at, '\n', len - at));
+			if (!end) break;
+			at = end + 1 - text;
+			continue;
+		}
+		assert(reclen == (size_t)reclen2 && !read.error());
+		assert(read.record().size == rec.size);
+		assert(read.record().addr == rec.addr);
+		assert(read.data().size() == rec.size);
+		if (rec.type == IHRR_I_DATA || F::file_type >= IHRT_S19)
+			assert(!std::memcmp(read.data().data(), data,
+				rec.size));
+		at += reclen;
+	}
+}
+
+template <class F>
+static void check()
+{
+	struct text_shape shape = {F::file_type, 0, 1024, 4096, 0, 1};
+	size_t len;
+	static_assert(ihr::reader<F>::file_type == F::file_type);
+	assert(ihr_reader(F::file_type) == F::read);
+	check_types<F>();
+	if (ihr::reader<F>::srec) check_addr_sizes<F>();
+	len = write_text(&shape, sizeof(text), text);
+	check_reads<F>(len);
+	damage_text(text, len, len / 100);
+	check_reads<F>(len);
+}
+
+int main(void)
+{
+	check<ihr::format::I8>();
+	check<ihr::format::I16>();
+	check<ihr::format::I32>();
+	check<ihr::format::S19>();
+	check<ihr::format::S28>();
+	check<ihr::format::S37>();
+	return 0;
+}
@@ -0,0 +1,73 @@
+#include "../test.h"
+#include <string.h>
+
+static const char hex_path[] = "ihrconv.hex";
+static const char srec_path[] = "ihrconv.s37";
+static const char bin_path[] = "ihrconv.bin";
+
+static const char text[] =
+	":020000041234B4\n"
+	":04FFFE0001020304F5\n"
+	":020000041235B3\n"
+	":020004000506EF\n"
+	":0400000512345678E3\n"
+	":00000001FF\n";
+
+static void write_file(const char *path, const char *contents)
+{
+	FILE *file = fopen(path, "wb");
+	assert(file);
+	fputs(contents, file);
+	fclose(file);
+}
+
+static size_t read_file(const char *path, char *buf, size_t size)
+{
+	FILE *file = fopen(path, "rb");
+	size_t len;
+	assert(file);
+	len = fread(buf, 1, size, file);
+	fclose(file);
+	return len;
+}
+
+int main(void)
+{
+	static const char bin[] = "\1\2\3\4\0\0\5\6";
+	char buf[1024];
+	size_t len;
+	write_file(hex_path, text);
+	/* Intel HEX to SREC, guessing the input type: */
+	assert(system("../ihrconv -o s37 ihrconv.hex ihrconv.s37") == 0);
+	len = read_file(srec_path, buf, sizeof(buf));
+	buf[len] = '\0';
+	assert(!strcmp(buf,
+		"S3091234FFFE01020304A9\n"
+		"S307123500040506A2\n"
+		"S70512345678E6\n"));
+	/* SREC to binary, with the gap filled: */
+	assert(system("../ihrconv -o bin -f 0 ihrconv.s37 ihrconv.bin") == 0);
+	len = read_file(bin_path, buf, sizeof(buf));
+	assert(len == 8);
+	assert(!memcmp(buf, bin, 8));
+	/* Binary back to Intel HEX: */
+	assert(system("../ihrconv -i bin -o i32 -b 0x1234FFFE -r 4 "
+		"ihrconv.bin ihrconv.hex") == 0);
+	len = read_file(hex_path, buf, sizeof(buf));
+	buf[len] = '\0';
+	assert(!strcmp(buf,
+		":020000041234B4\n"
+		":02FFFE000102FE\n"
+		":020000041235B3\n"
+		":0400000003040000F5\n"
+		":020004000506EF\n"
+		":00000001FF\n"));
+	/* Bad input is reported: */
+	write_file(hex_path, ":00000001FE\n");
+	assert(system("../ihrconv -o s37 ihrconv.hex ihrconv.s37 2>/dev/null")
+		!= 0);
+	remove(hex_path);
+	remove(srec_path);
+	remove(bin_path);
+	return 0;
+}
@@ -0,0 +1,225 @@
+#include "../test.h"
+#include <string.h>
+
+static void add_lines(struct ihr_image *img,
+	const char *const *lines,
+	size_t count)
+{
+	struct ihr_record rec;
+	IHR_U8 buf[IHR_MAX_SIZE];
+	size_t i;
+	for (i = 0; i < count; ++i) {
+		rec.data.data = buf;
+		read_or_die(img->file_type, strlen(lines[i]), lines[i], &rec,
+			i + 1);
+		assert(ihr_image_add(img, &rec) == (i + 1 == count));
+	}
+}
+
+static void assert_segment(const struct ihr_segment *seg,
+	IHR_U32 addr,
+	size_t size,
+	const char *data)
+{
+	assert(seg->addr == addr);
+	assert(seg->size == size);
+	assert(!memcmp(seg->data, data, size));
+}
+
+static void test_i32(void)
+{
+	static const char *const lines[] = {
+		":020000041234B4",
+		":04FFFE0001020304F5",
+		":020000041235B3",
+		":020002000506F1",
+		":0400000512345678E3",
+		":00000001FF"
+	};
+	struct ihr_image img;
+	ihr_image_init(&img, IHRT_I32);
+	add_lines(&img, lines, sizeof(lines) / sizeof(*lines));
+	assert(img.count == 1);
+	assert_segment(&img.segs[0], 0x1234FFFE, 6, "\1\2\3\4\5\6");
+	assert(img.start_type == IHRR_I_START_LIN_ADDR);
+	assert(img.start == 0x12345678);
+	assert(ihr_image_find(&img, 0x12350003) == &img.segs[0]);
+	assert(!ihr_image_find(&img, 0x12350004));
+	assert(!ihr_image_find(&img, 0x1234FFFD));
+	ihr_image_free(&img);
+}
+
+static void test_i16(void)
+{
+	static const char *const lines[] = {
+		":020000021000EC",
+		":02FFFF000A0BEB",
+		":0400000312345678E5",
+		":00000001FF"
+	};
+	struct ihr_image img;
+	ihr_image_init(&img, IHRT_I16);
+	add_lines(&img, lines, sizeof(lines) / sizeof(*lines));
+	/* The data wrapped around within the segment: */
+	assert(img.count == 2);
+	assert_segment(&img.segs[0], 0x10000, 1, "\13");
+	assert_segment(&img.segs[1], 0x1FFFF, 1, "\12");
+	assert(img.start_type == IHRR_I_START_SEG_ADDR);
+	assert(img.start == 0x12345678);
+	ihr_image_free(&img);
+}
+
+static void test_srec(void)
+{
+	static const char *const s28[] = {
+		"S20712345601020356",
+		"S2051234590457",
+		"S8041234565F"
+	};
+	static const char *const s37[] = {
+		"S30689ABCDEF0900",
+		"S70589ABCDEF0A"
+	};
+	struct ihr_image img;
+	ihr_image_init(&img, IHRT_S28);
+	add_lines(&img, s28, sizeof(s28) / sizeof(*s28));
+	assert(img.count == 1);
+	assert_segment(&img.segs[0], 0x123456, 4, "\1\2\3\4");
+	assert(img.start_type == IHRR_S8_START_24);
+	assert(img.start == 0x123456);
+	ihr_image_free(&img);
+	ihr_image_init(&img, IHRT_S37);
+	add_lines(&img, s37, sizeof(s37) / sizeof(*s37));
+	assert(img.count == 1);
+	assert_segment(&img.segs[0], 0x89ABCDEF, 1, "\11");
+	assert(img.start == 0x89ABCDEF);
+	ihr_image_free(&img);
+}
+
+/* Put random data at random places and compare with a flat model. */
+#define MODEL_SIZE 4096
+static void test_random_puts(void)
+{
+	static IHR_U8 model[MODEL_SIZE], present[MODEL_SIZE];
+	struct ihr_image img;
+	unsigned long seed = 7;
+	IHR_U8 data[64];
+	size_t i, n, addr;
+	ihr_image_init(&img, IHRT_I32);
+	for (n = 0; n < 2000; ++n) {
+		size_t size;
+		seed = seed * 1103515245 + 12345;
+		addr = (seed >> 8) % (MODEL_SIZE - sizeof(data));
+		size = 1 + (seed >> 20) % sizeof(data);
+		for (i = 0; i < size; ++i) {
+			data[i] = model[addr + i] = n + i;
+			present[addr + i] = 1;
+		}
+		assert(ihr_image_put(&img, addr, size, data) == 0);
+	}
+	assert(ihr_image_flush(&img) == 0);
+	addr = 0;
+	for (n = 0; n < img.count; ++n) {
+		const struct ihr_segment *seg = &img.segs[n];
+		for (; addr < seg->addr; ++addr) assert(!present[addr]);
+		assert(addr == 0 || !present[addr - 1]);
+		for (i = 0; i < seg->size; ++i, ++addr) {
+			assert(present[addr]);
+			assert(seg->data[i] == model[addr]);
+		}
+	}
+	for (; addr < MODEL_SIZE; ++addr) assert(!present[addr]);
+	ihr_image_free(&img);
+}
+
+static void test_wrap(void)
+{
+	struct ihr_image img;
+	ihr_image_init(&img, IHRT_I32);
+	assert(ihr_image_put(&img, 0xFFFFFFFE, 4, (const IHR_U8 *)"abcd") == 0);
+	assert(img.count == 2);
+	assert_segment(&img.segs[0], 0, 2, "cd");
+	assert_segment(&img.segs[1], 0xFFFFFFFE, 2, "ab");
+	assert(ihr_image_find(&img, 0xFFFFFFFF) == &img.segs[1]);
+	ihr_image_free(&img);
+}
+
+/* Data put from the top down make as many segments as they should, without
+ * moving every segment each time. */
+#define DOWN_COUNT 200000
+static void test_descending(void)
+{
+	struct ihr_image img;
+	IHR_U8 byte;
+	size_t n;
+	ihr_image_init(&img, IHRT_I32);
+	for (n = DOWN_COUNT; n-- > 0;) {
+		byte = n;
+		assert(ihr_image_put(&img, n, 1, &byte) == 0);
+	}
+	assert(ihr_image_flush(&img) == 0);
+	assert(img.count == 1 && img.segs[0].size == DOWN_COUNT);
+	for (n = 0; n < DOWN_COUNT; ++n) assert(img.segs[0].data[n] == (IHR_U8)n);
+	ihr_image_free(&img);
+	/* With gaps in between, each keeps its own segment: */
+	ihr_image_init(&img, IHRT_I32);
+	for (n = DOWN_COUNT; n-- > 0;) {
+		byte = n;
+		assert(ihr_image_put(&img, n * 2, 1, &byte) == 0);
+	}
+	assert(ihr_image_flush(&img) == 0);
+	assert(img.count == DOWN_COUNT);
+	for (n = 0; n < DOWN_COUNT; ++n) {
+		assert(img.segs[n].addr == n * 2 && img.segs[n].size == 1);
+		assert(img.segs[n].data[0] == (IHR_U8)n);
+	}
+	ihr_image_free(&img);
+}
+
+/* Data not yet merged are overlapped as the segments are. */
+static void test_pending(void)
+{
+	struct ihr_image img;
+	int policy;
+	for (policy = IHRO_LAST_WINS; policy <= IHRO_FIRST_WINS; ++policy) {
+		const char *want = policy == IHRO_LAST_WINS ? "xyzw" : "abcd";
+		ihr_image_init(&img, IHRT_I32);
+		img.overlap = policy;
+		assert(!ihr_image_put(&img, 100, 2, (const IHR_U8 *)"01"));
+		assert(!ihr_image_put(&img, 10, 2, (const IHR_U8 *)"ab"));
+		assert(!ihr_image_put(&img, 12, 2, (const IHR_U8 *)"cd"));
+		assert(!ihr_image_put(&img, 10, 4, (const IHR_U8 *)"xyzw"));
+		assert(!ihr_image_flush(&img));
+		assert(img.count == 2);
+		assert_segment(&img.segs[0], 10, 4, want);
+		assert_segment(&img.segs[1], 100, 2, "01");
+		assert(ihr_image_find(&img, 13) == &img.segs[0]);
+		/* Flushing again does nothing: */
+		assert(!ihr_image_flush(&img));
+		assert(img.count == 2);
+		ihr_image_free(&img);
+	}
+	ihr_image_init(&img, IHRT_I32);
+	img.overlap = IHRO_ERROR;
+	assert(!ihr_image_put(&img, 100, 2, (const IHR_U8 *)"01"));
+	assert(!ihr_image_put(&img, 10, 2, (const IHR_U8 *)"ab"));
+	assert(!ihr_image_put(&img, 10, 2, (const IHR_U8 *)"ab"));
+	assert(ihr_image_put(&img, 11, 2, (const IHR_U8 *)"xy")
+		== -IHRE_OVERLAP);
+	assert(!ihr_image_flush(&img));
+	assert(img.count == 2);
+	assert_segment(&img.segs[0], 10, 2, "ab");
+	ihr_image_free(&img);
+}
+
+int main(void)
+{
+	test_i32();
+	test_i16();
+	test_srec();
+	test_random_puts();
+	test_wrap();
+	test_descending();
+	test_pending();
+	return 0;
+}
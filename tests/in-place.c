@@ -0,0 +1,62 @@
+#include "../test.h"
+#include <string.h>
+
+#define TEXT_SIZE (1 << 16)
+
+static char text[TEXT_SIZE], copy[TEXT_SIZE];
+static size_t text_len;
+
+/* Fill text with records of random sizes, then damage some of it. */
+static void make_text(int file_type)
+{
+	struct text_shape shape = {0, 0, 60, 300, 0, 1};
+	shape.file_type = file_type;
+	shape.flags = next_random() % 2 ? IHRW_CRLF : 0;
+	text_len = write_text(&shape, TEXT_SIZE, text);
+	damage_text(text, text_len, text_len / 300);
+}
+
+/* Read text with a buffer and a copy of it in place; they should agree. */
+static void compare(int file_type)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter a, b;
+	struct ihr_record ra, rb;
+	int la, lb;
+	memcpy(copy, text, text_len);
+	ihr_iter_init(&a, file_type, text_len, text, data);
+	ihr_iter_init_in_place(&b, file_type, text_len, copy);
+	do {
+		la = ihr_iter_next(&a, &ra);
+		lb = ihr_iter_next(&b, &rb);
+		assert(la == lb);
+		assert(ra.type == rb.type);
+		assert(a.line == b.line && a.offset == b.offset);
+		if (la > 0 && (file_type <= IHRT_I32 ? ra.type == IHRR_I_DATA
+				: ra.type <= IHRR_S3_DATA_32)) {
+			assert(ra.size == rb.size && ra.addr == rb.addr);
+			assert(rb.data.data >= (IHR_U8 *)copy + b.offset);
+			assert(rb.data.data < (IHR_U8 *)copy + b.offset + lb);
+			assert(!memcmp(ra.data.data, rb.data.data, ra.size));
+		}
+	} while (la != 0);
+}
+
+int main(void)
+{
+	char line[] = ":0B0010006164647265737320676170A7\n";
+	struct ihr_record rec;
+	int file_type;
+	random_seed = 11;
+	assert(ihr_read_in_place(IHRT_I8, strlen(line), line, &rec) == 34);
+	assert(rec.data.data == (IHR_U8 *)line + 9);
+	assert(!memcmp(rec.data.data, "address gap", 11));
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		int round;
+		for (round = 0; round < 8; ++round) {
+			make_text(file_type);
+			compare(file_type);
+		}
+	}
+	return 0;
+}
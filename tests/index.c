@@ -0,0 +1,170 @@
+#include "../test.h"
+#include <string.h>
+
+static const char path[] = "index.hex";
+static const char index_path[] = "index.hex.idx";
+
+static char text[1 << 20];
+static size_t text_len;
+/* Write blocks of data at random addresses, some of them overlapping, some of
+ * them crossing 64K boundaries. */
+static void make_text(int file_type)
+{
+	static const IHR_U32 masks[] = {
+		0xFFFF, 0xFFFFF, 0xFFFFFFFF, 0xFFFF, 0xFFFFFF, 0xFFFFFFFF
+	};
+	IHR_U8 data[4096];
+	struct ihr_writer writer;
+	struct ihr_record rec;
+	int block;
+	ihr_writer_init(&writer, file_type, 0);
+	writer.rec_size = 32;
+	text_len = 0;
+	for (block = 0; block < 64; ++block) {
+		IHR_U32 addr = ((IHR_U32)next_random() << 15 | next_random())
+			& masks[file_type];
+		size_t size = next_random() % sizeof(data) + 1, off = 0, i;
+		if (block % 8 == 7) addr = 0xFFFFFF00 & masks[file_type];
+		if (size - 1 > masks[file_type] - addr)
+			size = masks[file_type] - addr + 1;
+		for (i = 0; i < size; ++i) data[i] = next_random();
+		while (off < size) {
+			assert(ihr_write_data(&writer, addr + off, size - off,
+				data + off, sizeof(text) - text_len,
+				text + text_len) >= 0);
+			text_len += writer.len;
+			off += writer.used;
+		}
+	}
+	rec.type = file_type <= IHRT_I32 ? IHRR_I_END_OF_FILE
+		: IHRR_S9_START_16 + IHRT_S19 - file_type;
+	rec.addr = 0;
+	text_len += ihr_write(file_type, 0, &rec, text + text_len);
+}
+
+/* Check that img has just the data of full from first to last. */
+static void check_range(const struct ihr_image *full,
+	const struct ihr_image *img,
+	IHR_U32 first,
+	IHR_U32 last)
+{
+	struct ihr_image expected;
+	size_t i;
+	ihr_image_init(&expected, full->file_type);
+	for (i = 0; i < full->count; ++i) {
+		const struct ihr_segment *seg = &full->segs[i];
+		IHR_U32 start = seg->addr, end = seg->addr + (seg->size - 1);
+		if (end < first || start > last) continue;
+		if (start < first) start = first;
+		if (end > last) end = last;
+		assert(!ihr_image_put(&expected, start, end - start + 1,
+			seg->data + (start - seg->addr)));
+	}
+	assert(img->count == expected.count);
+	for (i = 0; i < img->count; ++i) {
+		assert(img->segs[i].addr == expected.segs[i].addr);
+		assert(img->segs[i].size == expected.segs[i].size);
+		assert(!memcmp(img->segs[i].data, expected.segs[i].data,
+			img->segs[i].size));
+	}
+	ihr_image_free(&expected);
+}
+
+static void check_index(const struct ihr_index *index,
+	const struct ihr_image *full)
+{
+	int i;
+	for (i = 0; i < 200; ++i) {
+		struct ihr_image img;
+		IHR_U32 addr;
+		size_t size = next_random() % 10000 + 1;
+		if (i % 2 == 0 && full->count > 0) {
+			/* Look near some data: */
+			const struct ihr_segment *seg =
+				&full->segs[next_random() % full->count];
+			addr = seg->addr + next_random() % seg->size;
+			addr -= next_random() % 64;
+		} else {
+			addr = (IHR_U32)next_random() << 17 ^ next_random();
+		}
+		if (i == 0) {
+			addr = 0;
+			size = (size_t)-1;
+		}
+		ihr_image_init(&img, index->file_type);
+		assert(!ihr_index_get(index, text_len, text, addr, size, &img));
+		check_range(full, &img, addr,
+			size - 1 > 0xFFFFFFFF - addr ? 0xFFFFFFFF
+				: addr + (IHR_U32)(size - 1));
+		ihr_image_free(&img);
+	}
+}
+
+static void write_file(void)
+{
+	FILE *file = fopen(path, "wb");
+	assert(file);
+	assert(fwrite(text, 1, text_len, file) == text_len);
+	fclose(file);
+}
+
+int main(void)
+{
+	int file_type;
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		struct ihr_image full;
+		struct ihr_index index, loaded;
+		struct ihr_error err;
+		size_t i;
+		make_text(file_type);
+		ihr_image_init(&full, file_type);
+		assert(ihr_image_read(&full, text_len, text, 1, &err) == 1);
+		ihr_index_init(&index, file_type);
+		assert(ihr_index_build(&index, text_len, text, &err) == 1);
+		assert(index.count > 0);
+		check_index(&index, &full);
+		/* The index can be saved and loaded back: */
+		write_file();
+		remove(index_path);
+		ihr_index_init(&loaded, file_type);
+		assert(ihr_index_load(&loaded, NULL, path) == 1);
+		assert(!ihr_index_save(&index, NULL, path));
+		assert(!ihr_index_load(&loaded, NULL, path));
+		assert(loaded.count == index.count);
+		for (i = 0; i < index.count; ++i) {
+			const struct ihr_run *a = &loaded.runs[i],
+				*b = &index.runs[i];
+			assert(a->addr == b->addr && a->reach == b->reach
+				&& a->base == b->base && a->size == b->size
+				&& a->offset == b->offset && a->end == b->end);
+		}
+		check_index(&loaded, &full);
+		/* It is not loaded for another type or a changed text: */
+		loaded.file_type = file_type == IHRT_I8 ? IHRT_I16 : IHRT_I8;
+		assert(ihr_index_load(&loaded, NULL, path) == 1);
+		loaded.file_type = file_type;
+		text[text_len++] = '\n';
+		write_file();
+		assert(ihr_index_load(&loaded, NULL, path) == 1);
+		ihr_index_free(&loaded);
+		ihr_index_free(&index);
+		ihr_image_free(&full);
+	}
+	/* An error is reported where it is found: */
+	{
+		static const char bad[] =
+			":0400000001020304F2\n"
+			":04000400010203XXF2\n";
+		struct ihr_index index;
+		struct ihr_error err;
+		ihr_index_init(&index, IHRT_I32);
+		assert(ihr_index_build(&index, sizeof(bad) - 1, bad, &err)
+			== -IHRE_NOT_HEX);
+		assert(err.line == 2);
+		assert(index.count == 1);
+		ihr_index_free(&index);
+	}
+	remove(path);
+	remove(index_path);
+	return 0;
+}
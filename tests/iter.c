@@ -0,0 +1,59 @@
+#include "../test.h"
+#include <string.h>
+
+static const char text[] =
+	":0B0010006164647265737320676170A7\n"
+	"\n"
+	":10C20000E0A5E6F6FDFFE0AEE00FE6FCFDFFE6FD93\r\n"
+	"\r\n"
+	"\r"
+	":10C21000FFFFF6F50EFE4B66F2FA0CFEF2F40EFE90\r"
+	/* Errors; reading goes on after them: */
+	":10C22000F04EF05FF06CF07DCA0050C2F086F097D1\n"
+	":10C23000F04AF054BCF5\n"
+	"10C23000F04AF054BCF5204830592D02E018BB03F9\n"
+	":02000004FFFFFC\n"
+	"\n"
+	":00000001FF";
+
+static const struct {
+	int type;
+	size_t line;
+} records[] = {
+	{IHRR_I_DATA, 1},
+	{IHRR_I_DATA, 3},
+	{IHRR_I_DATA, 6},
+	{-IHRE_INVALID_CHECKSUM, 7},
+	{-IHRE_INVALID_SIZE, 8},
+	{-IHRE_MISSING_START, 9},
+	{-IHRE_INVALID_TYPE, 10},
+	{IHRR_I_END_OF_FILE, 12}
+};
+
+int main(void)
+{
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	IHR_U8 buf[IHR_MAX_SIZE];
+	size_t i;
+	int reclen;
+	ihr_iter_init(&iter, IHRT_I8, strlen(text), text, buf);
+	for (i = 0; (reclen = ihr_iter_next(&iter, &rec)) != 0; ++i) {
+		assert(i < sizeof(records) / sizeof(*records));
+		if (rec.type != records[i].type
+		 || iter.line != records[i].line) {
+			fprintf(stderr, "record %lu: EXPECTED %d on line %lu, "
+				"GOT %d on line %lu\n", (unsigned long)i,
+				records[i].type, (unsigned long)records[i].line,
+				rec.type, (unsigned long)iter.line);
+			exit(EXIT_FAILURE);
+		}
+		assert(text[iter.offset] == ':' || text[iter.offset] == '1');
+		assert((reclen < 0) == (rec.type < 0));
+	}
+	assert(i == sizeof(records) / sizeof(*records));
+	assert(iter.next == strlen(text));
+	/* The iterator stays at the end: */
+	assert(ihr_iter_next(&iter, &rec) == 0);
+	return 0;
+}
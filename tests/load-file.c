@@ -0,0 +1,79 @@
+#include "../test.h"
+#include <errno.h>
+#include <string.h>
+
+static const char path[] = "load-file.hex";
+static const char text[] =
+	":0B0010006164647265737320676170A7\n"
+	":10C20000E0A5E6F6FDFFE0AEE00FE6FCFDFFE6FD93\r\n"
+	"\n"
+	":10C21000FFFFF6F50EFE4B66F2FA0CFEF2F40EFE90\n"
+	":00000001FF\n"
+	":10C22000F04EF05FF06CF07DCA0050C2F086F097D1\n";
+
+static void write_file(const char *contents)
+{
+	FILE *file = fopen(path, "wb");
+	assert(file);
+	fputs(contents, file);
+	fclose(file);
+}
+
+static int count_records(void *ctx, const struct ihr_record *rec)
+{
+	int *count = ctx;
+	++*count;
+	return rec->type == IHRR_I_END_OF_FILE;
+}
+
+static int count_all(void *ctx, const struct ihr_record *rec)
+{
+	int *count = ctx;
+	(void)rec;
+	++*count;
+	return 0;
+}
+
+static int fail_second(void *ctx, const struct ihr_record *rec)
+{
+	int *count = ctx;
+	(void)rec;
+	return ++*count == 2 ? -IHRE_INVALID_TYPE : 0;
+}
+
+int main(void)
+{
+	struct ihr_error err;
+	int count;
+	write_file(text);
+	/* The callback can stop at the end of the file: */
+	count = 0;
+	assert(ihr_load_file(path, IHRT_I8, count_records, &count, &err) == 1);
+	assert(count == 4);
+	/* Otherwise, the bad checksum after it is reported: */
+	count = 0;
+	assert(ihr_load_file(path, IHRT_I8, count_all, &count, &err)
+		== -IHRE_INVALID_CHECKSUM);
+	assert(count == 4);
+	assert(err.code == IHRE_INVALID_CHECKSUM);
+	assert(err.line == 6);
+	assert(err.column == 44);
+	/* Errors from the callback are passed on: */
+	count = 0;
+	assert(ihr_load_file(path, IHRT_I8, fail_second, &count, &err)
+		== -IHRE_INVALID_TYPE);
+	assert(err.code == IHRE_INVALID_TYPE);
+	assert(err.line == 2);
+	/* An empty file has no records: */
+	write_file("");
+	count = 0;
+	assert(ihr_load_file(path, IHRT_I8, count_all, &count, &err) == 0);
+	assert(count == 0);
+	remove(path);
+	/* A missing file is a system error: */
+	assert(ihr_load_file(path, IHRT_I8, count_all, &count, &err)
+		== -IHRE_SYSTEM);
+	assert(err.code == IHRE_SYSTEM);
+	assert(errno == ENOENT);
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include "../test.h"
+#include <string.h>
+
+#define FILES 40
+
+static char text[1 << 20];
+/* What the callback has seen of a file. */
+struct seen {
+	unsigned long count;
+	unsigned long hash;
+	unsigned long stop_at; /* Stop after this many records, if not 0 */
+};
+
+static int take(void *ctx, const struct ihr_record *rec)
+{
+	struct seen *seen = ctx;
+	size_t i;
+	seen->hash = seen->hash * 31 + rec->type;
+	seen->hash = seen->hash * 31 + rec->addr;
+	seen->hash = seen->hash * 31 + rec->size;
+	if (rec->type == IHRR_I_DATA) {
+		for (i = 0; i < rec->size; ++i)
+			seen->hash = seen->hash * 31 + rec->data.data[i];
+	}
+	return ++seen->count == seen->stop_at;
+}
+
+/* Write a file of records with one kind of line ending, sometimes with blank
+ * lines and sometimes with a bad record. */
+static void write_file(const char *path, size_t size)
+{
+	static const char *const endings[] = {"\n", "\r\n", "\r"};
+	const char *ending = endings[next_random() % 3];
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	size_t len = 0, i;
+	FILE *file;
+	while (len + IHR_MAX_LENGTH * 2 < size) {
+		int n;
+		rec.type = IHRR_I_DATA;
+		rec.size = next_random() % 40;
+		rec.addr = next_random();
+		rec.data.data = data;
+		for (i = 0; i < rec.size; ++i) data[i] = next_random();
+		n = ihr_write(IHRT_I8, 0, &rec, text + len);
+		assert(n > 0);
+		len += n - 1;
+		if (next_random() % 30000 == 0) text[len - 2] = 'x';
+		strcpy(text + len, ending);
+		len += strlen(ending);
+		if (next_random() % 20 == 0) {
+			strcpy(text + len, ending);
+			len += strlen(ending);
+		}
+	}
+	/* The last line need not be ended: */
+	if (len > 0 && next_random() % 2) len -= strlen(ending);
+	file = fopen(path, "wb");
+	assert(file);
+	assert(fwrite(text, 1, len, file) == len);
+	fclose(file);
+}
+
+int main(void)
+{
+	static char names[FILES][32];
+	const char *paths[FILES];
+	void *ctxs[FILES];
+	struct seen seen[FILES];
+	struct ihr_error errs[FILES];
+	int i, status, first = 0;
+	for (i = 0; i < FILES; ++i) {
+		size_t size = next_random() % 4 == 0 ? next_random() * 30
+			: next_random() * 3;
+		sprintf(names[i], "load-files-%d.hex", i);
+		paths[i] = names[i];
+		/* One is missing: */
+		if (i != 7) write_file(paths[i], i == 3 ? 0 : size);
+		memset(&seen[i], 0, sizeof(seen[i]));
+		if (i == 11) seen[i].stop_at = 100;
+		ctxs[i] = &seen[i];
+	}
+	status = ihr_load_files(FILES, paths, IHRT_I8, take, ctxs, errs);
+	/* Each file is read as ihr_load_file reads it: */
+	for (i = 0; i < FILES; ++i) {
+		struct seen want;
+		struct ihr_error err;
+		int want_status;
+		memset(&want, 0, sizeof(want));
+		want.stop_at = seen[i].stop_at;
+		want_status = ihr_load_file(paths[i], IHRT_I8, take, &want,
+			&err);
+		assert(seen[i].count == want.count);
+		assert(seen[i].hash == want.hash);
+		assert(errs[i].code == err.code);
+		assert(errs[i].line == err.line);
+		assert(errs[i].column == err.column);
+		if (first == 0 && want_status < 0) first = want_status;
+		remove(paths[i]);
+	}
+	assert(errs[7].code == IHRE_SYSTEM);
+	assert(seen[11].count == 100);
+	/* The first failure is returned: */
+	assert(status == first);
+	assert(ihr_load_files(0, paths, IHRT_I8, take, ctxs, errs) == 0);
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include "../test.h"
+#include <string.h>
+
+static char line[IHR_MAX_LENGTH];
+static IHR_U8 bytes[IHR_MAX_SIZE];
+static unsigned long seed = 1;
+
+static IHR_U8 random_byte(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static void put_hex(char *text, IHR_U8 byte, int lower)
+{
+	const char *digits = lower ? "0123456789abcdef" : "0123456789ABCDEF";
+	text[0] = digits[byte >> 4];
+	text[1] = digits[byte & 0xF];
+}
+
+/* Write an I8HEX data record holding size random bytes into line. */
+static size_t make_record(int size)
+{
+	IHR_U8 cksum = size;
+	int i;
+	line[0] = ':';
+	put_hex(line + 1, size, 0);
+	memcpy(line + 3, "000000", 6);
+	for (i = 0; i < size; ++i) {
+		bytes[i] = random_byte();
+		cksum += bytes[i];
+		put_hex(line + 9 + i * 2, bytes[i], i % 3 == 0);
+	}
+	put_hex(line + 9 + size * 2, ~cksum + 1, 0);
+	return 11 + size * 2;
+}
+
+int main(void)
+{
+	struct ihr_record rec;
+	IHR_U8 buf[IHR_MAX_SIZE];
+	int size;
+	/* Every size decodes correctly: */
+	for (size = 0; size <= IHR_MAX_SIZE; ++size) {
+		size_t len = make_record(size);
+		rec.data.data = buf;
+		read_or_die(IHRT_I8, len, line, &rec, size + 1);
+		assert(rec.size == size);
+		assert(!memcmp(buf, bytes, size));
+	}
+	/* Every bad data character is reported at the start of its pair: */
+	for (size = 1; size <= IHR_MAX_SIZE; size += 7) {
+		size_t len = make_record(size);
+		size_t col;
+		for (col = 9; col < 9 + (size_t)size * 2; ++col) {
+			int pair = col - (col - 9) % 2;
+			char orig = line[col];
+			line[col] = 'G';
+			rec.data.data = buf;
+			assert(~read_or_live(IHRT_I8, len, line, &rec, size,
+				IHRE_NOT_HEX) == pair);
+			line[col] = '\n';
+			rec.data.data = buf;
+			assert(~read_or_live(IHRT_I8, len, line, &rec, size,
+				col == (size_t)pair ? IHRE_INVALID_SIZE
+					: IHRE_NOT_HEX) == pair);
+			line[col] = orig;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,192 @@
+#include "../test.h"
+#include <string.h>
+
+#define SPACE 4096
+
+static IHR_U8 flat[SPACE], present[SPACE];
+/* The overlaps an image reported. */
+struct seen {
+	IHR_U32 addrs[64];
+	size_t sizes[64];
+	int conflicts[64];
+	int count;
+	int fail; /* Whether to fail on the first */
+};
+
+static int note_overlap(void *ctx, IHR_U32 addr, size_t size, int conflict)
+{
+	struct seen *seen = ctx;
+	assert(seen->count < 64);
+	seen->addrs[seen->count] = addr;
+	seen->sizes[seen->count] = size;
+	seen->conflicts[seen->count] = conflict;
+	++seen->count;
+	return seen->fail ? -IHRE_INVALID_TYPE : 0;
+}
+
+/* The image holds just the bytes present, in segments as long as they can be. */
+static void check_image(struct ihr_image *img)
+{
+	size_t i = 0, at = 0;
+	assert(!ihr_image_flush(img));
+	while (at < SPACE) {
+		size_t end;
+		if (!present[at]) {
+			++at;
+			continue;
+		}
+		for (end = at; end < SPACE && present[end]; ++end);
+		assert(i < img->count);
+		assert(img->segs[i].addr == at);
+		assert(img->segs[i].size == end - at);
+		assert(!memcmp(img->segs[i].data, flat + at, end - at));
+		++i;
+		at = end;
+	}
+	assert(i == img->count);
+}
+
+static void check_policy(int policy)
+{
+	IHR_U8 data[200];
+	struct ihr_image img;
+	struct seen seen;
+	int trial;
+	memset(present, 0, sizeof(present));
+	ihr_image_init(&img, IHRT_I32);
+	img.overlap = policy;
+	img.on_overlap = note_overlap;
+	img.overlap_ctx = &seen;
+	for (trial = 0; trial < 2000; ++trial) {
+		size_t size = next_random() % sizeof(data) + 1;
+		IHR_U32 addr = next_random() % (SPACE - size);
+		size_t i, at;
+		int n = 0, conflict = 0, status;
+		for (i = 0; i < size; ++i) data[i] = next_random();
+		/* Often the same data are written again: */
+		if (next_random() % 2) {
+			for (i = 0; i < size; ++i) {
+				if (present[addr + i]) data[i] = flat[addr + i];
+			}
+			if (next_random() % 4 == 0)
+				data[next_random() % size] ^= 1;
+		}
+		seen.count = 0;
+		seen.fail = next_random() % 50 == 0;
+		status = ihr_image_put(&img, addr, size, data);
+		/* Each run of bytes already there is reported: */
+		for (at = addr; at < addr + size;) {
+			size_t end;
+			int differ = 0;
+			if (!present[at]) {
+				++at;
+				continue;
+			}
+			for (end = at; end < addr + size && present[end]; ++end)
+				differ |= flat[end] != data[end - addr];
+			if (!(seen.fail && n > 0)) {
+				assert(n < seen.count);
+				assert(seen.addrs[n] == at);
+				assert(seen.sizes[n] == end - at);
+				assert(seen.conflicts[n] == differ);
+			}
+			conflict |= differ;
+			++n;
+			at = end;
+			if (seen.fail || (differ && policy == IHRO_ERROR))
+				break;
+		}
+		if (n > 0 && seen.fail) {
+			assert(status == -IHRE_INVALID_TYPE);
+		} else if (conflict && policy == IHRO_ERROR) {
+			assert(status == -IHRE_OVERLAP);
+		} else {
+			assert(status == 0);
+			for (i = 0; i < size; ++i) {
+				if (!present[addr + i] || policy != IHRO_FIRST_WINS)
+					flat[addr + i] = data[i];
+				present[addr + i] = 1;
+			}
+		}
+		/* Nothing changes when it fails: */
+		check_image(&img);
+	}
+	ihr_image_free(&img);
+}
+
+static const char text[] =
+	":0400000001020304F2\n"
+	":0400020003040506E8\n"
+	":0400040005060708DE\n"
+	":0400060000000000F6\n";
+
+/* Reading a text stops at the record with differing data. */
+static void check_read(void)
+{
+	struct ihr_image img;
+	struct ihr_error err;
+	ihr_image_init(&img, IHRT_I8);
+	img.overlap = IHRO_ERROR;
+	assert(ihr_image_read(&img, strlen(text), text, 4, &err)
+		== -IHRE_OVERLAP);
+	assert(err.code == IHRE_OVERLAP);
+	assert(err.line == 4);
+	assert(img.count == 1 && img.segs[0].size == 8);
+	ihr_image_free(&img);
+}
+
+/* Data put in two pieces are checked whole before either is put. */
+static void check_pieces(void)
+{
+	static const IHR_U8 old[] = {1, 2}, new[] = {9, 9, 9, 9};
+	struct ihr_image img;
+	struct ihr_record rec;
+	int file_type;
+	for (file_type = IHRT_I16; file_type <= IHRT_I32; ++file_type) {
+		ihr_image_init(&img, file_type);
+		img.overlap = IHRO_ERROR;
+		assert(!ihr_image_put(&img, 0, sizeof(old), old));
+		if (file_type == IHRT_I16) {
+			/* The record wraps within its segment: */
+			rec.type = IHRR_I_DATA;
+			rec.addr = 0xFFFE;
+			rec.size = sizeof(new);
+			rec.data.data = (IHR_U8 *)new;
+			assert(ihr_image_add(&img, &rec) == -IHRE_OVERLAP);
+		} else {
+			/* The data wrap at the top of the address space: */
+			assert(ihr_image_put(&img, 0xFFFFFFFE, sizeof(new), new)
+				== -IHRE_OVERLAP);
+		}
+		assert(img.count == 1);
+		assert(img.segs[0].addr == 0 && img.segs[0].size == 2);
+		ihr_image_free(&img);
+	}
+}
+
+/* Reading a range through an index fails as the image does. */
+static void check_index(void)
+{
+	struct ihr_index index;
+	struct ihr_image img;
+	struct ihr_error err;
+	ihr_index_init(&index, IHRT_I8);
+	assert(!ihr_index_build(&index, strlen(text), text, &err));
+	ihr_image_init(&img, IHRT_I8);
+	img.overlap = IHRO_ERROR;
+	assert(ihr_index_get(&index, strlen(text), text, 4, 4, &img)
+		== -IHRE_OVERLAP);
+	ihr_image_free(&img);
+	ihr_index_free(&index);
+}
+
+int main(void)
+{
+	check_policy(IHRO_LAST_WINS);
+	check_policy(IHRO_FIRST_WINS);
+	check_policy(IHRO_ERROR);
+	check_read();
+	check_pieces();
+	check_index();
+	return 0;
+}
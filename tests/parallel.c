@@ -0,0 +1,175 @@
+#include "../test.h"
+#include <string.h>
+
+#define TEXT_SIZE (1 << 20)
+
+static char text[TEXT_SIZE];
+static size_t text_len;
+
+/* Append an Intel HEX record, or an SREC one if type is negative (-1 for S3,
+ * -7 for S7.) */
+static void append(int type, IHR_U16 addr, int size, const IHR_U8 *data)
+{
+	IHR_U8 bytes[IHR_MAX_SIZE + 5];
+	IHR_U8 cksum = 0;
+	int n = 0, i;
+	if (type >= 0) {
+		text[text_len++] = ':';
+		bytes[n++] = size;
+		bytes[n++] = addr >> 8;
+		bytes[n++] = addr;
+		bytes[n++] = type;
+	} else {
+		text[text_len++] = 'S';
+		text[text_len++] = '0' - type;
+		bytes[n++] = size + 5;
+		bytes[n++] = data[0];
+		bytes[n++] = data[1];
+		bytes[n++] = addr >> 8;
+		bytes[n++] = addr;
+		data += 2;
+	}
+	for (i = 0; i < size; ++i) bytes[n++] = data[i];
+	for (i = 0; i < n; ++i) cksum += bytes[i];
+	bytes[n++] = type >= 0 ? ~cksum + 1 : ~cksum;
+	for (i = 0; i < n; ++i) {
+		sprintf(text + text_len, "%02X", bytes[i]);
+		text_len += 2;
+	}
+	switch (next_random() % 8) {
+	case 0:
+		text[text_len++] = '\r';
+		break;
+	case 1:
+		text[text_len++] = '\n';
+		/* FALLTHROUGH */
+	default:
+		text[text_len++] = '\n';
+	}
+}
+
+/* Fill text with random records, mostly in order. */
+static void make_text(int file_type)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	IHR_U16 addr = 0;
+	text_len = 0;
+	while (text_len < TEXT_SIZE - 1200) {
+		int size = 1 + next_random() % 40, i;
+		for (i = 0; i < size; ++i) data[i] = next_random();
+		if (next_random() % 50 == 0) {
+			if (file_type == IHRT_I16) append(2, 0, 2, data);
+			if (file_type == IHRT_I32) append(4, 0, 2, data);
+		}
+		if (next_random() % 20 == 0) addr = next_random();
+		if (file_type == IHRT_S37) {
+			append(-3, addr, size, data);
+		} else {
+			append(0, addr, size, data);
+		}
+		addr += size;
+	}
+}
+
+/* Insert a line after the first line feed after offset. */
+static void insert(size_t offset, const char *line)
+{
+	char *at = strchr(text + offset, '\n') + 1;
+	size_t len = strlen(line);
+	memmove(at + len, at, text_len - (at - text));
+	memcpy(at, line, len);
+	text_len += len;
+}
+
+/* Put a record which is cut short just before offset, where a line feed is put,
+ * blanking out the rest of the lines it is put on. */
+static void cut_short(size_t offset, const char *record)
+{
+	size_t len = strlen(record), i = offset - len;
+	while (i > 0 && text[i - 1] != '\n' && text[i - 1] != '\r')
+		text[--i] = '\n';
+	memcpy(text + offset - len, record, len);
+	for (i = offset; i < text_len && text[i] != '\n' && text[i] != '\r';
+			++i)
+		text[i] = '\n';
+	text[offset] = '\n';
+}
+
+static void assert_same(const struct ihr_image *a, const struct ihr_image *b)
+{
+	size_t i;
+	assert(a->count == b->count);
+	assert(a->start_type == b->start_type);
+	assert(a->start == b->start);
+	assert(a->base == b->base);
+	for (i = 0; i < a->count; ++i) {
+		assert(a->segs[i].addr == b->segs[i].addr);
+		assert(a->segs[i].size == b->segs[i].size);
+		assert(!memcmp(a->segs[i].data, b->segs[i].data,
+			a->segs[i].size));
+	}
+}
+
+/* Read text record by record and in parallel, comparing the results. */
+static void compare(int file_type)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_image seq, par;
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	struct ihr_error err;
+	int seq_status = 0, reclen, threads;
+	size_t line = 0, column = 0;
+	ihr_image_init(&seq, file_type);
+	ihr_iter_init(&iter, file_type, text_len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		if (reclen < 0) {
+			seq_status = rec.type;
+			line = iter.line;
+			column = ~reclen;
+			break;
+		}
+		if ((seq_status = ihr_image_add(&seq, &rec)) != 0) break;
+	}
+	assert(!ihr_image_flush(&seq));
+	for (threads = 1; threads <= 9; threads += 2) {
+		ihr_image_init(&par, file_type);
+		assert(ihr_image_read(&par, text_len, text, threads, &err)
+			== seq_status);
+		if (seq_status < 0) {
+			assert(err.code == -seq_status);
+			assert(err.line == line);
+			assert(err.column == column);
+		}
+		assert_same(&seq, &par);
+		ihr_image_free(&par);
+	}
+	ihr_image_free(&seq);
+}
+
+int main(void)
+{
+	static const int types[] = {IHRT_I8, IHRT_I16, IHRT_I32, IHRT_S37};
+	size_t i;
+	random_seed = 3;
+	for (i = 0; i < sizeof(types) / sizeof(*types); ++i) {
+		int file_type = types[i];
+		char *mid;
+		make_text(file_type);
+		compare(file_type);
+		/* Stop at an error partway through: */
+		mid = strchr(text + text_len / 3 * 2, '\n') + 1;
+		mid[9] = 'x';
+		compare(file_type);
+		/* Stop at a record which is cut short at the end of a piece,
+		 * with the error it has in the whole text: */
+		make_text(file_type);
+		cut_short(text_len / 3, file_type == IHRT_S37 ? "S300" : ":00");
+		compare(file_type);
+		/* Stop at the end of the file: */
+		insert(text_len / 3, file_type == IHRT_S37 ?
+			"S70500000000FA\n" : ":00000001FF\n");
+		compare(file_type);
+	}
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "../test.h"
+#include <string.h>
+
+static char text[1 << 16];
+/* Read each record of the text with the reader and with ihr_read, which must
+ * agree, for file_type and for every other file type. */
+static void check(int text_type, size_t len)
+{
+	IHR_U8 data[IHR_MAX_SIZE], data2[IHR_MAX_SIZE];
+	struct ihr_record rec, rec2;
+	int file_type;
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		ihr_read_fn *read = ihr_reader(file_type);
+		size_t at = 0;
+		assert(read);
+		while (at < len) {
+			int reclen, reclen2;
+			rec.data.data = data;
+			rec2.data.data = data2;
+			reclen = read(len - at, text + at, &rec);
+			reclen2 = ihr_read(file_type, len - at, text + at, &rec2);
+			assert(reclen == reclen2);
+			assert(rec.type == rec2.type);
+			if (reclen < 0) {
+				assert(file_type != text_type);
+				break;
+			}
+			assert(rec.size == rec2.size);
+			assert(rec.addr == rec2.addr);
+			if (rec.type == IHRR_I_DATA || text_type >= IHRT_S19)
+				assert(!memcmp(data, data2, rec.size));
+			at += reclen;
+		}
+	}
+}
+
+int main(void)
+{
+	static const char changes[] = "0F9aG:S\r\n x";
+	int file_type, trial;
+	assert(!ihr_reader(-1));
+	assert(!ihr_reader(IHRT_S37 + 1));
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		/* Records of random data of all sizes: */
+		struct text_shape shape = {0, 0, 1024, 0, 0, 0};
+		size_t len;
+		shape.file_type = file_type;
+		len = write_text(&shape, sizeof(text), text);
+		check(file_type, len);
+		for (trial = 0; trial < 100; ++trial) {
+			size_t at = next_random() * 7 % len;
+			char old = text[at];
+			text[at] = changes[next_random() % (sizeof(changes) - 1)];
+			check(-1, len);
+			text[at] = old;
+		}
+	}
+	return 0;
+}
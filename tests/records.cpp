@@ -0,0 +1,129 @@
+#include "../test.h"
+#include "../ihr.hpp"
+#include <algorithm>
+#include <cstring>
+
+static char text[1 << 12];
+static size_t text_len;
+
+/* Append an I32 record to text. */
+static void add(int type, IHR_U32 addr, size_t size, const char *data)
+{
+	struct ihr_record rec;
+	int n;
+	rec.type = type;
+	rec.addr = addr;
+	rec.size = size;
+	rec.data.data = (IHR_U8 *)data;
+	n = ihr_write(IHRT_I32, 0, &rec, text + text_len);
+	assert(n > 0);
+	text_len += n;
+}
+
+/* Append an extended linear address record to text. */
+static void add_base(IHR_U16 base)
+{
+	struct ihr_record rec;
+	rec.type = IHRR_I_EXT_LIN_ADDR;
+	rec.addr = 0;
+	rec.size = 2;
+	rec.data.ihex.base_addr = base;
+	text_len += ihr_write(IHRT_I32, 0, &rec, text + text_len);
+}
+
+static bool same(std::span<const std::byte> data, const char *want)
+{
+	return data.size() == std::strlen(want)
+		&& !std::memcmp(data.data(), want, data.size());
+}
+
+/* Read text as I32 and check every record. */
+static void check_i32(ihr::records &recs)
+{
+	int i = 0;
+	for (const auto &res : recs) {
+		assert(res.has_value());
+		switch (i++) {
+		case 0:
+			assert(res->type == IHRR_I_EXT_LIN_ADDR);
+			assert(res->data.empty());
+			assert(res->raw->data.ihex.base_addr == 0x1234);
+			break;
+		case 1:
+			assert(res->type == IHRR_I_DATA);
+			assert(res->addr == 0x12340010);
+			assert(same(res->data, "hello"));
+			assert(res->line == 2);
+			break;
+		case 3:
+			/* Data past the top of the address space wrap: */
+			assert(res->addr == 0xFFFFFFFE && same(res->data, "wr"));
+			break;
+		case 4:
+			assert(res->addr == 0 && same(res->data, "ap"));
+			assert(res->line == 4);
+			break;
+		case 5:
+			assert(res->type == IHRR_I_END_OF_FILE);
+			break;
+		}
+	}
+	/* Nothing after the end record is read: */
+	assert(i == 6);
+}
+
+int main(void)
+{
+	add_base(0x1234);
+	add(IHRR_I_DATA, 0x10, 5, "hello");
+	add_base(0xFFFF);
+	add(IHRR_I_DATA, 0xFFFE, 4, "wrap");
+	add(IHRR_I_END_OF_FILE, 0, 0, "");
+	add(IHRR_I_DATA, 0, 4, "late");
+	{
+		ihr::records recs(std::string_view(text, text_len), IHRT_I32);
+		check_i32(recs);
+		/* It stays at the end: */
+		assert(recs.begin() == recs.end());
+	}
+	{
+		/* The data are the same when decoded in place: */
+		static char copy[sizeof(text)];
+		std::memcpy(copy, text, text_len);
+		ihr::records recs(ihr::in_place,
+			std::span<char>(copy, text_len), IHRT_I32);
+		check_i32(recs);
+	}
+	{
+		ihr::records recs(std::string_view(text, text_len), IHRT_I32);
+		auto data = [](const ihr::result<ihr::record> &res) {
+			return res && res->type == IHRR_I_DATA;
+		};
+		assert(std::count_if(recs.begin(), recs.end(), data) == 3);
+	}
+	{
+		ihr::records recs(std::string_view(text, text_len), IHRT_I32);
+		auto it = std::ranges::find_if(recs,
+			[](const ihr::result<ihr::record> &res) {
+				return res && res->type == IHRR_I_DATA
+					&& res->addr == 0;
+			});
+		assert(it != recs.end() && same((*it)->data, "ap"));
+	}
+	{
+		/* Errors say where they are, and reading goes on after them: */
+		const char *bad = ":0100000041BE\n:0100010042BD\n:0100020043BA\n";
+		ihr::records recs(bad, IHRT_I8);
+		auto it = recs.begin();
+		assert(it != recs.end() && (*it)->addr == 0);
+		++it;
+		assert(!*it);
+		assert(it->error().code == IHRE_INVALID_CHECKSUM);
+		assert(it->error().line == 2);
+		++it;
+		assert(*it && (*it)->addr == 2 && same((*it)->data, "C"));
+		++it;
+		assert(it == recs.end());
+	}
+	return 0;
+}
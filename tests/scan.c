@@ -0,0 +1,84 @@
+#include "../test.h"
+#include <string.h>
+
+static char text[1 << 16];
+/* Write records with random line endings and blank lines between them, and
+ * sometimes a stray line or a bad record. */
+static size_t write_endings(int stray)
+{
+	static const char *const endings[] = {"\n", "\r\n", "\r", "\n\n",
+		"\r\n\r\n", "\r\r\n", "\n\r"};
+	IHR_U8 data[64];
+	struct ihr_record rec;
+	size_t len = 0, i;
+	while (len < sizeof(text) - IHR_MAX_LENGTH - 16) {
+		const char *ending = endings[next_random() % 7];
+		int n;
+		rec.type = IHRR_I_DATA;
+		rec.size = next_random() % sizeof(data);
+		rec.addr = next_random();
+		rec.data.data = data;
+		for (i = 0; i < rec.size; ++i) data[i] = next_random();
+		n = ihr_write(IHRT_I8, 0, &rec, text + len);
+		assert(n > 0);
+		len += n - 1; /* Without its line ending */
+		if (next_random() % 50 == 0) text[len - 3] = 'x';
+		if (stray && next_random() % 200 == 0) text[len - n + 1] = '#';
+		memcpy(text + len, ending, strlen(ending));
+		len += strlen(ending);
+	}
+	/* The last record need not end the line: */
+	if (next_random() % 2) len -= text[len - 1] == '\n' ? 1 : 0;
+	return len;
+}
+
+static void check(size_t len)
+{
+	IHR_U8 data[IHR_MAX_SIZE], data2[IHR_MAX_SIZE];
+	struct ihr_lines lines;
+	struct ihr_iter iter;
+	struct ihr_record rec, rec2;
+	size_t i = 0, stray = (size_t)-1;
+	int reclen;
+	ihr_lines_init(&lines);
+	assert(!ihr_scan(&lines, IHRT_I8, len, text));
+	assert(lines.starts[lines.count] == len);
+	ihr_iter_init(&iter, IHRT_I8, len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) != 0) {
+		int reclen2;
+		assert(i < lines.count);
+		assert(lines.starts[i] == iter.offset);
+		assert(lines.numbers[i] == iter.line);
+		if (text[iter.offset] != ':' && stray == (size_t)-1) stray = i;
+		/* Each record can be read on its own: */
+		rec2.data.data = data2;
+		reclen2 = ihr_read(IHRT_I8, lines.starts[i + 1] - lines.starts[i],
+			text + lines.starts[i], &rec2);
+		assert(reclen2 == reclen);
+		assert(rec2.type == rec.type);
+		if (reclen > 0) assert(!memcmp(data, data2, rec.size));
+		++i;
+	}
+	assert(i == lines.count);
+	assert(lines.stray == (stray == (size_t)-1 ? lines.count : stray));
+	ihr_lines_free(&lines);
+}
+
+int main(void)
+{
+	static const char *const small[] = {"", "\n", "\r\n\r", ":", "\r:",
+		"x\n\n:\r\r\n"};
+	size_t i;
+	int trial;
+	for (i = 0; i < sizeof(small) / sizeof(*small); ++i) {
+		strcpy(text, small[i]);
+		check(strlen(small[i]));
+	}
+	for (trial = 0; trial < 20; ++trial) {
+		size_t len = write_endings(trial % 2);
+		check(len);
+		/* Cut anywhere, even within "\r\n": */
+		check(next_random() * 3 % len);
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include "../test.h"
+#include <string.h>
+
+#ifdef IHR_STATS
+static char text[1 << 20];
+
+/* Write many data records with an extended address record now and then. */
+static size_t write_even(void)
+{
+	IHR_U8 data[16];
+	struct ihr_record rec;
+	size_t len = 0;
+	IHR_U16 n = 0;
+	rec.data.data = data;
+	memset(data, 0xA5, sizeof(data));
+	while (len < sizeof(text) - IHR_MAX_LENGTH) {
+		if (n % 100 == 0) {
+			rec.type = IHRR_I_EXT_LIN_ADDR;
+			rec.size = 2;
+			rec.addr = 0;
+			rec.data.ihex.base_addr = n / 100;
+		} else {
+			rec.type = IHRR_I_DATA;
+			rec.size = sizeof(data);
+			rec.addr = n % 100 * sizeof(data);
+			rec.data.data = data;
+		}
+		len += ihr_write(IHRT_I32, 0, &rec, text + len);
+		++n;
+	}
+	return len;
+}
+
+static void check_iter(void)
+{
+	static char small[] =
+		":0B0010006164647265737320676170A7\n"
+		"\r\n"
+		":0B0010006164647265737320676170A8\n"
+		":00000001FF\n"
+		"\n";
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_stats stats;
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	ihr_stats_init(&stats);
+	ihr_stats_use(&stats);
+	assert(ihr_stats_current() == &stats);
+	ihr_iter_init(&iter, IHRT_I8, strlen(small), small, data);
+	while (ihr_iter_next(&iter, &rec) != 0);
+	ihr_stats_use(NULL);
+	assert(stats.records[IHRR_I_DATA] == 1);
+	assert(stats.records[IHRR_I_END_OF_FILE] == 1);
+	assert(stats.errors[IHRE_INVALID_CHECKSUM] == 1);
+	assert(stats.bytes == 11);
+	assert(stats.lines == 5);
+	/* Nothing is counted when no stats are in use: */
+	ihr_iter_init(&iter, IHRT_I8, strlen(small), small, data);
+	while (ihr_iter_next(&iter, &rec) != 0);
+	assert(stats.records[IHRR_I_DATA] == 1);
+}
+
+/* Counting on many threads counts each record once. */
+static void check_threads(void)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_stats serial, parallel, both;
+	struct ihr_image img;
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	struct ihr_error err;
+	size_t len = write_even();
+	int i;
+	ihr_stats_init(&serial);
+	ihr_stats_use(&serial);
+	ihr_iter_init(&iter, IHRT_I32, len, text, data);
+	while (ihr_iter_next(&iter, &rec) > 0);
+	ihr_stats_init(&parallel);
+	ihr_stats_use(&parallel);
+	ihr_image_init(&img, IHRT_I32);
+	assert(!ihr_image_read(&img, len, text, 4, &err));
+	ihr_image_free(&img);
+	ihr_stats_use(NULL);
+	for (i = 0; i < IHR_STATS_TYPES; ++i) {
+		assert(serial.records[i] == parallel.records[i]);
+		assert(parallel.errors[i] == 0);
+	}
+	assert(serial.bytes == parallel.bytes);
+	assert(serial.lines == parallel.lines);
+	assert(parallel.ticks[IHRS_DECODE] >= 0);
+	assert(parallel.ticks[IHRS_PLACE] >= 0);
+	ihr_stats_init(&both);
+	ihr_stats_merge(&both, &serial);
+	ihr_stats_merge(&both, &parallel);
+	assert(both.records[IHRR_I_DATA] == 2 * serial.records[IHRR_I_DATA]);
+	assert(both.bytes == 2 * serial.bytes);
+}
+#endif /* IHR_STATS */
+
+int main(void)
+{
+#ifdef IHR_STATS
+	check_iter();
+	check_threads();
+#endif
+	return 0;
+}
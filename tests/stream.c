@@ -0,0 +1,256 @@
+#include "../test.h"
+#include <string.h>
+
+#define TEXT_SIZE (1 << 16)
+#define MAX_RESULTS (TEXT_SIZE / 2)
+
+static char text[TEXT_SIZE];
+static size_t text_len;
+
+/* What became of a line: */
+static struct result {
+	int type;
+	IHR_U8 size;
+	IHR_U32 addr;
+	IHR_U32 value; /* Sum of data bytes, or the special Intel HEX field */
+	size_t line;
+	size_t column;
+} expected[MAX_RESULTS], got[MAX_RESULTS];
+static size_t n_expected, n_got;
+
+static void append_hex(IHR_U8 byte)
+{
+	sprintf(text + text_len, "%02X", byte);
+	text_len += 2;
+}
+
+/* Append a good record of a type valid for the file type. */
+static void append_record(int file_type)
+{
+	IHR_U8 bytes[IHR_MAX_SIZE + 5];
+	IHR_U8 cksum = 0;
+	int n = 0, size, i;
+	if (file_type <= IHRT_I32) {
+		static const int types[] = {0, 0, 0, 0, 1, 2, 3, 4, 5};
+		static const int sizes[] = {-1, 0, 2, 4, 2, 4};
+		int type;
+		do {
+			type = types[next_random() % 9];
+		} while ((type == 2 || type == 3) && file_type != IHRT_I16
+		      || (type == 4 || type == 5) && file_type != IHRT_I32);
+		size = sizes[type] < 0 ? next_random() % 40 : sizes[type];
+		text[text_len++] = ':';
+		bytes[n++] = size;
+		bytes[n++] = next_random();
+		bytes[n++] = next_random();
+		bytes[n++] = type;
+		for (i = 0; i < size; ++i) bytes[n++] = next_random();
+		for (i = 0; i < n; ++i) cksum += bytes[i];
+		bytes[n++] = ~cksum + 1;
+	} else {
+		static const int types[] = {0, 1, 2, 3, 5, 6, 7, 8, 9};
+		int type, addr_size;
+		do {
+			type = types[next_random() % 9];
+		} while (type == 6 && file_type == IHRT_S19
+		      || (type == 1 || type == 9) && file_type != IHRT_S19
+		      || (type == 2 || type == 8) && file_type != IHRT_S28
+		      || (type == 3 || type == 7) && file_type != IHRT_S37);
+		addr_size = type == 2 || type == 6 || type == 8 ? 3
+			: type == 3 || type == 7 ? 4 : 2;
+		size = type <= 3 ? next_random() % 40 : 0;
+		text[text_len++] = 'S';
+		text[text_len++] = '0' + type;
+		bytes[n++] = size + addr_size + 1;
+		for (i = 0; i < addr_size + size; ++i) bytes[n++] = next_random();
+		for (i = 0; i < n; ++i) cksum += bytes[i];
+		bytes[n++] = ~cksum;
+	}
+	for (i = 0; i < n; ++i) append_hex(bytes[i]);
+}
+
+/* Fill text with records and blank lines, then damage some of it. */
+static void make_text(int file_type)
+{
+	static const char *const endings[] = {"\n", "\r\n", "\r", "\n\n"};
+	size_t i;
+	text_len = 0;
+	while (text_len < TEXT_SIZE - 600) {
+		append_record(file_type);
+		strcpy(text + text_len, endings[next_random() % 4]);
+		text_len += strlen(text + text_len);
+	}
+	for (i = 0; i < text_len / 200; ++i) {
+		static const char junk[] = "\n\r0Fx :S";
+		size_t at = next_random() % text_len;
+		switch (next_random() % 3) {
+		case 0:
+			/* Replace a character: */
+			text[at] = junk[next_random() % (sizeof(junk) - 1)];
+			break;
+		case 1:
+			/* Delete a character: */
+			memmove(text + at, text + at + 1, text_len - at - 1);
+			--text_len;
+			break;
+		case 2:
+			/* Insert a character: */
+			memmove(text + at + 1, text + at, text_len - at);
+			text[at] = junk[next_random() % (sizeof(junk) - 1)];
+			++text_len;
+			break;
+		}
+	}
+}
+
+static void note(struct result *res,
+	const struct ihr_record *rec,
+	int file_type)
+{
+	int i;
+	res->type = rec->type;
+	if (rec->type < 0) return;
+	res->size = rec->size;
+	res->addr = rec->addr;
+	res->value = 0;
+	switch (file_type <= IHRT_I32 ? rec->type : IHRR_I_DATA) {
+	case IHRR_I_EXT_SEG_ADDR:
+	case IHRR_I_EXT_LIN_ADDR:
+		res->value = rec->data.ihex.base_addr;
+		break;
+	case IHRR_I_START_SEG_ADDR:
+		res->value = rec->data.ihex.start.code_seg;
+		break;
+	case IHRR_I_START_LIN_ADDR:
+		res->value = rec->data.ihex.ext_instr_ptr;
+		break;
+	default:
+		for (i = 0; i < rec->size; ++i) {
+			res->value += rec->data.data[i];
+		}
+		break;
+	}
+}
+
+/* Read text one line at a time with ihr_read, like the README example. */
+static void read_lines(int file_type)
+{
+	IHR_U8 buf[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	size_t idx = 0, line = 1;
+	n_expected = 0;
+	while (idx < text_len) {
+		size_t end = idx;
+		int reclen;
+		if (text[idx] == '\n' || text[idx] == '\r') {
+			if (text[idx] == '\r' && idx + 1 < text_len
+			 && text[idx + 1] == '\n') ++idx;
+			++idx;
+			++line;
+			continue;
+		}
+		while (end < text_len && text[end] != '\n' && text[end] != '\r')
+			++end;
+		if (end < text_len) {
+			if (text[end] == '\r' && end + 1 < text_len
+			 && text[end + 1] == '\n') ++end;
+			++end;
+		}
+		rec.data.data = buf;
+		reclen = ihr_read(file_type, end - idx, text + idx, &rec);
+		note(&expected[n_expected], &rec, file_type);
+		expected[n_expected].line = line;
+		expected[n_expected].column = reclen < 0 ? ~reclen : 0;
+		++n_expected;
+		idx = end;
+		++line;
+	}
+}
+
+static int note_record(void *ctx, const struct ihr_record *rec)
+{
+	note(&got[n_got], rec, *(int *)ctx);
+	got[n_got].line = 0;
+	got[n_got].column = 0;
+	++n_got;
+	return 0;
+}
+
+/* Read text in pieces of random sizes with a stream. */
+static void read_stream(int file_type, size_t max_piece)
+{
+	struct ihr_stream stream;
+	size_t idx = 0;
+	int status;
+	n_got = 0;
+	ihr_stream_init(&stream, file_type);
+	while (idx < text_len) {
+		size_t piece = 1 + next_random() % max_piece;
+		if (piece > text_len - idx) piece = text_len - idx;
+		while ((status = ihr_stream_feed(&stream, piece, text + idx,
+				note_record, &file_type)) < 0) {
+			got[n_got].type = status;
+			got[n_got].line = stream.err.line;
+			got[n_got].column = stream.err.column;
+			++n_got;
+			idx += stream.used;
+			piece -= stream.used;
+		}
+		assert(status == 0);
+		assert(stream.used == piece);
+		idx += piece;
+	}
+	if ((status = ihr_stream_end(&stream, note_record, &file_type)) < 0) {
+		got[n_got].type = status;
+		got[n_got].line = stream.err.line;
+		got[n_got].column = stream.err.column;
+		++n_got;
+	}
+}
+
+static void compare(void)
+{
+	size_t i;
+	for (i = 0; i < n_expected && i < n_got; ++i) {
+		struct result *e = &expected[i], *g = &got[i];
+		if (g->type < 0) {
+			if (g->type != e->type || g->line != e->line
+			 || g->column != e->column) {
+				fprintf(stderr, "result %lu: EXPECTED %d at "
+					"%lu:%lu, GOT %d at %lu:%lu\n",
+					(unsigned long)i, e->type,
+					(unsigned long)e->line,
+					(unsigned long)e->column,
+					g->type, (unsigned long)g->line,
+					(unsigned long)g->column);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			assert(g->type == e->type);
+			assert(g->size == e->size);
+			assert(g->addr == e->addr);
+			assert(g->value == e->value);
+		}
+	}
+	assert(n_expected == n_got);
+}
+
+int main(void)
+{
+	int file_type;
+	random_seed = 5;
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		int round;
+		for (round = 0; round < 4; ++round) {
+			make_text(file_type);
+			read_lines(file_type);
+			read_stream(file_type, 1);
+			compare();
+			read_stream(file_type, 7);
+			compare();
+			read_stream(file_type, 4096);
+			compare();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include "../test.h"
+#include <string.h>
+
+static char text[1 << 16], copy[sizeof(text)];
+/* Find the first error as reading with an iterator would. */
+static int first_error(int file_type, size_t len, struct ihr_error *err)
+{
+	IHR_U8 data[IHR_MAX_SIZE];
+	struct ihr_iter iter;
+	struct ihr_record rec;
+	int reclen;
+	ihr_iter_init(&iter, file_type, len, text, data);
+	while ((reclen = ihr_iter_next(&iter, &rec)) > 0);
+	err->code = reclen < 0 ? -rec.type : 0;
+	err->line = reclen < 0 ? iter.line : 0;
+	err->column = reclen < 0 ? ~reclen : 0;
+	return reclen < 0 ? rec.type : 0;
+}
+
+static void check(int file_type, size_t len)
+{
+	struct ihr_error want, got;
+	int status = first_error(file_type, len, &want);
+	memcpy(copy, text, len);
+	assert(ihr_validate(file_type, len, text, &got) == status);
+	assert(got.code == want.code);
+	assert(got.line == want.line);
+	assert(got.column == want.column);
+	/* Nothing is written: */
+	assert(!memcmp(copy, text, len));
+}
+
+int main(void)
+{
+	static const char changes[] = "0F9aG:S\r\n x";
+	int file_type, flags, trial;
+	for (file_type = IHRT_I8; file_type <= IHRT_S37; ++file_type) {
+		for (flags = 0; flags <= IHRW_CRLF; flags += IHRW_CRLF) {
+			/* Records of random data of all sizes: */
+			struct text_shape shape = {0, 0, 1024, 0, 0, 0};
+			struct ihr_error err;
+			size_t len;
+			shape.file_type = file_type;
+			shape.flags = flags;
+			len = write_text(&shape, sizeof(text), text);
+			assert(!ihr_validate(file_type, len, text, &err));
+			assert(err.code == 0);
+			for (trial = 0; trial < 200; ++trial) {
+				size_t at = next_random() * 7 % len;
+				char old = text[at];
+				text[at] = changes[next_random()
+					% (sizeof(changes) - 1)];
+				check(file_type, len);
+				text[at] = old;
+			}
+			/* Cutting the text anywhere: */
+			for (trial = 0; trial < 50; ++trial)
+				check(file_type, next_random() * 3 % len);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,168 @@
+#include "../test.h"
+#include <string.h>
+
+#define DATA_SIZE 3000
+
+static char text[1 << 16];
+static size_t text_len;
+
+/* Read each line and write it back, which should give the same line. */
+static void rewrite(int file_type, const char *const *lines, size_t count)
+{
+	IHR_U8 buf[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	char out[IHR_MAX_LENGTH];
+	size_t i;
+	for (i = 0; i < count; ++i) {
+		size_t len = strlen(lines[i]);
+		rec.data.data = buf;
+		read_or_die(file_type, len, lines[i], &rec, i + 1);
+		assert(ihr_write(file_type, 0, &rec, out) == (int)len + 1);
+		assert(!memcmp(out, lines[i], len) && out[len] == '\n');
+		assert(ihr_write(file_type, IHRW_CRLF, &rec, out)
+			== (int)len + 2);
+		assert(!memcmp(out + len, "\r\n", 2));
+	}
+}
+
+static void test_rewrite(void)
+{
+	static const char *const i16[] = {
+		":0B0010006164647265737320676170A7",
+		":10C20000E0A5E6F6FDFFE0AEE00FE6FCFDFFE6FD93",
+		":020000021000EC",
+		":0400000312345678E5",
+		":00000001FF"
+	};
+	static const char *const i32[] = {
+		":020000041234B4",
+		":0400000512345678E3"
+	};
+	static const char *const s19[] = {
+		"S00600004844521B",
+		"S1130000285F245F2212226A000424290008237C2A",
+		"S5030001FB",
+		"S9030000FC"
+	};
+	static const char *const s28[] = {
+		"S20712345601020356",
+		"S604000001FA",
+		"S8041234565F"
+	};
+	static const char *const s37[] = {
+		"S30689ABCDEF0900",
+		"S70589ABCDEF0A"
+	};
+	rewrite(IHRT_I16, i16, sizeof(i16) / sizeof(*i16));
+	rewrite(IHRT_I32, i32, sizeof(i32) / sizeof(*i32));
+	rewrite(IHRT_S19, s19, sizeof(s19) / sizeof(*s19));
+	rewrite(IHRT_S28, s28, sizeof(s28) / sizeof(*s28));
+	rewrite(IHRT_S37, s37, sizeof(s37) / sizeof(*s37));
+}
+
+static void test_errors(void)
+{
+	static IHR_U8 buf[IHR_MAX_SIZE];
+	struct ihr_record rec;
+	char out[IHR_MAX_LENGTH];
+	rec.type = IHRR_I_EXT_LIN_ADDR;
+	rec.data.ihex.base_addr = 0;
+	assert(ihr_write(IHRT_I16, 0, &rec, out) == -IHRE_INVALID_TYPE);
+	rec.type = IHRR_S1_DATA_16;
+	assert(ihr_write(IHRT_S37, 0, &rec, out) == -IHRE_INVALID_TYPE);
+	rec.type = IHRR_S3_DATA_32;
+	rec.size = IHR_MAX_SIZE - 4;
+	rec.data.data = buf;
+	assert(ihr_write(IHRT_S37, 0, &rec, out) == -IHRE_INVALID_SIZE);
+	rec.size = IHR_MAX_SIZE - 5;
+	assert(ihr_write(IHRT_S37, 0, &rec, out) == IHR_MAX_LENGTH - 10);
+}
+
+/* Write data at addr in pieces of text no bigger than cap, then end the file. */
+static void write_all(int file_type,
+	IHR_U32 addr,
+	size_t size,
+	const IHR_U8 *data,
+	size_t cap)
+{
+	struct ihr_writer writer;
+	struct ihr_record rec;
+	ihr_writer_init(&writer, file_type, 0);
+	text_len = 0;
+	while (size > 0) {
+		assert(ihr_write_data(&writer, addr, size, data, cap,
+			text + text_len) == 0);
+		assert(writer.used > 0 && writer.len <= cap);
+		text_len += writer.len;
+		addr += writer.used;
+		data += writer.used;
+		size -= writer.used;
+	}
+	rec.type = file_type <= IHRT_I32 ? IHRR_I_END_OF_FILE
+		: IHRR_S9_START_16 + IHRT_S19 - file_type;
+	rec.addr = 0;
+	text_len += ihr_write(file_type, 0, &rec, text + text_len);
+}
+
+static void test_round_trip(int file_type, IHR_U32 addr, size_t cap)
+{
+	static IHR_U8 data[DATA_SIZE];
+	struct ihr_image img;
+	struct ihr_error err;
+	size_t i;
+	for (i = 0; i < DATA_SIZE; ++i) data[i] = i * 7 + i / 256;
+	write_all(file_type, addr, DATA_SIZE, data, cap);
+	ihr_image_init(&img, file_type);
+	assert(ihr_image_read(&img, text_len, text, 1, &err) == 1);
+	if ((IHR_U32)(addr + DATA_SIZE) < addr) {
+		/* The data wrapped around to 0: */
+		size_t low = (IHR_U32)(addr + DATA_SIZE);
+		assert(img.count == 2);
+		assert(img.segs[0].addr == 0 && img.segs[0].size == low);
+		assert(!memcmp(img.segs[0].data, data + DATA_SIZE - low, low));
+		assert(img.segs[1].addr == addr);
+		assert(!memcmp(img.segs[1].data, data, DATA_SIZE - low));
+	} else {
+		assert(img.count == 1);
+		assert(img.segs[0].addr == addr);
+		assert(img.segs[0].size == DATA_SIZE);
+		assert(!memcmp(img.segs[0].data, data, DATA_SIZE));
+	}
+	ihr_image_free(&img);
+}
+
+static void test_limits(void)
+{
+	static const IHR_U8 data[4];
+	struct ihr_writer writer;
+	ihr_writer_init(&writer, IHRT_S19, 0);
+	assert(ihr_write_data(&writer, 0xFFFE, 4, data, sizeof(text), text)
+		== -IHRE_INVALID_ADDR);
+	assert(writer.used == 2);
+	ihr_writer_init(&writer, IHRT_I8, 0);
+	assert(ihr_write_data(&writer, 0x10000, 4, data, sizeof(text), text)
+		== -IHRE_INVALID_ADDR);
+	assert(writer.used == 0);
+	/* Too little room for a record: */
+	assert(ihr_write_data(&writer, 0, 4, data, 10, text) == 0);
+	assert(writer.used == 0 && writer.len == 0);
+	/* Smaller records: */
+	writer.rec_size = 1;
+	assert(ihr_write_data(&writer, 0, 4, data, sizeof(text), text) == 0);
+	assert(writer.len == 4 * 14);
+}
+
+int main(void)
+{
+	test_rewrite();
+	test_errors();
+	test_round_trip(IHRT_I8, 0x100, sizeof(text));
+	test_round_trip(IHRT_I16, 0x3FF00, 2 * IHR_MAX_LENGTH);
+	test_round_trip(IHRT_I32, 0x1234FF80, 2 * IHR_MAX_LENGTH);
+	test_round_trip(IHRT_I32, 0xFFFFFC00, sizeof(text));
+	test_round_trip(IHRT_S19, 0x1000, 2 * IHR_MAX_LENGTH);
+	test_round_trip(IHRT_S28, 0xFFF000, sizeof(text));
+	test_round_trip(IHRT_S37, 0xFFFFFF00, 2 * IHR_MAX_LENGTH);
+	test_limits();
+	return 0;
+}